@@ -0,0 +1,149 @@
+/**************************************************************************
+  Compares running the same graph of jobs every frame by rebuilding it
+  with Job::Create and AddDependency against replaying a TaskGraph
+
+  The graph is a number of layers of jobs, where each job depends on two
+  jobs from the layer before it.
+
+  Usage: GraphBenchmark [workers] [frames]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "Job.h"
+#include "Manager.h"
+#include "TaskGraph.h"
+
+using namespace JobBot;
+
+namespace
+{
+// Shape of the graph, 2000 jobs in total
+constexpr size_t scLayers = 20;
+constexpr size_t scWidth  = 100;
+
+typedef std::chrono::steady_clock Clock;
+
+void NodeJobFunc(Job* job)
+{
+  // A little bit of work so the jobs aren't completely empty
+  unsigned* value = job->GetData<unsigned*>();
+  for (unsigned i = 0; i < 64; ++i)
+  {
+    *value = *value * 1664525u + 1013904223u;
+  }
+}
+JobFunction NodeJob(NodeJobFunc);
+
+void FrameJobFunc(Job* job) { (void)job; }
+JobFunction FrameJob(FrameJobFunc);
+
+double Seconds(Clock::time_point start, Clock::time_point end)
+{
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/*
+    Make every job for a frame, link them up, submit them and wait
+*/
+double RunRebuilt(Manager& manager, unsigned* values)
+{
+  Clock::time_point start = Clock::now();
+
+  Job* frame = Job::Create(FrameJob);
+  std::vector<Job*> jobs(scLayers * scWidth);
+
+  for (size_t layer = 0; layer < scLayers; ++layer)
+  {
+    for (size_t i = 0; i < scWidth; ++i)
+    {
+      size_t index = layer * scWidth + i;
+      jobs[index]  = Job::CreateChild(NodeJob, &values[index], frame);
+
+      if (layer > 0)
+      {
+        size_t above = (layer - 1) * scWidth;
+        jobs[index]->AddDependency(jobs[above + i]);
+        jobs[index]->AddDependency(jobs[above + (i + 1) % scWidth]);
+      }
+    }
+  }
+
+  JobHandle handle = frame->GetHandle();
+  manager.SubmitJobs(jobs.data(), jobs.size());
+  manager.SubmitJob(frame);
+  manager.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  return Seconds(start, Clock::now());
+}
+
+/*
+    Run a graph built ahead of time
+*/
+double RunReplayed(Manager& manager, TaskGraph& graph)
+{
+  Clock::time_point start = Clock::now();
+  graph.RunAndWait(manager);
+  return Seconds(start, Clock::now());
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+  unsigned frames  = 200;
+  if (argc > 1) workers = std::max(1, std::atoi(argv[1]));
+  if (argc > 2) frames = std::max(1, std::atoi(argv[2]));
+
+  Manager manager(workers);
+  std::vector<unsigned> values(scLayers * scWidth, 1);
+
+  TaskGraph graph;
+  for (size_t layer = 0; layer < scLayers; ++layer)
+  {
+    for (size_t i = 0; i < scWidth; ++i)
+    {
+      TaskGraph::Node node =
+          graph.AddNode(NodeJob, &values[layer * scWidth + i]);
+
+      if (layer > 0)
+      {
+        TaskGraph::Node above = static_cast<TaskGraph::Node>(
+            (layer - 1) * scWidth);
+        graph.AddDependency(above + static_cast<TaskGraph::Node>(i), node);
+        graph.AddDependency(
+            above + static_cast<TaskGraph::Node>((i + 1) % scWidth), node);
+      }
+    }
+  }
+
+  double rebuiltTotal = 0, replayedTotal = 0;
+  double rebuiltBest = 1e30, replayedBest = 1e30;
+  for (unsigned frame = 0; frame < frames; ++frame)
+  {
+    double rebuilt  = RunRebuilt(manager, &values[0]);
+    double replayed = RunReplayed(manager, graph);
+
+    rebuiltTotal += rebuilt;
+    replayedTotal += replayed;
+    rebuiltBest  = std::min(rebuiltBest, rebuilt);
+    replayedBest = std::min(replayedBest, replayed);
+  }
+
+  std::printf("workers: %u, frames: %u, jobs per frame: %zu\n", workers,
+              frames, scLayers * scWidth);
+  std::printf("rebuilt each frame:  mean %8.1f us  best %8.1f us\n",
+              rebuiltTotal / frames * 1e6, rebuiltBest * 1e6);
+  std::printf("TaskGraph replay:    mean %8.1f us  best %8.1f us\n",
+              replayedTotal / frames * 1e6, replayedBest * 1e6);
+
+  return 0;
+}
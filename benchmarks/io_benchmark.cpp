@@ -0,0 +1,170 @@
+/**************************************************************************
+  Shows how much CPU work gets done while IO jobs are stuck waiting
+
+  A thread that is not a worker keeps a number of IO jobs going, each of
+  which sleeps to stand in for a slow read, and keeps the workers fed with
+  small CPU jobs, counting how many of those finish in time. IO jobs count
+  as blocking, and this is run with compensating workers on and off, to
+  show the CPU jobs keep going while the workers that took the IO jobs are
+  blocked.
+
+  Usage: IOBenchmark [workers] [ioJobs] [milliseconds]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "Job.h"
+#include "Manager.h"
+#include "Worker.h"
+
+using namespace JobBot;
+
+namespace
+{
+// Time each CPU job keeps a worker busy for
+constexpr std::chrono::microseconds scCpuWork(20);
+// Time each IO job is blocked for
+constexpr std::chrono::milliseconds scIOWait(20);
+// CPU jobs kept waiting per worker, topped up every millisecond
+constexpr int scCpuBacklog = 100;
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+    Keep a worker busy without sleeping
+*/
+void Spin(std::chrono::microseconds time)
+{
+  Clock::time_point end = Clock::now() + time;
+  while (Clock::now() < end)
+  {
+  }
+}
+
+/*
+    Everything the jobs need to know about the run
+*/
+struct Run
+{
+  Manager* manager;
+  std::atomic_bool running;
+  std::atomic_int outstanding;
+  std::atomic<std::uint64_t> cpuJobs;
+  std::atomic<std::uint64_t> ioJobs;
+};
+
+/*
+    Make a CPU job, which only counts if it finishes before time is up
+*/
+Job* MakeCpuJob(Run& run)
+{
+  ++run.outstanding;
+  return Job::Create([&run]() {
+    Spin(scCpuWork);
+    if (run.running)
+    {
+      ++run.cpuJobs;
+    }
+    --run.outstanding;
+  });
+}
+
+/*
+    Make an IO job that blocks for a while
+*/
+Job* MakeIOJob(Run& run)
+{
+  ++run.outstanding;
+  return Job::Create(
+      [&run]() {
+        std::this_thread::sleep_for(scIOWait);
+        ++run.ioJobs;
+        --run.outstanding;
+      },
+      JobType::IO);
+}
+
+void RunStalls(const char* name, size_t maxCompensating, unsigned workers,
+               unsigned ioJobs, unsigned milliseconds)
+{
+  Manager manager(workers);
+  manager.SetMaxCompensatingWorkers(maxCompensating);
+
+  Run run;
+  run.manager     = &manager;
+  run.running     = true;
+  run.outstanding = 0;
+  run.cpuJobs     = 0;
+  run.ioJobs      = 0;
+
+  std::atomic_bool done(false);
+  std::thread submitter([&]() {
+    const Clock::time_point end =
+        Clock::now() + std::chrono::milliseconds(milliseconds);
+    Clock::time_point nextIO = Clock::now();
+    while (Clock::now() < end)
+    {
+      // Always have IO jobs going, about ioJobs of them at once
+      if (Clock::now() >= nextIO)
+      {
+        for (unsigned i = 0; i < ioJobs; ++i)
+        {
+          manager.SubmitJob(MakeIOJob(run));
+        }
+        nextIO += scIOWait;
+      }
+
+      // Keep the CPU jobs coming through the shared queues, where the
+      // IO jobs are too, so the workers keep taking both
+      while (run.outstanding.load() <
+             scCpuBacklog * static_cast<int>(workers))
+      {
+        manager.SubmitJob(MakeCpuJob(run));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    run.running = false;
+    while (run.outstanding.load() != 0)
+    {
+      std::this_thread::yield();
+    }
+    done = true;
+  });
+
+  // The main thread is a worker too, and the only one if there is just one
+  Worker::GetThisThreadsWorker()->WorkWhileWaitingFor(done);
+  submitter.join();
+
+  std::printf("%-20s CPU jobs: %8llu (%7.1f per ms)  IO jobs: %6llu\n", name,
+              static_cast<unsigned long long>(run.cpuJobs.load()),
+              static_cast<double>(run.cpuJobs.load()) / milliseconds,
+              static_cast<unsigned long long>(run.ioJobs.load()));
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned workers      = 4;
+  unsigned ioJobs       = 4;
+  unsigned milliseconds = 1000;
+  if (argc > 1) workers = std::max(1, std::atoi(argv[1]));
+  if (argc > 2) ioJobs = std::max(0, std::atoi(argv[2]));
+  if (argc > 3) milliseconds = std::max(1, std::atoi(argv[3]));
+
+  std::printf("workers: %u, IO jobs at once: %u, run: %u ms\n", workers,
+              ioJobs, milliseconds);
+  RunStalls("compensating on", 64, workers, ioJobs, milliseconds);
+  RunStalls("compensating off", 0, workers, ioJobs, milliseconds);
+  RunStalls("no IO", 64, workers, 0, milliseconds);
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+/**************************************************************************
+  Shows how long jobs at each priority wait when the workers are flooded
+  with more urgent work than they can keep up with
+
+  Chains of the most urgent jobs, each submitting the next, keep every
+  worker busy, while a thread that is not a worker adds one job at each of
+  the other priorities every millisecond. Once the time is up the chains
+  stop and everything left is allowed to finish. This is run with priority
+  aging on and off, to show aging keeps the less urgent jobs from waiting
+  until the flood is over.
+
+  Usage: PriorityBenchmark [workers] [milliseconds]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "Job.h"
+#include "Manager.h"
+
+using namespace JobBot;
+
+namespace
+{
+// Time each of the flooding jobs keeps a worker busy for
+constexpr std::chrono::microseconds scUrgentWork(10);
+// Time between adding jobs at the other priorities
+constexpr std::chrono::milliseconds scTrickleInterval(1);
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+    Keep a worker busy without sleeping
+*/
+void Spin(std::chrono::microseconds time)
+{
+  Clock::time_point end = Clock::now() + time;
+  while (Clock::now() < end)
+  {
+  }
+}
+
+/*
+    Everything the jobs need to know about the run
+*/
+struct Flood
+{
+  Manager* manager;
+  std::atomic_bool flooding;
+  std::atomic_int outstanding;
+};
+
+/*
+    Make a job at some priority that counts itself down when it has run.
+    Urgent jobs keep the flood going by submitting another one
+*/
+Job* MakeJob(unsigned priority, Flood& flood)
+{
+  Job* job = Job::Create([priority, &flood]() {
+    if (priority == 0)
+    {
+      Spin(scUrgentWork);
+      if (flood.flooding.load())
+      {
+        flood.manager->SubmitJob(MakeJob(0, flood));
+      }
+    }
+    --flood.outstanding;
+  });
+  job->SetPriority(priority);
+  ++flood.outstanding;
+  return job;
+}
+
+void RunFlood(const char* name, std::chrono::microseconds aging,
+              unsigned workers, unsigned milliseconds)
+{
+  Manager manager(workers);
+  manager.SetPriorityAging(aging);
+  manager.SetWaitTracking(true);
+
+  Flood flood;
+  flood.manager     = &manager;
+  flood.flooding    = true;
+  flood.outstanding = 0;
+
+  std::thread submitter([&]() {
+    // Two chains per worker, so there is always urgent work waiting
+    for (unsigned i = 0; i < workers * 2; ++i)
+    {
+      manager.SubmitJob(MakeJob(0, flood));
+    }
+
+    const Clock::time_point end =
+        Clock::now() + std::chrono::milliseconds(milliseconds);
+    while (Clock::now() < end)
+    {
+      for (unsigned priority = 1; priority < Job::NUM_PRIORITIES; ++priority)
+      {
+        manager.SubmitJob(MakeJob(priority, flood));
+      }
+      std::this_thread::sleep_for(scTrickleInterval);
+    }
+
+    flood.flooding = false;
+    while (flood.outstanding.load() != 0)
+    {
+      std::this_thread::yield();
+    }
+  });
+  submitter.join();
+
+  Worker::PriorityStats stats = manager.GetPriorityStats();
+
+  std::printf("%s\n", name);
+  for (unsigned priority = 0; priority < Job::NUM_PRIORITIES; ++priority)
+  {
+    const std::uint64_t jobs = stats.timedJobs[priority];
+    std::printf("  priority %u: %8llu jobs  wait (us): mean %9.1f  "
+                "max %8llu  aged %6llu\n",
+                priority, static_cast<unsigned long long>(jobs),
+                (jobs != 0) ? static_cast<double>(stats.totalWait[priority]) /
+                                  jobs
+                            : 0.0,
+                static_cast<unsigned long long>(stats.maxWait[priority]),
+                static_cast<unsigned long long>(stats.agedJobs[priority]));
+  }
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned workers      = 4;
+  unsigned milliseconds = 1000;
+  if (argc > 1) workers = std::max(2, std::atoi(argv[1]));
+  if (argc > 2) milliseconds = std::max(1, std::atoi(argv[2]));
+
+  std::printf("workers: %u, flood: %u ms\n", workers, milliseconds);
+  RunFlood("aging 2 ms", std::chrono::microseconds(2000), workers,
+           milliseconds);
+  RunFlood("aging off", std::chrono::microseconds::zero(), workers,
+           milliseconds);
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+/**************************************************************************
+  Measures how job throughput scales with the number of workers
+
+  Two workloads are timed for every worker count from 1 to N:
+    flat  - many small jobs submitted from the main thread
+    split - a binary tree of jobs where every job submits its own children
+            from whatever worker is running it
+
+  Only uses the basic Job/Manager interface so the same file can be built
+  against older revisions for before/after comparisons.
+
+  Usage: ScalingBenchmark [maxWorkers] [repetitions]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "Job.h"
+#include "Manager.h"
+
+using namespace JobBot;
+
+namespace
+{
+// Number of jobs in the flat workload
+constexpr unsigned scFlatJobs = 16384;
+// Depth of the split workload's tree (2^depth leaves)
+constexpr int scSplitDepth = 13;
+// Amount of busy work in every job
+constexpr unsigned scWorkIterations = 256;
+
+volatile float sSink;
+
+void BusyWork(unsigned seed)
+{
+  float value = static_cast<float>(seed);
+  for (unsigned i = 0; i < scWorkIterations; ++i)
+  {
+    value = value * 0.999f + 1.0f;
+  }
+  sSink = value;
+}
+
+void FlatJobFunc(Job* job) { BusyWork(job->GetData<unsigned>()); }
+TinyJobFunction FlatJob(FlatJobFunc);
+
+struct SplitData
+{
+  Manager* manager;
+  int depth;
+};
+
+void SplitJobFunc(Job* job);
+JobFunction SplitJob(SplitJobFunc);
+
+void SplitJobFunc(Job* job)
+{
+  SplitData data = job->GetData<SplitData>();
+  BusyWork(static_cast<unsigned>(data.depth));
+
+  if (data.depth > 0)
+  {
+    SplitData childData = {data.manager, data.depth - 1};
+
+    job->SetAllowCompletion(false);
+    data.manager->SubmitJob(Job::CreateChild(SplitJob, childData, job));
+    data.manager->SubmitJob(Job::CreateChild(SplitJob, childData, job));
+    job->SetAllowCompletion(true);
+  }
+}
+
+void NoOpJobFunc(Job* job) { (void)job; }
+JobFunction NoOpJob(NoOpJobFunc);
+
+double RunFlat(Manager& manager)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  Job* root = Job::Create(NoOpJob);
+  root->SetAllowCompletion(false);
+  manager.SubmitJob(root);
+  for (unsigned i = 0; i < scFlatJobs; ++i)
+  {
+    manager.SubmitJob(Job::CreateChild(FlatJob, i, root));
+  }
+  root->SetAllowCompletion(true);
+
+  manager.GetThisThreadsWorker()->WorkWhileWaitingFor(root);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+double RunSplit(Manager& manager)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  SplitData data = {&manager, scSplitDepth};
+  Job* root      = Job::Create(SplitJob, data);
+  manager.SubmitJob(root);
+
+  manager.GetThisThreadsWorker()->WorkWhileWaitingFor(root);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+  unsigned repetitions = 5;
+  if (argc > 1) maxWorkers = std::max(1, std::atoi(argv[1]));
+  if (argc > 2) repetitions = std::max(1, std::atoi(argv[2]));
+
+  constexpr unsigned splitJobs = (2u << scSplitDepth) - 1;
+
+  std::printf("%8s %16s %16s\n", "workers", "flat (Mjobs/s)",
+              "split (Mjobs/s)");
+
+  for (unsigned workers = 1; workers <= maxWorkers; ++workers)
+  {
+    Manager manager(workers);
+
+    // Take the best of several runs to filter out scheduler noise
+    double bestFlat  = 1e30;
+    double bestSplit = 1e30;
+    for (unsigned rep = 0; rep < repetitions; ++rep)
+    {
+      bestFlat  = std::min(bestFlat, RunFlat(manager));
+      bestSplit = std::min(bestSplit, RunSplit(manager));
+    }
+
+    std::printf("%8u %16.3f %16.3f\n", workers,
+                scFlatJobs / bestFlat / 1e6, splitJobs / bestSplit / 1e6);
+  }
+
+  return 0;
+}
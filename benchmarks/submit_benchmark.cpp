@@ -0,0 +1,149 @@
+/**************************************************************************
+  Compares the cost of submitting jobs one at a time with SubmitJob against
+  submitting them in batches with SubmitJobs
+
+  Two cases are timed:
+    external - jobs made and submitted by a thread that is not a worker,
+               so every job goes through the shared queues
+    parallel for - ParallelForJob against ParallelForBulkJob, where the
+                   chunks are submitted from a worker
+
+  Usage: SubmitBenchmark [workers] [repetitions]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "Job.h"
+#include "Manager.h"
+#include "Utility.h"
+
+using namespace JobBot;
+
+namespace
+{
+// Number of jobs submitted in the external case
+constexpr size_t scExternalJobs = 32768;
+// Number of jobs handed to SubmitJobs at once
+constexpr size_t scBatchSize = 64;
+// Number of elements and chunk size for the parallel for case
+constexpr size_t scElements  = 1 << 20;
+constexpr size_t scChunkSize = 64;
+
+typedef std::chrono::steady_clock Clock;
+
+void NoOpJobFunc(Job* job) { (void)job; }
+TinyJobFunction NoOpJob(NoOpJobFunc);
+
+void AddOne(Job* job, int* data, size_t count)
+{
+  (void)job;
+  for (size_t i = 0; i < count; ++i)
+  {
+    ++data[i];
+  }
+}
+
+double Seconds(Clock::time_point start, Clock::time_point end)
+{
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/*
+    Submit jobs from a separate thread, returning the time spent submitting
+*/
+double RunExternal(Manager& manager, bool bulk)
+{
+  Job* root = Job::Create(NoOpJob);
+  root->SetAllowCompletion(false);
+
+  double submitTime = 0;
+  std::thread producer([&]() {
+    Job* batch[scBatchSize];
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < scExternalJobs; i += scBatchSize)
+    {
+      for (size_t j = 0; j < scBatchSize; ++j)
+      {
+        batch[j] = Job::CreateChild(NoOpJob, root);
+      }
+
+      if (bulk)
+      {
+        manager.SubmitJobs(batch, scBatchSize);
+      }
+      else
+      {
+        for (Job* job : batch)
+        {
+          manager.SubmitJob(job);
+        }
+      }
+    }
+    submitTime = Seconds(start, Clock::now());
+  });
+  producer.join();
+
+  manager.SubmitJob(root);
+  root->SetAllowCompletion(true);
+  manager.GetThisThreadsWorker()->WorkWhileWaitingFor(root);
+
+  return submitTime;
+}
+
+/*
+    Run a whole parallel for, returning the total time taken
+*/
+double RunParallelFor(Manager& manager, int* data, bool bulk)
+{
+  Clock::time_point start = Clock::now();
+
+  Job* job = bulk ? Utilities::ParallelForBulkJob<int>(
+                        &manager, AddOne, data, scElements, scChunkSize)
+                  : Utilities::ParallelForJob<int>(&manager, AddOne, data,
+                                                   scElements, scChunkSize);
+  manager.SubmitJob(job);
+  manager.GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+
+  return Seconds(start, Clock::now());
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned workers     = std::max(1u, std::thread::hardware_concurrency());
+  unsigned repetitions = 5;
+  if (argc > 1) workers = std::max(1, std::atoi(argv[1]));
+  if (argc > 2) repetitions = std::max(1, std::atoi(argv[2]));
+
+  Manager manager(workers);
+  std::vector<int> data(scElements, 0);
+
+  // Take the best of several runs to filter out scheduler noise
+  double single = 1e30, bulk = 1e30, forSingle = 1e30, forBulk = 1e30;
+  for (unsigned rep = 0; rep < repetitions; ++rep)
+  {
+    single    = std::min(single, RunExternal(manager, false));
+    bulk      = std::min(bulk, RunExternal(manager, true));
+    forSingle = std::min(forSingle, RunParallelFor(manager, &data[0], false));
+    forBulk   = std::min(forBulk, RunParallelFor(manager, &data[0], true));
+  }
+
+  std::printf("workers: %u\n", workers);
+  std::printf("external submit, SubmitJob:  %8.3f Mjobs/s\n",
+              scExternalJobs / single / 1e6);
+  std::printf("external submit, SubmitJobs: %8.3f Mjobs/s\n",
+              scExternalJobs / bulk / 1e6);
+  std::printf("ParallelForJob:              %8.3f ms\n", forSingle * 1e3);
+  std::printf("ParallelForBulkJob:          %8.3f ms\n", forBulk * 1e3);
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**************************************************************************
+  Measures how long it takes a sleeping worker to start running a job
+  after it has been submitted
+
+  Each sample lets the workers go idle, submits a single job from a thread
+  that is not a worker, and records the time until the job starts running.
+  This is repeated for each predefined idle policy, along with how long the
+  workers spent spinning, yielding and parked, to show the trade off
+  between wake up latency and CPU burned while idle.
+
+  Usage: WakeBenchmark [workers] [samples]
+
+  Author:
+  Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "Job.h"
+#include "Manager.h"
+
+using namespace JobBot;
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+struct WakeData
+{
+  Clock::time_point submitted;
+  std::atomic<long long>* latency;
+};
+
+void WakeJobFunc(Job* job)
+{
+  WakeData& data = job->GetData<WakeData>();
+  data.latency->store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          Clock::now() - data.submitted)
+                          .count());
+}
+JobFunction WakeJob(WakeJobFunc);
+
+/*
+    Time a number of wake ups, returning the latencies in nanoseconds
+*/
+std::vector<long long> MeasureWakeUps(Manager& manager, unsigned samples)
+{
+  std::vector<long long> latencies;
+  latencies.reserve(samples);
+
+  std::thread submitter([&]() {
+    std::atomic<long long> latency(-1);
+
+    for (unsigned i = 0; i < samples; ++i)
+    {
+      // Give the workers time to run out of work and go idle
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      latency = -1;
+      WakeData data = {Clock::now(), &latency};
+      manager.SubmitJob(Job::Create(WakeJob, data));
+
+      while (latency.load() < 0)
+      {
+        std::this_thread::yield();
+      }
+      latencies.push_back(latency.load());
+    }
+  });
+  submitter.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  return latencies;
+}
+
+void RunPolicy(const char* name, const Worker::IdlePolicy& policy,
+               unsigned workers, unsigned samples)
+{
+  Manager manager(workers, JobPool::scDefaultInitialCapacity,
+                  JobPool::scDefaultMaxCapacity, policy);
+
+  std::vector<long long> latencies = MeasureWakeUps(manager, samples);
+  Worker::IdleStats stats          = manager.GetIdleStats();
+
+  auto percentile = [&](double p) {
+    return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1e3;
+  };
+
+  std::printf("%-12s wake latency (us): p50 %7.1f  p90 %7.1f  p99 %7.1f  "
+              "max %7.1f\n",
+              name, percentile(0.5), percentile(0.9), percentile(0.99),
+              percentile(1.0));
+  std::printf("%-12s idle time (ms):    spin %7.1f  yield %6.1f  "
+              "park %7.1f\n",
+              "", stats.spinTime / 1e6, stats.yieldTime / 1e6,
+              stats.parkTime / 1e6);
+}
+}
+
+int main(int argc, char** argv)
+{
+  unsigned workers = 4;
+  unsigned samples = 500;
+  if (argc > 1) workers = std::max(2, std::atoi(argv[1]));
+  if (argc > 2) samples = std::max(1, std::atoi(argv[2]));
+
+  std::printf("workers: %u, samples: %u\n", workers, samples);
+  RunPolicy("LowLatency", Worker::IdlePolicy::LowLatency, workers, samples);
+  RunPolicy("Balanced", Worker::IdlePolicy::Balanced, workers, samples);
+  RunPolicy("PowerSaving", Worker::IdlePolicy::PowerSaving, workers, samples);
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**************************************************************************
+    Contains implementation of DeadlineQueue
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <algorithm>
+
+#include "DeadlineQueue.h"
+
+namespace JobBot
+{
+DeadlineQueue::DeadlineQueue() : nextOrder_(0), size_(0), earliest_(0) {}
+
+void DeadlineQueue::Push(Job* job, std::uint32_t deadline)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Entry entry = {deadline, nextOrder_++, job};
+  heap_.push_back(entry);
+  std::push_heap(heap_.begin(), heap_.end(), &Later);
+
+  earliest_.store(heap_.front().deadline, std::memory_order_relaxed);
+  size_.store(heap_.size(), std::memory_order_relaxed);
+}
+
+Job* DeadlineQueue::Pop()
+{
+  // Don't bother locking to find out there's nothing to take
+  if (size_.load(std::memory_order_relaxed) == 0) return nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (heap_.empty()) return nullptr;
+
+  std::pop_heap(heap_.begin(), heap_.end(), &Later);
+  Job* job = heap_.back().job;
+  heap_.pop_back();
+
+  if (!heap_.empty())
+  {
+    earliest_.store(heap_.front().deadline, std::memory_order_relaxed);
+  }
+  size_.store(heap_.size(), std::memory_order_relaxed);
+
+  return job;
+}
+
+bool DeadlineQueue::Peek(std::uint32_t& deadline) const
+{
+  if (size_.load(std::memory_order_relaxed) == 0) return false;
+
+  deadline = earliest_.load(std::memory_order_relaxed);
+  return true;
+}
+
+size_t DeadlineQueue::Size() const
+{
+  return size_.load(std::memory_order_relaxed);
+}
+
+bool DeadlineQueue::Later(const Entry& a, const Entry& b)
+{
+  // Compared by difference so ticks wrapping around doesn't matter
+  const std::int32_t difference =
+      static_cast<std::int32_t>(a.deadline - b.deadline);
+  return (difference != 0) ? (difference > 0) : (a.order > b.order);
+}
+}
@@ -0,0 +1,96 @@
+/**************************************************************************
+    Declaration of DeadlineQueue, which hands out jobs with a deadline
+    earliest deadline first
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _DEADLINEQUEUE_H
+#define _DEADLINEQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace JobBot
+{
+// Forward Declarations
+class Job;
+
+/*
+    Priority queue of jobs ordered by deadline, soonest first, with jobs
+    sharing a deadline coming out in the order they went in.
+
+    Deadlines are in the manager's microsecond ticks, which wrap around, so
+    only deadlines within half an hour or so of each other order correctly.
+
+    Only frame critical work is given a deadline, so there is never much in
+    here and a lock is cheaper than anything cleverer. The size and earliest
+    deadline can be looked at without taking it, so workers only lock the
+    queue when there is something to take.
+*/
+class DeadlineQueue
+{
+public:
+  DeadlineQueue();
+
+  DeadlineQueue(const DeadlineQueue&) = delete;
+  DeadlineQueue& operator=(const DeadlineQueue&) = delete;
+
+  /*
+      Add a job that should be finished by deadline
+  */
+  void Push(Job* job, std::uint32_t deadline);
+
+  /*
+      Take the job with the earliest deadline
+
+      Returns nullptr if the queue is empty
+  */
+  Job* Pop();
+
+  /*
+      Get the earliest deadline of any job in the queue without locking it.
+      Only a hint, since jobs can be added or taken at the same time
+
+      Returns false if the queue looked empty
+  */
+  bool Peek(std::uint32_t& deadline) const;
+
+  /*
+      Approximate number of jobs in the queue
+  */
+  size_t Size() const;
+
+private:
+  struct Entry
+  {
+    std::uint32_t deadline;
+    // Breaks ties between equal deadlines, first in first out
+    std::uint64_t order;
+    Job* job;
+  };
+
+  /*
+      Does a come out after b. Orders the heap so the soonest deadline is
+      on top
+  */
+  static bool Later(const Entry& a, const Entry& b);
+
+  // Binary heap of the jobs, soonest deadline at the front
+  std::vector<Entry> heap_;
+  // Order to give the next job pushed
+  std::uint64_t nextOrder_;
+  // Protects heap_ and nextOrder_
+  std::mutex mutex_;
+
+  // Copies of the heap's size and front deadline, for Peek
+  std::atomic_size_t size_;
+  std::atomic<std::uint32_t> earliest_;
+};
+}
+#endif
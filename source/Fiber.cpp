@@ -0,0 +1,327 @@
+/**************************************************************************
+    Contains implementation of Fiber and FiberStackPool
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <assert.h>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Fiber.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define JOBBOT_ASAN 1
+#elif defined(__SANITIZE_THREAD__)
+#define JOBBOT_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define JOBBOT_ASAN 1
+#elif __has_feature(thread_sanitizer)
+#define JOBBOT_TSAN 1
+#endif
+#endif
+
+#ifdef JOBBOT_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+#ifdef JOBBOT_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#ifdef JOBBOT_FIBERS
+/*
+    Save the registers a function must preserve on the current stack, store
+    the stack pointer in *from, then switch to the stack pointer to and
+    restore the registers saved there, returning to wherever that stack
+    left off.
+
+    A new fiber's stack is set up to look like it was left by a switch, and
+    "returns" into JobBotStartFiber, which calls the entry held in the
+    saved registers with the data held in another.
+*/
+extern "C" void JobBotSwitchFiber(void** from, void* to);
+extern "C" void JobBotStartFiber();
+
+#if defined(__x86_64__)
+// System V: rbx, rbp and r12-r15 are kept, along with the SSE and x87
+// control words. The new fiber's entry is in r13 and its data in r12
+__asm__(".text\n"
+        ".globl JobBotSwitchFiber\n"
+        ".hidden JobBotSwitchFiber\n"
+        ".type JobBotSwitchFiber, @function\n"
+        "JobBotSwitchFiber:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  subq $8, %rsp\n"
+        "  stmxcsr (%rsp)\n"
+        "  fnstcw 4(%rsp)\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  ldmxcsr (%rsp)\n"
+        "  fldcw 4(%rsp)\n"
+        "  addq $8, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n"
+        ".size JobBotSwitchFiber, .-JobBotSwitchFiber\n"
+        "\n"
+        ".globl JobBotStartFiber\n"
+        ".hidden JobBotStartFiber\n"
+        ".type JobBotStartFiber, @function\n"
+        "JobBotStartFiber:\n"
+        "  movq %r12, %rdi\n"
+        "  callq *%r13\n"
+        "  ud2\n"
+        ".size JobBotStartFiber, .-JobBotStartFiber\n");
+#elif defined(__aarch64__)
+// AAPCS64: x19-x29, the link register and d8-d15 are kept. The new fiber's
+// entry is in x20 and its data in x19
+__asm__(".text\n"
+        ".globl JobBotSwitchFiber\n"
+        ".hidden JobBotSwitchFiber\n"
+        ".type JobBotSwitchFiber, %function\n"
+        "JobBotSwitchFiber:\n"
+        "  sub sp, sp, #160\n"
+        "  stp x19, x20, [sp, #0]\n"
+        "  stp x21, x22, [sp, #16]\n"
+        "  stp x23, x24, [sp, #32]\n"
+        "  stp x25, x26, [sp, #48]\n"
+        "  stp x27, x28, [sp, #64]\n"
+        "  stp x29, x30, [sp, #80]\n"
+        "  stp d8, d9, [sp, #96]\n"
+        "  stp d10, d11, [sp, #112]\n"
+        "  stp d12, d13, [sp, #128]\n"
+        "  stp d14, d15, [sp, #144]\n"
+        "  mov x9, sp\n"
+        "  str x9, [x0]\n"
+        "  mov sp, x1\n"
+        "  ldp x19, x20, [sp, #0]\n"
+        "  ldp x21, x22, [sp, #16]\n"
+        "  ldp x23, x24, [sp, #32]\n"
+        "  ldp x25, x26, [sp, #48]\n"
+        "  ldp x27, x28, [sp, #64]\n"
+        "  ldp x29, x30, [sp, #80]\n"
+        "  ldp d8, d9, [sp, #96]\n"
+        "  ldp d10, d11, [sp, #112]\n"
+        "  ldp d12, d13, [sp, #128]\n"
+        "  ldp d14, d15, [sp, #144]\n"
+        "  add sp, sp, #160\n"
+        "  ret\n"
+        ".size JobBotSwitchFiber, .-JobBotSwitchFiber\n"
+        "\n"
+        ".globl JobBotStartFiber\n"
+        ".hidden JobBotStartFiber\n"
+        ".type JobBotStartFiber, %function\n"
+        "JobBotStartFiber:\n"
+        "  mov x0, x19\n"
+        "  blr x20\n"
+        "  brk #0\n"
+        ".size JobBotStartFiber, .-JobBotStartFiber\n");
+#endif
+#endif
+
+namespace JobBot
+{
+namespace
+{
+// Fiber the calling thread last switched away from, so the fiber it lands
+// on can tell the sanitizers where it came from
+thread_local Fiber* tSwitchedFrom = nullptr;
+}
+
+// need a definition
+constexpr size_t FiberStackPool::scDefaultStackSize;
+constexpr bool Fiber::scSupported;
+
+FiberStackPool::FiberStackPool(size_t stackSize)
+    : stackSize_(stackSize), guardSize_(4096), count_(0)
+{
+#ifdef JOBBOT_FIBERS
+  guardSize_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+
+  if (stackSize_ == 0) stackSize_ = scDefaultStackSize;
+  stackSize_ = (stackSize_ + guardSize_ - 1) / guardSize_ * guardSize_;
+}
+
+FiberStackPool::~FiberStackPool()
+{
+#ifdef JOBBOT_FIBERS
+  for (void* stack : free_)
+  {
+    munmap(static_cast<char*>(stack) - guardSize_, guardSize_ + stackSize_);
+  }
+#endif
+}
+
+void* FiberStackPool::Allocate()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty())
+    {
+      void* stack = free_.back();
+      free_.pop_back();
+      return stack;
+    }
+  }
+
+#ifdef JOBBOT_FIBERS
+  void* memory = mmap(nullptr, guardSize_ + stackSize_,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+  if (memory == MAP_FAILED) return nullptr;
+
+  // Stacks grow down, so the guard goes at the bottom
+  if (mprotect(memory, guardSize_, PROT_NONE) != 0)
+  {
+    munmap(memory, guardSize_ + stackSize_);
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++count_;
+  return static_cast<char*>(memory) + guardSize_;
+#else
+  return nullptr;
+#endif
+}
+
+void FiberStackPool::Free(void* stack)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(stack);
+}
+
+size_t FiberStackPool::GetStackSize() const { return stackSize_; }
+
+size_t FiberStackPool::GetStackCount() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return count_;
+}
+
+Fiber::Fiber()
+    : stackPointer_(nullptr), stack_(nullptr), stackSize_(0),
+      entry_(nullptr), data_(nullptr), fakeStack_(nullptr),
+      sanitizerStack_(nullptr), sanitizerStackSize_(0), tsanFiber_(nullptr)
+{
+}
+
+Fiber::Fiber(void* stack, size_t size, EntryFunction entry, void* data)
+    : stackPointer_(nullptr), stack_(stack), stackSize_(size), entry_(entry),
+      data_(data), fakeStack_(nullptr), sanitizerStack_(stack),
+      sanitizerStackSize_(size), tsanFiber_(nullptr)
+{
+#ifdef JOBBOT_FIBERS
+  // Lay out the top of the stack the way JobBotSwitchFiber leaves it, so
+  // switching to the fiber "returns" into JobBotStartFiber with the stack
+  // aligned the way a call expects
+  std::uintptr_t top = reinterpret_cast<std::uintptr_t>(stack) + size;
+  top &= ~static_cast<std::uintptr_t>(15);
+  void** frame = reinterpret_cast<void**>(top) - 20;
+
+  for (size_t i = 0; i < 20; ++i)
+  {
+    frame[i] = nullptr;
+  }
+
+#if defined(__x86_64__)
+  // Control words, r15, r14, r13, r12, rbx, rbp, return address
+  const std::uint32_t controlWords[2] = {0x1F80, 0x037F};
+  std::memcpy(&frame[0], controlWords, sizeof(controlWords));
+  frame[3] = reinterpret_cast<void*>(&Fiber::Start);
+  frame[4] = this;
+  frame[7] = reinterpret_cast<void*>(&JobBotStartFiber);
+#elif defined(__aarch64__)
+  // x19, x20, ..., x29, x30 (return address), d8-d15
+  frame[0]  = this;
+  frame[1]  = reinterpret_cast<void*>(&Fiber::Start);
+  frame[11] = reinterpret_cast<void*>(&JobBotStartFiber);
+#endif
+
+  stackPointer_ = frame;
+#endif
+
+#ifdef JOBBOT_TSAN
+  tsanFiber_ = __tsan_create_fiber(0);
+#endif
+}
+
+Fiber::~Fiber()
+{
+#ifdef JOBBOT_TSAN
+  if (stack_ != nullptr)
+  {
+    __tsan_destroy_fiber(tsanFiber_);
+  }
+#endif
+}
+
+void Fiber::SwitchTo(Fiber& other)
+{
+#ifdef JOBBOT_FIBERS
+  tSwitchedFrom = this;
+
+#ifdef JOBBOT_ASAN
+  __sanitizer_start_switch_fiber(&fakeStack_, other.sanitizerStack_,
+                                 other.sanitizerStackSize_);
+#endif
+#ifdef JOBBOT_TSAN
+  // Whatever the thread is running on now is this fiber, even if it is
+  // someone else's fiber standing in as this thread's stack
+  if (stack_ == nullptr)
+  {
+    tsanFiber_ = __tsan_get_current_fiber();
+  }
+  __tsan_switch_to_fiber(other.tsanFiber_, 0);
+#endif
+
+  JobBotSwitchFiber(&stackPointer_, other.stackPointer_);
+
+  FinishSwitch();
+#else
+  (void)other;
+  assert(!"Fibers are not supported on this platform");
+#endif
+}
+
+void* Fiber::GetStack() const { return stack_; }
+
+void Fiber::Start(void* fiber)
+{
+  Fiber* self = static_cast<Fiber*>(fiber);
+  self->FinishSwitch();
+
+  self->entry_(self->data_);
+
+  // There is nothing to return to
+  std::terminate();
+}
+
+void Fiber::FinishSwitch()
+{
+#ifdef JOBBOT_ASAN
+  // Only now does the sanitizer say where the stack that was left is
+  Fiber* from = tSwitchedFrom;
+  __sanitizer_finish_switch_fiber(fakeStack_, &from->sanitizerStack_,
+                                  &from->sanitizerStackSize_);
+#endif
+}
+}
@@ -0,0 +1,190 @@
+/**************************************************************************
+    Declaration of Fiber, a stack jobs can be run on and switched away from
+    part way through, and FiberStackPool, which hands out stacks for them
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _FIBER_H
+#define _FIBER_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Switching stacks is done by hand, so fibers only exist where that has
+// been written
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define JOBBOT_FIBERS 1
+#endif
+
+namespace JobBot
+{
+/*
+    Stacks for fibers, kept around once made so fibers can come and go
+    without mapping memory every time.
+
+    Each stack has a guard page below it that can't be touched, so a fiber
+    that overflows its stack crashes right away instead of quietly writing
+    over whatever comes next in memory. Stack memory is only reserved until
+    it is used, so generous stack sizes are cheap.
+
+    Safe to use from any thread.
+*/
+class FiberStackPool
+{
+public:
+  // Stack size pools start with, in bytes
+  static constexpr size_t scDefaultStackSize = 256 * 1024;
+
+  /*
+      stackSize - usable size of each stack, rounded up to whole pages
+  */
+  explicit FiberStackPool(size_t stackSize = scDefaultStackSize);
+
+  /*
+      Unmaps every stack that has been given back. Stacks still in use
+      when the pool is destroyed are leaked
+  */
+  ~FiberStackPool();
+
+  FiberStackPool(const FiberStackPool&) = delete;
+  FiberStackPool& operator=(const FiberStackPool&) = delete;
+
+  /*
+      Get a stack, reusing one that was given back if there is one
+
+      Returns the lowest usable address of the stack, or nullptr if no more
+      stacks could be mapped (or fibers aren't supported here)
+  */
+  void* Allocate();
+
+  /*
+      Give back a stack from Allocate for something else to use
+  */
+  void Free(void* stack);
+
+  /*
+      Get the usable size of each stack, in bytes
+  */
+  size_t GetStackSize() const;
+
+  /*
+      Number of stacks that have been mapped and not unmapped since
+  */
+  size_t GetStackCount() const;
+
+private:
+  // Usable size of each stack, and of the guard page below each one
+  size_t stackSize_;
+  size_t guardSize_;
+
+  // Stacks that have been given back
+  std::vector<void*> free_;
+  // Number of stacks mapped
+  size_t count_;
+  // Protects everything above
+  mutable std::mutex mutex_;
+};
+
+/*
+    A stack that can be switched to and from, so something running on it
+    can be put aside part way through and picked up again later.
+
+    A fiber is either made with a stack of its own, in which case it starts
+    running its entry function the first time it is switched to, or stands
+    in for the stack the thread was already running on. Switching is
+    cooperative, only happens when asked for, and only saves what the
+    calling convention says must survive a function call, so it costs about
+    as much as one.
+
+    A fiber must only ever be run on one thread, since code running on it
+    is free to hold on to thread local addresses across a switch.
+*/
+class Fiber
+{
+public:
+  // Function a fiber with its own stack runs. It must never return, and
+  // anything it throws ends the program
+  typedef void (*EntryFunction)(void* data);
+
+  // If fibers work on this platform. Nothing else here does if not
+#ifdef JOBBOT_FIBERS
+  static constexpr bool scSupported = true;
+#else
+  static constexpr bool scSupported = false;
+#endif
+
+  /*
+      Make a fiber for the stack the calling thread is running on right
+      now, to switch back to it later
+  */
+  Fiber();
+
+  /*
+      Make a fiber that runs entry(data) on a stack the first time it is
+      switched to
+
+      stack - lowest address of the stack
+      size - size of the stack in bytes
+  */
+  Fiber(void* stack, size_t size, EntryFunction entry, void* data);
+
+  /*
+      Must not be the fiber that is running. Whatever was left on its stack
+      is abandoned without being unwound
+  */
+  ~Fiber();
+
+  Fiber(const Fiber&) = delete;
+  Fiber& operator=(const Fiber&) = delete;
+
+  /*
+      Save where the calling thread is in this fiber, which must be the one
+      it is running on, and carry on in another fiber from wherever that
+      one was left. Returns once something switches back to this fiber
+  */
+  void SwitchTo(Fiber& other);
+
+  /*
+      Get the stack this fiber was made with, or nullptr for a fiber that
+      stands in for a thread's own stack
+  */
+  void* GetStack() const;
+
+private:
+  /*
+      Where fibers with their own stack start, which runs their entry
+      function
+  */
+  static void Start(void* fiber);
+
+  /*
+      Let sanitizers know a switch has landed on the calling fiber
+  */
+  void FinishSwitch();
+
+  // Stack pointer the fiber was left at, where its registers are saved
+  void* stackPointer_;
+
+  // The fiber's own stack, if it has one
+  void* stack_;
+  size_t stackSize_;
+
+  // Run the first time the fiber is switched to
+  EntryFunction entry_;
+  void* data_;
+
+  // Stack bookkeeping for AddressSanitizer, which is told about every
+  // switch so it doesn't mistake the other stacks for garbage
+  void* fakeStack_;
+  const void* sanitizerStack_;
+  size_t sanitizerStackSize_;
+
+  // ThreadSanitizer's handle for the fiber
+  void* tsanFiber_;
+};
+}
+#endif
@@ -6,18 +6,17 @@
 ***************************************************************************/
 
 #include <assert.h>
-#include <cstring> //memcpy
 #include <mutex>
 
 #include "Job.h"
+#include "JobExceptions.h"
+#include "JobPool.h"
+#include "Manager.h"
 
 namespace JobBot
 {
-// Initialize static members of job class
-std::atomic_size_t Job::sCurJobIndex_(0);
-Job Job::sPreallocJobArray_[scMaxJobAlloc_] = {};
-
 #ifdef _DEBUG
+// Initialize static members of job class
 std::atomic_size_t Job::sJobsAdded_     = 0;
 std::atomic_size_t Job::sJobsCompleted_ = 0;
 #endif
@@ -33,23 +32,66 @@ constexpr unsigned char JOB_FLAG_MASK_GRAPHICS =
 constexpr unsigned char JOB_FLAG_MASK_IMPORTANT =
     1 << static_cast<unsigned>(JobType::Important);
 
-constexpr unsigned char JOB_FLAG_MASK_STATUS_IN_PROGRESS =
+constexpr std::uint16_t JOB_FLAG_MASK_STATUS_IN_PROGRESS =
     JOB_FLAG_MASK_IMPORTANT << 1;
-constexpr unsigned char JOB_FLAG_MASK_STATUS_CANCELLED =
+constexpr std::uint16_t JOB_FLAG_MASK_STATUS_CANCELLED =
     JOB_FLAG_MASK_STATUS_IN_PROGRESS << 1;
+constexpr std::uint16_t JOB_FLAG_MASK_STATUS_REUSABLE =
+    JOB_FLAG_MASK_STATUS_CANCELLED << 1;
+constexpr std::uint16_t JOB_FLAG_MASK_CALLBACK_AS_JOB =
+    JOB_FLAG_MASK_STATUS_REUSABLE << 1;
+constexpr std::uint16_t JOB_FLAG_MASK_CANCEL_ON_EXCEPTION =
+    JOB_FLAG_MASK_CALLBACK_AS_JOB << 1;
+constexpr std::uint16_t JOB_FLAG_MASK_KEEPS_EXCEPTIONS =
+    JOB_FLAG_MASK_CANCEL_ON_EXCEPTION << 1;
+constexpr std::uint16_t JOB_FLAG_MASK_BLOCKING =
+    JOB_FLAG_MASK_KEEPS_EXCEPTIONS << 1;
+
+// Priority is kept in the two bits after the other flags
+constexpr unsigned JOB_FLAG_PRIORITY_SHIFT = 12;
+constexpr std::uint16_t JOB_FLAG_MASK_PRIORITY =
+    0x3 << JOB_FLAG_PRIORITY_SHIFT;
+
+// Whether an exception is kept for the job, and whether anything could
+// wait for it, go after the priority
+constexpr std::uint16_t JOB_FLAG_MASK_HOLDS_EXCEPTION =
+    0x1 << (JOB_FLAG_PRIORITY_SHIFT + 2);
+constexpr std::uint16_t JOB_FLAG_MASK_HANDLE_TAKEN =
+    JOB_FLAG_MASK_HOLDS_EXCEPTION << 1;
+static_assert(JOB_FLAG_MASK_BLOCKING <
+                  (1 << JOB_FLAG_PRIORITY_SHIFT),
+              "Priority bits overlap the other flags");
+static_assert((Job::NUM_PRIORITIES - 1) <=
+                  (JOB_FLAG_MASK_PRIORITY >> JOB_FLAG_PRIORITY_SHIFT),
+              "Not enough flag bits for every priority");
+
+Job::Successor Job::sClosedSuccessors_ = {nullptr, nullptr};
+thread_local Job::SuccessorCache Job::tSuccessorCache_;
+std::atomic<std::uint32_t> Job::sCancels_(0);
+
+// Priorities are passed around by reference (by gtest, among others), so
+// need a definition
+constexpr unsigned Job::NUM_PRIORITIES;
+constexpr unsigned Job::DEFAULT_PRIORITY;
 
 Job::Job()
-    : jobFunc_(nullptr), callbackFunc_(nullptr), unfinishedJobs_(-1),
-      parent_(nullptr), ghostJobCount_(0), flags_(0)
+    : ghostJobCount_(0), retainCount_(1), flags_(0), unfinishedJobs_(-1),
+      slot_(0), generation_(0), pendingDependencies_(1), submitTime_(0),
+      deadline_(0), cancelsSeen_(0), jobFunc_(nullptr),
+      callbackFunc_(nullptr), parent_(nullptr), successors_(nullptr),
+      manager_(nullptr), payloadDestructor_(nullptr)
 {
 }
 
 Job::Job(JobFunction function, Job* parent)
-    : jobFunc_(function.function), callbackFunc_(nullptr), unfinishedJobs_(1),
-      parent_(parent), ghostJobCount_(0),
-      flags_(
-          function.flags &
-          ~(JOB_FLAG_MASK_STATUS_IN_PROGRESS | JOB_FLAG_MASK_STATUS_CANCELLED))
+    : ghostJobCount_(0), retainCount_(1),
+      flags_(function.flags & ~(JOB_FLAG_MASK_STATUS_IN_PROGRESS |
+                                JOB_FLAG_MASK_STATUS_CANCELLED)),
+      unfinishedJobs_(1), slot_(0), generation_(0),
+      pendingDependencies_(1), submitTime_(0), deadline_(0), cancelsSeen_(0),
+      jobFunc_(function.function),
+      callbackFunc_(nullptr), parent_(parent), successors_(nullptr),
+      manager_(nullptr), payloadDestructor_(nullptr)
 {
   // If there is a parent, it now has one more job that must finish before
   // parent is done
@@ -70,34 +112,30 @@ Job& Job::operator=(const Job& job)
   unfinishedJobs_.store(job.unfinishedJobs_.load());
   parent_ = job.parent_;
   ghostJobCount_.store(job.ghostJobCount_.load());
-  std::memcpy(padding_, job.padding_, PADDING_BYTES);
+  successors_.store(job.successors_.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+  pendingDependencies_.store(
+      job.pendingDependencies_.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  manager_  = job.manager_;
+  deadline_ = job.deadline_;
+  retainCount_.store(job.retainCount_.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+
+  // The payload is left alone. Payloads aren't safe to copy byte by byte,
+  // and are only ever constructed in place once the job has its memory
   return *this;
 }
 
-Job* Job::Create(JobFunction& function)
+Job* Job::Create(const JobFunction& function)
 {
   return CreateChild(function, nullptr);
 }
 
-Job* Job::CreateChild(JobFunction& function, Job* parent)
+Job* Job::CreateChild(const JobFunction& function, Job* parent)
 {
-  Job* nextJob;
-
-  do
-  {
-    // Grab the index and move the index forward atomically before trying
-    // to grab a job to avoid thread conflicts
-    size_t myJobIndex = sCurJobIndex_++;
-
-    // Grab the next job from the pool
-    // Use & as a bitmask instead of modulo since the array is a power of 2 in
-    // size
-    nextJob = &(sPreallocJobArray_[myJobIndex & scJobLoopBitMask_]);
-
-    // Make sure this job is not currently in use
-    // Default constructed jobs (that occupy the entire array initially)
-    // will automagically meet this condition
-  } while (nextJob->ghostJobCount_ != 0 || nextJob->unfinishedJobs_ > -1);
+  // Grab memory for the job from this thread's part of the pool
+  Job* nextJob = JobPool::Allocate();
 
   // Now that job has been found, make sure its set as completable by default
   nextJob->ghostJobCount_ = 0;
@@ -105,7 +143,34 @@ Job* Job::CreateChild(JobFunction& function, Job* parent)
   *nextJob = Job(function, parent);
 
   // Ensure jobs cannot be initialized with an in-progress flag
-  nextJob->flags_ = function.flags;
+  std::uint16_t flags = function.flags;
+
+  // Children of cancelled jobs start out cancelled, and children are as
+  // urgent as their parent. Otherwise nothing above the child has been
+  // cancelled as of now
+  const std::uint32_t cancels = sCancels_.load(std::memory_order_acquire);
+  nextJob->cancelsSeen_.store(cancels, std::memory_order_relaxed);
+  if (parent != nullptr)
+  {
+    if (parent->IsCancelled())
+    {
+      flags |= JOB_FLAG_MASK_STATUS_CANCELLED;
+    }
+    flags |= parent->flags_.load(std::memory_order_relaxed) &
+             JOB_FLAG_MASK_PRIORITY;
+  }
+  else
+  {
+    flags |= DEFAULT_PRIORITY << JOB_FLAG_PRIORITY_SHIFT;
+  }
+
+  // IO jobs are expected to block unless they say otherwise
+  if (flags & JOB_FLAG_MASK_IO)
+  {
+    flags |= JOB_FLAG_MASK_BLOCKING;
+  }
+
+  nextJob->flags_.store(flags, std::memory_order_relaxed);
 
   return nextJob;
 }
@@ -116,71 +181,612 @@ void Job::Run()
   if (jobFunc_ != nullptr)
   {
     // Mark this job as in progress
-    flags_ |= JOB_FLAG_MASK_STATUS_IN_PROGRESS;
+    flags_.fetch_or(JOB_FLAG_MASK_STATUS_IN_PROGRESS,
+                    std::memory_order_relaxed);
 
-    // Run the job function
-    jobFunc_(this);
+    // Run the job function, unless the work is no longer wanted
+    if (!IsCancelled())
+    {
+      try
+      {
+        jobFunc_(this);
+      }
+      catch (...)
+      {
+        // Leave it for whoever is waiting on this job, rather than taking
+        // the worker down with it
+        Fail(std::current_exception());
+      }
+    }
 
     // Complete the job
     Finish();
   }
 }
 
+void Job::Fail(std::exception_ptr exception)
+{
+  // The closest job that asked for it has the rest of its work cancelled
+  for (Job* job = this; job != nullptr; job = job->parent_)
+  {
+    if (job->flags_.load(std::memory_order_relaxed) &
+        JOB_FLAG_MASK_CANCEL_ON_EXCEPTION)
+    {
+      job->Cancel();
+      break;
+    }
+  }
+
+  // Store it for one job only, so nothing is left behind for jobs nobody
+  // waits on. That is the closest one something is known to be waiting on,
+  // or otherwise the root, since that is usually what gets waited on
+  Job* owner = this;
+  while (owner->parent_ != nullptr &&
+         !(owner->flags_.load(std::memory_order_relaxed) &
+           JOB_FLAG_MASK_KEEPS_EXCEPTIONS))
+  {
+    owner = owner->parent_;
+  }
+
+  // The owner's memory is kept until the exception is taken, so a waiter
+  // that is slow to look can't find some other job there instead
+  owner->Retain();
+  if (JobErrors::Store(
+          JobHandle(owner->slot_,
+                    owner->generation_.load(std::memory_order_relaxed)),
+          exception))
+  {
+    owner->flags_.fetch_or(JOB_FLAG_MASK_HOLDS_EXCEPTION,
+                           std::memory_order_relaxed);
+  }
+  else
+  {
+    owner->Release();
+  }
+}
+
+void Job::KeepExceptions()
+{
+  flags_.fetch_or(JOB_FLAG_MASK_KEEPS_EXCEPTIONS, std::memory_order_relaxed);
+}
+
+void Job::SetBlocking(bool blocking)
+{
+  if (blocking)
+  {
+    flags_.fetch_or(JOB_FLAG_MASK_BLOCKING, std::memory_order_relaxed);
+  }
+  else
+  {
+    flags_.fetch_and(static_cast<std::uint16_t>(~JOB_FLAG_MASK_BLOCKING),
+                     std::memory_order_relaxed);
+  }
+}
+
+bool Job::IsBlocking() const
+{
+  return flags_.load(std::memory_order_relaxed) & JOB_FLAG_MASK_BLOCKING;
+}
+
 bool Job::IsFinished() const
 {
   // Job is finished when there are no unfinished jobs
   return unfinishedJobs_ <= 0;
 }
 
-void Job::SetCallback(JobFunction func) { callbackFunc_ = func.function; }
+void Job::AddDependency(Job* before)
+{
+  if (before == nullptr) return;
+
+  // Count the dependency first, so it can't be released before it has
+  // been counted
+  pendingDependencies_.fetch_add(1, std::memory_order_relaxed);
+
+  Successor* node = AllocateSuccessor();
+  node->job       = this;
+  node->next      = before->successors_.load(std::memory_order_acquire);
+  do
+  {
+    if (node->next == &sClosedSuccessors_)
+    {
+      // Already finished, so there is nothing to wait for
+      FreeSuccessor(node);
+      pendingDependencies_.fetch_sub(1, std::memory_order_relaxed);
+      return;
+    }
+  } while (!before->successors_.compare_exchange_weak(
+      node->next, node, std::memory_order_release,
+      std::memory_order_acquire));
+}
+
+void Job::ReleaseSuccessors()
+{
+  // Close the list so nothing else is added after it has been walked
+  Successor* node = successors_.exchange(&sClosedSuccessors_,
+                                         std::memory_order_acq_rel);
+
+  while (node != nullptr)
+  {
+    Successor* next = node->next;
+    Job* successor  = node->job;
+    FreeSuccessor(node);
+
+    // The last dependency to finish sends the job off, as long as it has
+    // already been submitted
+    if (successor->pendingDependencies_.fetch_sub(
+            1, std::memory_order_acq_rel) == 1)
+    {
+      successor->manager_->SubmitJob(successor);
+    }
+
+    node = next;
+  }
+}
+
+Job::Successor* Job::AllocateSuccessor()
+{
+  SuccessorCache& cache = tSuccessorCache_;
+  if (cache.freeList == nullptr) return new Successor;
+
+  Successor* node = cache.freeList;
+  cache.freeList  = node->next;
+  --cache.count;
+  return node;
+}
+
+void Job::FreeSuccessor(Successor* node)
+{
+  SuccessorCache& cache = tSuccessorCache_;
+  if (cache.count == scMaxCachedSuccessors_)
+  {
+    delete node;
+    return;
+  }
+
+  node->next     = cache.freeList;
+  cache.freeList = node;
+  ++cache.count;
+}
+
+Job::SuccessorCache::SuccessorCache() : freeList(nullptr), count(0) {}
+
+Job::SuccessorCache::~SuccessorCache()
+{
+  while (freeList != nullptr)
+  {
+    Successor* following = freeList->next;
+    delete freeList;
+    freeList = following;
+  }
+}
+
+bool Job::DeferUntilReady(Manager* manager)
+{
+  // Remembered either way, for whatever the job goes on to submit
+  manager_ = manager;
+
+  // Dependencies are only added before submission, so once this is down to
+  // just the submission hold it can only stay there
+  if (pendingDependencies_.load(std::memory_order_acquire) <= 1) return false;
+
+  // Give up the submission hold. If the dependencies all finished since
+  // the check above, it's up to the submitter to run the job after all
+  return pendingDependencies_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+}
+
+JobHandle Job::GetHandle()
+{
+  // Something may wait on this job now, so what it throws has to be kept
+  flags_.fetch_or(JOB_FLAG_MASK_HANDLE_TAKEN, std::memory_order_relaxed);
+
+  return JobHandle(slot_, generation_.load(std::memory_order_relaxed));
+}
+
+Manager* Job::GetManager() const { return manager_; }
+
+void Job::SetCallback(JobFunction func, bool asJob)
+{
+  callbackFunc_ = func.function;
+
+  // A callback run as a job holds this job open the same way a child
+  // does, from now until it has run, so the job is never seen finished
+  // in between
+  const bool held = flags_.load(std::memory_order_relaxed) &
+                    JOB_FLAG_MASK_CALLBACK_AS_JOB;
+  if (asJob && !held)
+  {
+    flags_.fetch_or(JOB_FLAG_MASK_CALLBACK_AS_JOB, std::memory_order_relaxed);
+    ++unfinishedJobs_;
+  }
+  else if (!asJob && held)
+  {
+    flags_.fetch_and(
+        static_cast<std::uint16_t>(~JOB_FLAG_MASK_CALLBACK_AS_JOB),
+        std::memory_order_relaxed);
+    --unfinishedJobs_;
+  }
+}
 
 bool Job::MatchesType(JobType type) const
 {
   // Misc means matches no other type
   if (type == JobType::Misc &&
-      (flags_ & ((JOB_FLAG_MASK_IMPORTANT << 1) - 1)) == 0)
+      (flags_.load(std::memory_order_relaxed) &
+       ((JOB_FLAG_MASK_IMPORTANT << 1) - 1)) == 0)
     return true;
   else
   {
     // Otherwise flag bits follow predictable bit pattern
-    return (flags_ & (1 << static_cast<unsigned>(type)));
+    return (flags_.load(std::memory_order_relaxed) &
+            (1 << static_cast<unsigned>(type)));
   }
 }
 
+JobType Job::GetType() const
+{
+  if (MatchesType(JobType::Important)) return JobType::Important;
+  if (MatchesType(JobType::IO)) return JobType::IO;
+  if (MatchesType(JobType::Huge)) return JobType::Huge;
+  if (MatchesType(JobType::Graphics)) return JobType::Graphics;
+  if (MatchesType(JobType::Tiny)) return JobType::Tiny;
+  return JobType::Misc;
+}
+
+void Job::SetPriority(unsigned priority)
+{
+  if (priority >= NUM_PRIORITIES) priority = NUM_PRIORITIES - 1;
+
+  std::uint16_t flags = flags_.load(std::memory_order_relaxed);
+  while (!flags_.compare_exchange_weak(
+      flags, static_cast<std::uint16_t>(
+                 (flags & ~JOB_FLAG_MASK_PRIORITY) |
+                 (priority << JOB_FLAG_PRIORITY_SHIFT)),
+      std::memory_order_relaxed))
+  {
+  }
+}
+
+unsigned Job::GetPriority() const
+{
+  return (flags_.load(std::memory_order_relaxed) & JOB_FLAG_MASK_PRIORITY) >>
+         JOB_FLAG_PRIORITY_SHIFT;
+}
+
+void Job::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+  SetDeadline(std::chrono::duration_cast<std::chrono::microseconds>(
+      deadline - std::chrono::steady_clock::now()));
+}
+
+void Job::SetDeadline(std::chrono::microseconds fromNow)
+{
+  // Kept well clear of where tick differences wrap around
+  const std::chrono::microseconds longest(1 << 30);
+  if (fromNow > longest) fromNow = longest;
+  if (fromNow < -longest) fromNow = -longest;
+
+  // 0 means there is no deadline, so skip over it on the rare occasion the
+  // ticks wrap around to it
+  const std::int32_t offset = static_cast<std::int32_t>(fromNow.count());
+  deadline_ = Manager::GetTicks() + static_cast<std::uint32_t>(offset);
+  if (deadline_ == 0) deadline_ = 1;
+}
+
+bool Job::HasDeadline() const { return deadline_ != 0; }
+
 bool Job::InProgress() const
 {
-  return flags_ & JOB_FLAG_MASK_STATUS_IN_PROGRESS;
+  return flags_.load(std::memory_order_relaxed) &
+         JOB_FLAG_MASK_STATUS_IN_PROGRESS;
+}
+
+void Job::Cancel()
+{
+  // Only this job is marked, its children find out by looking at their
+  // parents, so cancelling a huge tree is still cheap. Counting it tells
+  // every job to look again
+  flags_.fetch_or(JOB_FLAG_MASK_STATUS_CANCELLED, std::memory_order_relaxed);
+  sCancels_.fetch_add(1, std::memory_order_release);
+}
+
+void Job::SetCancelOnException(bool cancel)
+{
+  if (cancel)
+  {
+    flags_.fetch_or(JOB_FLAG_MASK_CANCEL_ON_EXCEPTION,
+                    std::memory_order_relaxed);
+  }
+  else
+  {
+    flags_.fetch_and(
+        static_cast<std::uint16_t>(~JOB_FLAG_MASK_CANCEL_ON_EXCEPTION),
+        std::memory_order_relaxed);
+  }
+}
+
+bool Job::IsCancelled() const
+{
+  if (flags_.load(std::memory_order_relaxed) & JOB_FLAG_MASK_STATUS_CANCELLED)
+  {
+    return true;
+  }
+
+  // Nothing above can have been cancelled if no job has been since the
+  // last look
+  const std::uint32_t cancels = sCancels_.load(std::memory_order_acquire);
+  if (cancels == cancelsSeen_.load(std::memory_order_relaxed)) return false;
+
+  // Parents always outlive their unfinished children, so the chain up is
+  // safe to follow
+  for (const Job* job = parent_; job != nullptr; job = job->parent_)
+  {
+    if (job->flags_.load(std::memory_order_relaxed) &
+        JOB_FLAG_MASK_STATUS_CANCELLED)
+    {
+      return true;
+    }
+  }
+
+  cancelsSeen_.store(cancels, std::memory_order_relaxed);
+  return false;
 }
 
 void Job::Finish()
 {
+  // Work up the tree a level at a time rather than recursing into the
+  // parent, so finishing the bottom of a deep tree can't run out of stack
+  Job* job = this;
+  while (job != nullptr)
+  {
+    job = job->FinishOne();
+  }
+}
+
+Job* Job::FinishOne()
+{
+  if (flags_.load(std::memory_order_relaxed) & JOB_FLAG_MASK_STATUS_REUSABLE)
+  {
+    return FinishReusable();
+  }
+
   char cachedGhostJobs = ghostJobCount_.load();
+
+  // Only the decrement that takes the count to zero finishes the job.
+  // Reading the count again afterwards would let two children finishing
+  // at once both see zero, and both finish and free the job
+  int previous = unfinishedJobs_.fetch_sub(1);
+
+  // A callback run as a job has its own hold on the count, so the
+  // decrement that leaves only that hold is the one to start it. Anyone
+  // holding the job open is waiting for the callback too, so it starts
+  // regardless
+  if (previous == 2 && callbackFunc_ != nullptr &&
+      (flags_.load(std::memory_order_relaxed) &
+       JOB_FLAG_MASK_CALLBACK_AS_JOB))
+  {
+    if (SubmitCallback())
+    {
+      // The callback job finishes this one once it is done
+      return nullptr;
+    }
+
+    // It ran here instead, so let go of its hold too
+    previous = unfinishedJobs_.fetch_sub(1);
+  }
+
+  if (previous != 1 || cachedGhostJobs != 0)
+  {
+    return nullptr;
+  }
+
+  // Run the callback to allow user to clean up if it exists
+  if (callbackFunc_ != nullptr)
+  {
+    callbackFunc_(this);
+  }
+
+  // Anything waiting on this job can go now
+  ReleaseSuccessors();
+
+  flags_.fetch_and(static_cast<std::uint16_t>(
+                       ~JOB_FLAG_MASK_STATUS_IN_PROGRESS),
+                   std::memory_order_relaxed);
+
+  DropUnwantedException();
+
+  // The parent finishes after this job is gone, so hold on to it
+  Job* parent = parent_;
+
+  // Decrement unfinishedJobs_ once more to bring it to -1
+  // so that allocator can see this jobs is completely finished
   --unfinishedJobs_;
+#ifdef _DEBUG
+  ++sJobsCompleted_;
+
+  assert(unfinishedJobs_ == -1);
+  assert(jobFunc_ != nullptr);
+#endif
+
+  if (retainCount_.load(std::memory_order_acquire) == 1)
+  {
+    // Nobody else owns the job, so clean up what it was holding before
+    // anyone waiting on a handle carries on
+    DestroyPayload();
+
+    // Let handles know this job is done, anything looking at this memory
+    // from here on is looking at a different job
+    generation_.fetch_add(1, std::memory_order_release);
+
+    // Give the memory back so another job can use it
+    JobPool::Free(this);
+  }
+  else
+  {
+    // Someone still wants to look at the payload, so it is cleaned up
+    // once they let go
+    generation_.fetch_add(1, std::memory_order_release);
+    Release();
+  }
+
+  return parent;
+}
 
-  if (unfinishedJobs_ == 0 && cachedGhostJobs == 0)
+bool Job::SubmitCallback()
+{
+  JobFunctionPointer callback = callbackFunc_;
+  callbackFunc_               = nullptr;
+
+  // The callback goes to the manager this job was submitted to, and if
+  // there isn't one, or no room for another job, it runs right here
+  Job* callbackJob = nullptr;
+  if (manager_ != nullptr)
   {
-    // Run the callback to allow user to clean up if it exists
-    if (callbackFunc_ != nullptr)
+    try
+    {
+      callbackJob = Create(
+          [this, callback]() {
+            // The error belongs to this job, and it has to finish either
+            // way or nothing waiting on it ever wakes
+            try
+            {
+              callback(this);
+            }
+            catch (...)
+            {
+              Fail(std::current_exception());
+            }
+            Finish();
+          },
+          GetType());
+    }
+    catch (const JobRejected&)
     {
-      callbackFunc_(this);
+      callbackJob = nullptr;
     }
+  }
+
+  if (callbackJob == nullptr)
+  {
+    callback(this);
+    return false;
+  }
+
+  callbackJob->SetPriority(GetPriority());
+  callbackJob->deadline_ = deadline_;
+  manager_->SubmitJob(callbackJob);
+  return true;
+}
+
+Job* Job::FinishReusable()
+{
+  if (unfinishedJobs_.fetch_sub(1) != 1) return nullptr;
+
+  flags_.fetch_and(
+      static_cast<std::uint16_t>(~JOB_FLAG_MASK_STATUS_IN_PROGRESS),
+      std::memory_order_relaxed);
 
-    if (parent_ != nullptr)
+  for (Successor* node = successors_.load(std::memory_order_relaxed);
+       node != nullptr; node = node->next)
+  {
+    if (node->job->pendingDependencies_.fetch_sub(
+            1, std::memory_order_acq_rel) == 1)
     {
-      parent_->Finish();
+      node->job->manager_->SubmitJob(node->job);
     }
+  }
 
-    flags_ &= ~JOB_FLAG_MASK_STATUS_IN_PROGRESS;
+  DropUnwantedException();
 
-    // Decrement unfinishedJobs_ once more to bring it to -1
-    // so that allocator can see this jobs is completely finished
-    --unfinishedJobs_;
-#ifdef _DEBUG
-    ++sJobsCompleted_;
+  // Whoever owns this job may reset or free it as soon as the callback or
+  // the parent says the work is done, so don't touch it after that
+  Job* parent = parent_;
 
-    assert(unfinishedJobs_ == -1);
-    assert(jobFunc_ != nullptr);
-#endif
+  if (callbackFunc_ != nullptr)
+  {
+    callbackFunc_(this);
+  }
+
+  return parent;
+}
+
+void Job::MakeReusable()
+{
+  flags_.fetch_or(JOB_FLAG_MASK_STATUS_REUSABLE, std::memory_order_relaxed);
+}
+
+void Job::ResetForReuse(Manager* manager, std::uint32_t dependencies,
+                        int unfinishedJobs)
+{
+  manager_ = manager;
+  pendingDependencies_.store(dependencies, std::memory_order_relaxed);
+  unfinishedJobs_.store(unfinishedJobs, std::memory_order_relaxed);
+  flags_.fetch_and(static_cast<std::uint16_t>(
+                       ~(JOB_FLAG_MASK_STATUS_IN_PROGRESS |
+                         JOB_FLAG_MASK_STATUS_CANCELLED)),
+                   std::memory_order_relaxed);
+}
+
+void Job::ReleaseReusable()
+{
+  flags_.store(0, std::memory_order_relaxed);
+  successors_.store(nullptr, std::memory_order_relaxed);
+  unfinishedJobs_ = -1;
+
+  generation_.fetch_add(1, std::memory_order_release);
+  Recycle();
+}
+
+void Job::Retain() { retainCount_.fetch_add(1, std::memory_order_relaxed); }
+
+void Job::Release()
+{
+  // Being the only owner left is the common case, and nobody can start
+  // owning the job now, so skip the atomic subtract
+  if (retainCount_.load(std::memory_order_acquire) == 1 ||
+      retainCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    Recycle();
+  }
+}
+
+void Job::DropUnwantedException()
+{
+  // Only look for an exception when this job was given one, and nothing
+  // can wait on a job nobody took a handle to, so don't keep it
+  const std::uint16_t flags = flags_.load(std::memory_order_relaxed);
+  if ((flags & JOB_FLAG_MASK_HOLDS_EXCEPTION) &&
+      !(flags & JOB_FLAG_MASK_HANDLE_TAKEN))
+  {
+    JobErrors::Take(
+        JobHandle(slot_, generation_.load(std::memory_order_relaxed)));
+  }
+}
+
+void Job::ReleaseException()
+{
+  flags_.fetch_and(static_cast<std::uint16_t>(~JOB_FLAG_MASK_HOLDS_EXCEPTION),
+                   std::memory_order_relaxed);
+  Release();
+}
+
+void Job::ForgetHandles()
+{
+  flags_.fetch_and(static_cast<std::uint16_t>(~JOB_FLAG_MASK_HANDLE_TAKEN),
+                   std::memory_order_relaxed);
+}
+
+void Job::Recycle()
+{
+  DestroyPayload();
+  JobPool::Free(this);
+}
+
+void Job::DestroyPayload()
+{
+  if (payloadDestructor_ != nullptr)
+  {
+    payloadDestructor_(this);
+    payloadDestructor_ = nullptr;
   }
 }
 
@@ -11,6 +11,16 @@
 #define _JOB_H
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "JobHandle.h"
+#include "PayloadArena.h"
 
 namespace JobSystemTests
 {
@@ -35,6 +45,8 @@ enum struct JobType
     Forward declaration so that JobFunction typedef can happen
 */
 class Job;
+class Manager;
+template <typename T> class JobFuture;
 
 /*
     Define JobFunction pointers to make declarations of Jobs much tidier
@@ -49,6 +61,100 @@ struct JobFunction
   unsigned char flags         = 0;
 };
 
+namespace Detail
+{
+/*
+    Is F something that can be called with the Job* running it
+*/
+template <typename F, typename = void> struct TakesJob : std::false_type
+{
+};
+template <typename F>
+struct TakesJob<F, decltype(void(std::declval<F&>()(std::declval<Job*>())))>
+    : std::true_type
+{
+};
+
+/*
+    Is F something that can be called with no arguments
+*/
+template <typename F, typename = void> struct TakesNothing : std::false_type
+{
+};
+template <typename F>
+struct TakesNothing<F, decltype(void(std::declval<F&>()()))> : std::true_type
+{
+};
+
+/*
+    What calling F gives back, preferring to pass the Job* if it can take
+    one. Has no type if F can't be called either way
+*/
+template <typename F, bool = TakesJob<F>::value,
+          bool = TakesNothing<F>::value>
+struct CallableResult
+{
+};
+template <typename F, bool takesNothing>
+struct CallableResult<F, true, takesNothing>
+{
+  typedef decltype(std::declval<F&>()(std::declval<Job*>())) type;
+};
+template <typename F> struct CallableResult<F, false, true>
+{
+  typedef decltype(std::declval<F&>()()) type;
+};
+
+/*
+    Call a job callable, passing the job along if it wants it
+*/
+template <typename F>
+inline auto Invoke(F& function, Job* job, std::true_type)
+    -> decltype(function(job))
+{
+  return function(job);
+}
+template <typename F>
+inline auto Invoke(F& function, Job*, std::false_type) -> decltype(function())
+{
+  return function();
+}
+
+/*
+    Job::Create gives back a plain job for a callable that returns nothing.
+    Has no type for anything else, including function pointers, which
+    still go through JobFunction
+*/
+template <typename F, typename = void> struct JobFor
+{
+};
+template <typename F>
+struct JobFor<
+    F, typename std::enable_if<
+           !std::is_convertible<F, JobFunction>::value &&
+           std::is_void<typename CallableResult<
+               typename std::decay<F>::type>::type>::value>::type>
+{
+  typedef Job* type;
+};
+
+/*
+    The future Job::Create gives back for a callable returning a value.
+    Has no type for anything else, so those go to the other overloads
+*/
+template <typename F, typename = void> struct FutureFor
+{
+};
+template <typename F>
+struct FutureFor<
+    F, typename std::enable_if<!std::is_void<typename CallableResult<
+           typename std::decay<F>::type>::type>::value>::type>
+{
+  typedef typename CallableResult<typename std::decay<F>::type>::type result;
+  typedef JobFuture<result> type;
+};
+}
+
 #pragma pack(push, 1)
 class Job
 {
@@ -56,12 +162,12 @@ public:
   /*
       Allocate memory for a job, giving it a function
   */
-  static Job* Create(JobFunction& function);
+  static Job* Create(const JobFunction& function);
 
   /*
       Allocate memory for a job, giving it a function and a parent
   */
-  static Job* CreateChild(JobFunction& function, Job* parent);
+  static Job* CreateChild(const JobFunction& function, Job* parent);
 
   /*
       Allocate memory for a job, giving it a function and some data.
@@ -71,13 +177,61 @@ public:
 
       2 Variants, for with/without parent jobs.
 
-      These functions will cause a compilation failure if your data is
-      too large to fit within a job itself.
+      Data too large to fit within a job itself is put in the
+      PayloadArena instead (see SetData).
   */
   template <typename T>
-  static Job* Create(JobFunction& function, const T& data);
+  static Job* Create(const JobFunction& function, const T& data);
   template <typename T>
-  static Job* CreateChild(JobFunction& function, const T& data, Job* parent);
+  static Job* CreateChild(const JobFunction& function, const T& data,
+                          Job* parent);
+
+  /*
+      Same as above, but moves the data into the job instead of copying it
+  */
+  template <typename T>
+  static typename std::enable_if<!std::is_lvalue_reference<T>::value,
+                                 Job*>::type
+  Create(const JobFunction& function, T&& data);
+  template <typename T>
+  static typename std::enable_if<!std::is_lvalue_reference<T>::value,
+                                 Job*>::type
+  CreateChild(const JobFunction& function, T&& data, Job* parent);
+
+  /*
+      Allocate memory for a job that runs a callable, such as a lambda or
+      function object, that returns nothing. The callable can take no
+      arguments, or the Job* running it, and may be move only.
+
+      The callable is moved into the job's padding if it fits, and into a
+      PayloadArena block if it doesn't, so small captures never need the
+      heap. It is destroyed when the job's memory is reused, so jobs made
+      this way must not use SetData.
+  */
+  template <typename F>
+  static typename Detail::JobFor<F>::type Create(F&& function,
+                                                 JobType type = JobType::Misc);
+  template <typename F>
+  static typename Detail::JobFor<F>::type CreateChild(
+      F&& function, Job* parent, JobType type = JobType::Misc);
+
+  /*
+      Allocate memory for a job that runs a callable (a lambda or function
+      object) and gives back a JobFuture for the value it returns. The
+      callable can take no arguments, or the Job* running it.
+
+      Submit the job from the future's GetJob() like any other. The callable
+      and then its result are kept in the job's padding when they fit, and
+      in a PayloadArena block when they don't, so neither needs the heap.
+
+      Defined in JobFuture.h, which must be included to use these.
+  */
+  template <typename F>
+  static typename Detail::FutureFor<F>::type Create(
+      F&& function, JobType type = JobType::Misc);
+  template <typename F>
+  static typename Detail::FutureFor<F>::type CreateChild(
+      F&& function, Job* parent, JobType type = JobType::Misc);
 
   /*
       Execute this job
@@ -86,47 +240,219 @@ public:
 
   /*
       Check if this job has finished its work
+
+      Only meaningful while the job is known to be alive, since finished
+      jobs are reused. Use a JobHandle to check on a job after that
   */
   bool IsFinished() const;
 
+  /*
+      Make this job wait for another job to finish before it runs.
+
+      Submitting this job to a manager as usual is still required, but it
+      is only handed to workers once every job it depends on has finished
+      (including their children). Whichever worker finishes the last of
+      them submits it to the same manager.
+
+      Dependencies must all be added before this job is submitted. before
+      must not have finished yet, unless it is being held open with
+      SetAllowCompletion(false). A job can depend on any number of jobs,
+      and any number of jobs can depend on a job.
+
+      before - the job that has to finish first
+  */
+  void AddDependency(Job* before);
+
+  /*
+      Get a handle that can tell when this job has finished, even after its
+      memory has been reused. Take it before submitting the job, since the
+      job may finish and be reused at any point after that
+
+      Exceptions are only kept for jobs something has taken a handle to
+      (see JobErrors)
+  */
+  JobHandle GetHandle();
+
+  /*
+      Get the manager the job was last submitted to, or nullptr if it
+      hasn't been yet
+  */
+  Manager* GetManager() const;
+
   /*
       Set a callback function to be executed after the completion
       of this job. This function will be run by the same worker
       that completed the job.
 
+      If asJob is set, the callback is submitted as a job of its own
+      instead, to the manager this job was submitted to, so a worker
+      finishing the last job in a big tree doesn't end up running every
+      callback above it by itself. The job still counts as unfinished (and
+      keeps its parent unfinished) until the callback has run. Callbacks of
+      jobs that were never submitted, or that there is no room left in the
+      pool for, are run right away. Must be called before the job is
+      submitted.
+
       func - the function to use as a callback
+      asJob - run the callback as a separate job
   */
-  void SetCallback(JobFunction func);
+  void SetCallback(JobFunction func, bool asJob = false);
 
   /*
       Does this job match the given type?
   */
   bool MatchesType(JobType type) const;
 
+  /*
+      Get the type of this job (the type of queue it belongs in)
+  */
+  JobType GetType() const;
+
+  /*
+      Set how urgent this job is compared to other jobs of its type, from
+      0 (most urgent) to NUM_PRIORITIES - 1. Workers take every job at a
+      more urgent level before any job at a less urgent one, except for
+      jobs that have waited long enough to be aged past them (see
+      Manager::SetPriorityAging). Anything past the last level is treated
+      as the last level.
+
+      Jobs start at DEFAULT_PRIORITY, and children start at their parent's
+      priority. Must be set before the job is submitted
+  */
+  void SetPriority(unsigned priority);
+
+  /*
+      Get how urgent this job is, 0 being the most urgent
+  */
+  unsigned GetPriority() const;
+
+  /*
+      Give this job a time it should be done running by. Workers that
+      schedule earliest deadline first (RealTime and Graphics) take jobs
+      with a deadline before anything else they take, soonest deadline
+      first and whatever their priority. Other workers take them when they
+      run out of other work, or when the deadline is within the manager's
+      aging time (see Manager::SetPriorityAging). A job whose function
+      returns after its deadline counts as a miss (see
+      Manager::GetDeadlineStats).
+
+      Deadlines are kept to the microsecond and must be within a quarter
+      of an hour of now. Children don't get their parent's deadline, but a
+      callback run as a job does. Must be set before the job is submitted,
+      and jobs in a TaskGraph keep theirs every time the graph runs, so set
+      it again before each run
+  */
+  void SetDeadline(std::chrono::steady_clock::time_point deadline);
+
+  /*
+      Same as above, with the deadline given as a time from now
+  */
+  void SetDeadline(std::chrono::microseconds fromNow);
+
+  /*
+      Has this job been given a deadline
+  */
+  bool HasDeadline() const;
+
+  // Number of priority levels jobs can be given
+  static constexpr unsigned NUM_PRIORITIES = 4;
+  // Priority jobs start at, leaving room for more and less urgent work
+  static constexpr unsigned DEFAULT_PRIORITY = 2;
+
   /*
     Is this job currently in progress
   */
   bool InProgress() const;
 
+  /*
+      Cancel this job and everything below it. Cancelled jobs that haven't
+      started are still taken by workers, but their job function is
+      skipped. Their callbacks still run (and can check IsCancelled) and
+      their parents are still told they finished, so anything waiting on
+      them carries on as normal.
+
+      A job that is already running keeps going unless it checks
+      IsCancelled itself. Safe to call from any thread, as long as the job
+      hasn't finished
+  */
+  void Cancel();
+
+  /*
+      Cancel everything below this job (including itself) if any of those
+      jobs throws an exception, so the rest of a failed piece of work is
+      skipped. Off by default.
+
+      Whatever happens, exceptions thrown by job functions are caught and
+      rethrown to whoever waits on the root of the tree the job was in
+      (see JobErrors)
+  */
+  void SetCancelOnException(bool cancel);
+
+  /*
+      Have exceptions thrown by this job, or any job under it, kept for
+      this job rather than the root of its tree, for when this job is the
+      one that gets waited on. Futures and tasks do this for their jobs
+  */
+  void KeepExceptions();
+
+  /*
+      Say whether this job spends most of its time blocked (on a file, the
+      network, a lock...), so a compensating worker should keep its core
+      busy while it runs (see Manager::SetMaxCompensatingWorkers). On by
+      default for IO jobs and off for the rest. IO jobs that never block
+      for long can turn it off to save the manager keeping track of them
+  */
+  void SetBlocking(bool blocking);
+
+  /*
+      Is this job counted as blocked while it runs, either since it is an
+      IO job or from SetBlocking
+  */
+  bool IsBlocking() const;
+
+  /*
+      Has this job, or any job above it, been cancelled
+
+      Cheap enough for long running jobs to check regularly. Jobs above
+      this one are only looked at if some job has been cancelled since the
+      last check
+  */
+  bool IsCancelled() const;
+
   /*
       Associate some data with the job. This data cannot be type
       checked when it is accessed, so make sure that the expected
       types are well documented.
 
-      Recommend using a struct for multiple arguments. This should
-      be smaller than PADDING_BYTES (checked with a static assert).
+      The data is copy constructed into the job, and destroyed when the
+      job's memory is reused (or when SetData is called again), so types
+      that own memory, like std::string or std::vector, are safe to use.
+
+      Recommend using a struct for multiple arguments. Data up to
+      PADDING_BYTES is kept in the job itself. Anything bigger is copied
+      into a block from the calling thread's PayloadArena, which is given
+      back automatically when the job finishes.
 
       data - the data to put in the jobs storage space
   */
   template <typename T> void SetData(const T& data);
 
+  /*
+      Same as above, but moves the data into the job, so owned buffers and
+      move only types like std::unique_ptr can be handed over without a
+      copy
+  */
+  template <typename T>
+  typename std::enable_if<!std::is_lvalue_reference<T>::value>::type SetData(
+      T&& data);
+
   /*
       Retrive the associated data that is stored with this job.
       This data cannot be type checked when it is accessed, so
       when using make sure that the used type matches the expected type.
 
-      Recommend using a struct for multiple arguments. This should
-      be smaller than PADDING_BYTES (checked with a static assert).
+      Recommend using a struct for multiple arguments. Works the same
+      whether or not the data was too big to keep in the job.
   */
   template <typename T> T& GetData();
 
@@ -135,13 +461,25 @@ public:
   // Amount of data within a job
   static constexpr size_t PAYLOAD_SIZE =
       2 * sizeof(JobFunctionPointer) + sizeof(std::atomic_int) + sizeof(Job*) +
-      sizeof(std::atomic_char) + sizeof(unsigned char);
+      sizeof(std::atomic_char) + sizeof(std::atomic<unsigned char>) +
+      sizeof(std::atomic<std::uint16_t>) +
+      sizeof(std::uint32_t) + sizeof(std::atomic<std::uint32_t>) +
+      sizeof(std::atomic<void*>) + 2 * sizeof(std::atomic<std::uint32_t>) +
+      2 * sizeof(std::uint32_t) +
+      sizeof(Manager*) + sizeof(void (*)(Job*));
   // Amount of bytes to add in order to reach target size
   static constexpr size_t PADDING_BYTES = TARGET_JOB_SIZE - PAYLOAD_SIZE;
 
   // Fail to compile if trying to add negative
   static_assert(PAYLOAD_SIZE < TARGET_JOB_SIZE,
                 "Job size exceeds target job size");
+  // The two one byte members after the padding must leave the flags
+  // aligned, which must leave the four byte members aligned, and those
+  // must leave the pointers aligned
+  static_assert((PADDING_BYTES + 2) % 2 == 0 &&
+                    (PADDING_BYTES + 4) % 4 == 0 &&
+                    (PADDING_BYTES + 4 + 7 * 4) % sizeof(void*) == 0,
+                "Job members would be misaligned");
 
 #ifdef _DEBUG
   // Need access to private function to reset UnfinishedJobCount for testing
@@ -170,29 +508,259 @@ public:
   bool GetCompletable() const;
 
 private:
+  /*
+      A job that is waiting for the job it is attached to to finish
+  */
+  struct Successor
+  {
+    Job* job;
+    Successor* next;
+  };
+
+  /*
+      Members are ordered so that every one of them is naturally aligned
+      (the pool lines jobs up on TARGET_JOB_SIZE boundaries): the payload
+      first, then the one byte members, then the two byte flags, then the
+      four byte members, then the pointers. Keep it that way when adding
+      members, or atomics end up misaligned, which is slow on x86 and a
+      crash elsewhere
+  */
+
+  // Padding bytes, where job data is kept
+  unsigned char padding_[PADDING_BYTES];
+
+  // Number of other parts of code that need this job to remain 'alive'
+  std::atomic_char ghostJobCount_;
+
+  // Number of owners keeping this job's memory from going back to the
+  // pool. Starts at 1 for the job itself, which lets go when it finishes
+  std::atomic<unsigned char> retainCount_;
+
+  // Information about this job. Atomic since it can be cancelled from
+  // another thread
+  std::atomic<std::uint16_t> flags_;
+
+  // Number of child jobs including this one that need to be completed before
+  // this job is done
+  std::atomic_int unfinishedJobs_;
+
+  // Index of this job's memory in the pool. Set once by the pool and never
+  // copied between jobs
+  std::uint32_t slot_;
+
+  // Number of jobs that have finished in this job's memory. Belongs to the
+  // memory rather than the job, so is never copied between jobs either
+  std::atomic<std::uint32_t> generation_;
+
+  // Number of unfinished jobs this one depends on, plus one until this
+  // job has been submitted
+  std::atomic<std::uint32_t> pendingDependencies_;
+
+  // When this job was submitted, in the manager's microsecond ticks, or 0
+  // if its wait isn't being timed
+  std::uint32_t submitTime_;
+
+  // When this job should be done running by, in the manager's microsecond
+  // ticks, or 0 if it has no deadline
+  std::uint32_t deadline_;
+
+  // Value of sCancels_ when this job last found nothing above it had been
+  // cancelled, so it doesn't have to look again until something has
+  mutable std::atomic<std::uint32_t> cancelsSeen_;
+
   // Function that contains the actual job behavior
   JobFunctionPointer jobFunc_;
   // Function that contains the callback (may be nullptr)
   JobFunctionPointer callbackFunc_;
 
-  // Number of child jobs including this one that need to be completed before
-  // this job is done
-  std::atomic_int unfinishedJobs_;
+  union
+  {
+    // Parent of this job
+    Job* parent_;
+    // Next job in the pool's free list while this job is not in use
+    Job* nextFree_;
+  };
 
-  // Parent of this job
-  Job* parent_;
+  // Jobs waiting for this one to finish. Set to &sClosedSuccessors_ once
+  // this job has finished, so late dependencies know not to wait
+  std::atomic<Successor*> successors_;
+  static Successor sClosedSuccessors_;
 
-  // Number of other parts of code that need this job to remain 'alive'
-  std::atomic_char ghostJobCount_;
+  // Number of times any job has been cancelled
+  static std::atomic<std::uint32_t> sCancels_;
 
-  // Information about this job
-  unsigned char flags_;
+  /*
+      Successor nodes given back on one thread, handed out again before
+      going to the heap. Nodes go back to whichever thread finished the job
+      they hung off, which is fine since they are all the same size
+  */
+  struct SuccessorCache
+  {
+    SuccessorCache();
+    ~SuccessorCache();
+
+    Successor* freeList;
+    size_t count;
+  };
+
+  static thread_local SuccessorCache tSuccessorCache_;
+
+  // Most successor nodes a thread keeps around before giving them back to
+  // the heap
+  static constexpr size_t scMaxCachedSuccessors_ = 1024;
+
+  // Manager this job was submitted to while it still had dependencies,
+  // so whoever finishes the last of them knows where to send it
+  Manager* manager_;
+
+  // Cleans up whatever the payload holds before the memory is reused
+  // (may be nullptr)
+  void (*payloadDestructor_)(Job*);
 
   // Complete all steps to properly terminate a job
   void Finish();
 
-  // Padding bytes
-  unsigned char padding_[PADDING_BYTES];
+  /*
+      Deal with an exception thrown by this job's function
+  */
+  void Fail(std::exception_ptr exception);
+
+  /*
+      Finish this job, but not its parent. Returns the parent if this job
+      is now done, so it needs finishing too, or nullptr if not
+  */
+  Job* FinishOne();
+
+  /*
+      Submit the callback of a job that is done apart from it, as a job
+      which finishes this one once it has run. Returns false if it had to
+      run the callback here instead
+  */
+  bool SubmitCallback();
+
+  /*
+      Hand every job waiting on this one its share of being ready to run
+  */
+  void ReleaseSuccessors();
+
+  /*
+      Get a successor node from the calling thread's cache, or the heap if
+      it has none
+  */
+  static Successor* AllocateSuccessor();
+
+  /*
+      Give back a successor node from AllocateSuccessor
+  */
+  static void FreeSuccessor(Successor* node);
+
+  /*
+      Finish for jobs owned by a TaskGraph. Instead of going back to the
+      pool the job stays put to be run again, and its list of successors
+      is left as it is for next time. Returns the parent, the same as
+      FinishOne
+  */
+  Job* FinishReusable();
+
+  /*
+      Keep this job out of the pool when it finishes, so it can be run
+      again with ResetForReuse
+  */
+  void MakeReusable();
+
+  /*
+      Get a reusable job ready to run again
+
+      manager - manager to submit successors to
+      dependencies - number of jobs that must finish before this one can run
+      unfinishedJobs - number of times Finish must be called for this job
+                       to be done (1, plus any children)
+  */
+  void ResetForReuse(Manager* manager, std::uint32_t dependencies,
+                     int unfinishedJobs);
+
+  /*
+      Give a reusable job back to the pool for good
+  */
+  void ReleaseReusable();
+
+  /*
+      Payloads that fit in the padding live there, anything else is given a
+      PayloadArena block and the padding holds a pointer to it
+  */
+  template <typename T>
+  using IsInlinePayload =
+      std::integral_constant<bool, sizeof(T) <= PADDING_BYTES>;
+
+  /*
+      Construct a T as this job's payload, destroying any payload it
+      already had. The T is destroyed when the job is recycled, which is
+      skipped entirely for small payloads that don't need destroying
+  */
+  template <typename T, typename... Args> T& EmplacePayload(Args&&... args);
+
+  /*
+      Get a payload put in place by EmplacePayload
+  */
+  template <typename T> T& GetPayload();
+
+  /*
+      Payload destructor for payloads put in place by EmplacePayload
+  */
+  template <typename T> static void PayloadDestructor(Job* job);
+
+  /*
+      Destroy this job's payload, if it has one that needs destroying
+  */
+  void DestroyPayload();
+
+  /*
+      Job function for jobs made from a callable that returns nothing
+  */
+  template <typename F> static void RunCallable(Job* job);
+
+  /*
+      Keep this job's memory from being reused after it finishes, until
+      Release is called. Only the creator may call this, before the job is
+      submitted, or something that is keeping the job from finishing, so
+      the job can't have let go of itself yet
+  */
+  void Retain();
+
+  /*
+      Let go of the job's memory. The last owner to let go gives it back
+      to the pool
+  */
+  void Release();
+
+  /*
+      Throw away the exception kept for this job if nothing took a handle
+      to it, since then nothing can wait for it. Called as the job finishes
+  */
+  void DropUnwantedException();
+
+  /*
+      Let go of the memory kept for an exception, once it has been taken
+  */
+  void ReleaseException();
+
+  /*
+      Say that nothing is going to wait on this job after all, so anything
+      it throws from now on isn't kept
+  */
+  void ForgetHandles();
+
+  /*
+      Clean up the payload and give the memory back to the pool
+  */
+  void Recycle();
+
+  /*
+      Called when this job is submitted, remembering the manager. If it
+      still has unfinished dependencies return true, leaving the last
+      dependency to submit it. Returns false if it can run now
+  */
+  bool DeferUntilReady(Manager* manager);
 
 #ifdef _DEBUG
   static std::atomic_size_t sJobsAdded_;
@@ -206,7 +774,7 @@ private:
       not through the specific functions for it. Allowing user-constructed jobs
       is error prone as they could go out of scope and their memory freed before
       job is executed, so all jobs live in preallocated space
-      as a static member of this class
+      owned by the JobPool
   */
 
   /*
@@ -228,17 +796,20 @@ private:
   */
   Job& operator=(const Job& job);
 
-  // Amount of jobs for which memory should be preallocated
-  // 2^16 is the maximum amount used in stress testing, but can easily be
-  // increased
-  static constexpr size_t scMaxJobAlloc_ = 1 << 16;
-  // Bitmask to use instead of % for powers of 2
-  static constexpr size_t scJobLoopBitMask_ = scMaxJobAlloc_ - 1;
-  // Memory pool to allocate all jobs inside
-  static Job sPreallocJobArray_[scMaxJobAlloc_];
-
-  // Index of current place in pool used for allocation
-  static std::atomic_size_t sCurJobIndex_;
+  // All jobs live in memory owned by the pool
+  friend class JobPool;
+  // Handles look at the generation to see if their job is done
+  friend class JobHandle;
+  // Exceptions keep the job's memory around until they are taken
+  friend class JobErrors;
+  // Managers hold on to jobs that are waiting on dependencies
+  friend class Manager;
+  // Task graphs keep their jobs around to run again and again
+  friend class TaskGraph;
+  // Futures keep their job around to read the result out of it
+  template <typename T> friend class JobFuture;
+  // Workers count the jobs that run past their deadline
+  friend class Worker;
 };
 #pragma pack(pop)
 
@@ -268,7 +839,7 @@ struct ImportantJobFunction : public JobFunction
 };
 
 template <typename T>
-inline Job* Job::Create(JobFunction& function, const T& data)
+inline Job* Job::Create(const JobFunction& function, const T& data)
 {
   Job* job = Create(function);
   job->SetData<T>(data);
@@ -276,30 +847,113 @@ inline Job* Job::Create(JobFunction& function, const T& data)
 }
 
 template <typename T>
-inline Job* Job::CreateChild(JobFunction& function, const T& data, Job* parent)
+inline Job* Job::CreateChild(const JobFunction& function, const T& data,
+                             Job* parent)
 {
   Job* job = CreateChild(function, parent);
   job->SetData<T>(data);
   return job;
 }
 
+template <typename F>
+inline typename Detail::JobFor<F>::type Job::Create(F&& function,
+                                                    JobType type)
+{
+  return CreateChild(std::forward<F>(function), nullptr, type);
+}
+
+template <typename F>
+inline typename Detail::JobFor<F>::type
+Job::CreateChild(F&& function, Job* parent, JobType type)
+{
+  typedef typename std::decay<F>::type Callable;
+
+  Job* job = CreateChild(JobFunction(&RunCallable<Callable>, type), parent);
+  job->EmplacePayload<Callable>(std::forward<F>(function));
+  return job;
+}
+
+template <typename T, typename... Args>
+inline T& Job::EmplacePayload(Args&&... args)
+{
+  static_assert(alignof(T) <= PayloadArena::scBlockAlignment,
+                "Job payload is too strictly aligned");
+
+  DestroyPayload();
+
+  void* space = padding_;
+  if (!IsInlinePayload<T>::value)
+  {
+    space                              = PayloadArena::Allocate(sizeof(T));
+    *reinterpret_cast<void**>(padding_) = space;
+  }
+
+  T* payload = new (space) T(std::forward<Args>(args)...);
+
+  // Plain data in the padding can just be forgotten about
+  if (!IsInlinePayload<T>::value || !std::is_trivially_destructible<T>::value)
+  {
+    payloadDestructor_ = &PayloadDestructor<T>;
+  }
+  return *payload;
+}
+
+template <typename T> inline T& Job::GetPayload()
+{
+  return IsInlinePayload<T>::value ? *reinterpret_cast<T*>(padding_)
+                                   : **reinterpret_cast<T**>(padding_);
+}
+
+template <typename T> inline void Job::PayloadDestructor(Job* job)
+{
+  T& payload = job->GetPayload<T>();
+  payload.~T();
+
+  if (!IsInlinePayload<T>::value)
+  {
+    PayloadArena::Free(&payload);
+  }
+}
+
+template <typename F> inline void Job::RunCallable(Job* job)
+{
+  Detail::Invoke(job->GetPayload<F>(), job, Detail::TakesJob<F>());
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_lvalue_reference<T>::value, Job*>::type
+Job::Create(const JobFunction& function, T&& data)
+{
+  Job* job = Create(function);
+  job->SetData(std::move(data));
+  return job;
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_lvalue_reference<T>::value, Job*>::type
+Job::CreateChild(const JobFunction& function, T&& data, Job* parent)
+{
+  Job* job = CreateChild(function, parent);
+  job->SetData(std::move(data));
+  return job;
+}
+
 template <typename T> inline void Job::SetData(const T& data)
 {
-  // Verify that the data will fit in the allocated space
-  static_assert(sizeof(T) <= PADDING_BYTES,
-                "Job data too large, recommend passing by pointer");
+  // Put the data in the padding bytes, or an arena block if it's too big
+  EmplacePayload<T>(data);
+}
 
-  // Put the data in the padding bytes
-  *reinterpret_cast<T*>(padding_) = data;
+template <typename T>
+inline typename std::enable_if<!std::is_lvalue_reference<T>::value>::type
+Job::SetData(T&& data)
+{
+  EmplacePayload<typename std::remove_cv<T>::type>(std::move(data));
 }
 template <typename T> inline T& Job::GetData()
 {
-  // Verify that the requested data is small enough to be in the padding space
-  static_assert(sizeof(T) <= PADDING_BYTES,
-                "Job data too large, recommend passing by pointer");
-
-  // Get the data from the padding bytes
-  return *reinterpret_cast<T*>(padding_);
+  // Get the data from the padding bytes, or the arena block they point at
+  return GetPayload<T>();
 }
 }
 
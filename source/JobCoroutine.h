@@ -0,0 +1,333 @@
+/**************************************************************************
+    Declaration of JobTask, for writing jobs as C++20 coroutines that
+    co_await other jobs, futures and timers
+
+    Only available when the compiler supports coroutines, in which case
+    JOBBOT_COROUTINES is defined. The rest of the library doesn't need it
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBCOROUTINE_H
+#define _JOBCOROUTINE_H
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define JOBBOT_COROUTINES 1
+#endif
+#endif
+
+#ifdef JOBBOT_COROUTINES
+
+#include <assert.h>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+
+#include "Job.h"
+#include "JobFuture.h"
+#include "Manager.h"
+
+namespace JobBot
+{
+/*
+    A job written as a coroutine.
+
+    Calling a function that returns a JobTask makes a job that hasn't run
+    yet. Submit it like any other job, wait on it, add dependencies to it or
+    cancel it. Once it is running the coroutine can co_await:
+
+      Submit(job) or Submit(jobs, count) - submit jobs and wait for all of
+                                           them to finish
+      Delay(time)                        - wait for some time to pass
+      a JobFuture                        - wait for its result
+
+    Waiting doesn't tie up the worker. The coroutine is put aside and the
+    worker goes on to other jobs, and once whatever it was waiting for is
+    done a new job picks the coroutine up again, on whichever worker gets
+    to it. Those jobs are children of the task's job, so the task's job
+    doesn't finish until the coroutine does, and nothing ends up waiting
+    on top of anything else's stack the way WorkWhileWaitingFor does.
+
+    A task that throws fails the same way a job would, with the exception
+    rethrown to whoever waits on the task's job. Cancelling the task's job
+    stops the coroutine at its next co_await, destroying it without
+    running any more of it.
+*/
+class JobTask
+{
+public:
+  struct promise_type;
+
+  /*
+      Get the job that runs this task
+  */
+  Job* GetJob() const { return job_; }
+
+private:
+  explicit JobTask(Job* job) : job_(job) {}
+
+  Job* job_;
+};
+
+namespace Detail
+{
+typedef std::coroutine_handle<JobTask::promise_type> TaskHandle;
+
+/*
+    Where a task's exception is left between the coroutine ending and the
+    job that resumed it finding out. The coroutine always ends on the
+    thread that resumed it, before resume returns, so this is per thread
+*/
+inline std::exception_ptr& TaskException()
+{
+  static thread_local std::exception_ptr tException;
+  return tException;
+}
+
+/*
+    Payload of the jobs that start and resume a task. If the job never
+    runs (it was cancelled) the coroutine is destroyed along with it
+*/
+class TaskResumer
+{
+public:
+  explicit TaskResumer(TaskHandle handle) : handle_(handle) {}
+
+  TaskResumer(TaskResumer&& other) noexcept : handle_(other.handle_)
+  {
+    other.handle_ = nullptr;
+  }
+
+  TaskResumer(const TaskResumer&) = delete;
+  TaskResumer& operator=(const TaskResumer&) = delete;
+
+  ~TaskResumer()
+  {
+    if (handle_)
+    {
+      handle_.destroy();
+    }
+  }
+
+  void operator()(Job* job);
+
+private:
+  TaskHandle handle_;
+};
+}
+
+struct JobTask::promise_type
+{
+  JobTask get_return_object()
+  {
+    job = Job::Create(
+        Detail::TaskResumer(Detail::TaskHandle::from_promise(*this)));
+
+    // The jobs resuming the task are children of this one, so whatever they
+    // throw is kept for whoever waits on the task
+    job->KeepExceptions();
+    return JobTask(job);
+  }
+
+  // Nothing runs until the task's job does
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  std::suspend_never final_suspend() noexcept { return {}; }
+
+  void return_void() {}
+
+  void unhandled_exception()
+  {
+    Detail::TaskException() = std::current_exception();
+  }
+
+  // Job this task runs as
+  Job* job = nullptr;
+  // Manager the task's job was submitted to, where everything it waits on
+  // is submitted too
+  Manager* manager = nullptr;
+};
+
+namespace Detail
+{
+inline void TaskResumer::operator()(Job* job)
+{
+  // The coroutine may finish, or be picked up by another job, before
+  // resume returns, so let go of it first
+  TaskHandle handle = handle_;
+  handle_           = nullptr;
+
+  // The first run is the task's own job. This thread may have workers for
+  // other managers too, so go by where the job was submitted
+  if (handle.promise().manager == nullptr)
+  {
+    handle.promise().manager = job->GetManager();
+    assert(handle.promise().manager != nullptr &&
+           "Tasks must be submitted to a manager");
+  }
+
+  handle.resume();
+
+  std::exception_ptr exception;
+  exception.swap(TaskException());
+  if (exception != nullptr)
+  {
+    std::rethrow_exception(exception);
+  }
+}
+
+/*
+    Base of everything a task can co_await
+*/
+class TaskAwaiter
+{
+public:
+  bool await_ready() const noexcept { return false; }
+  void await_resume() const noexcept {}
+
+protected:
+  /*
+      Make the job that picks a task back up again. It is a child of the
+      task's job, so that stays unfinished in the meantime
+  */
+  static Job* MakeResumeJob(TaskHandle handle)
+  {
+    Job* task = handle.promise().job;
+    return Job::CreateChild(TaskResumer(handle), task, task->GetType());
+  }
+};
+
+/*
+    Submits some jobs, and resumes the task once they have all finished
+*/
+class SubmitAwaiter : public TaskAwaiter
+{
+public:
+  SubmitAwaiter(Job* job) : jobs_(&job_), count_(1), job_(job) {}
+  SubmitAwaiter(Job* const* jobs, size_t count)
+      : jobs_(jobs), count_(count), job_(nullptr)
+  {
+  }
+
+  bool await_ready() const noexcept { return count_ == 0; }
+
+  void await_suspend(TaskHandle handle)
+  {
+    Manager* manager = handle.promise().manager;
+    Job* resume      = MakeResumeJob(handle);
+    for (size_t i = 0; i < count_; ++i)
+    {
+      resume->AddDependency(jobs_[i]);
+    }
+
+    // The task can be resumed on another worker as soon as the last job
+    // is submitted, and this awaiter lives in the task, so it must not be
+    // touched after that
+    Job* const* jobs   = jobs_;
+    const size_t count = count_;
+    manager->SubmitJob(resume);
+    manager->SubmitJobs(jobs, count);
+  }
+
+private:
+  Job* const* jobs_;
+  size_t count_;
+  Job* job_;
+};
+
+/*
+    Resumes the task once some time has passed
+*/
+class DelayAwaiter : public TaskAwaiter
+{
+public:
+  explicit DelayAwaiter(std::chrono::microseconds delay) : delay_(delay) {}
+
+  bool await_ready() const noexcept { return delay_.count() <= 0; }
+
+  void await_suspend(TaskHandle handle)
+  {
+    handle.promise().manager->SubmitJobAfter(MakeResumeJob(handle), delay_);
+  }
+
+private:
+  std::chrono::microseconds delay_;
+};
+
+/*
+    Resumes the task once a future's job has finished, and gives its result
+*/
+template <typename T> class FutureAwaiter : public TaskAwaiter
+{
+public:
+  explicit FutureAwaiter(JobFuture<T>& future) : future_(future) {}
+
+  bool await_ready() const { return future_.IsReady(); }
+
+  void await_suspend(TaskHandle handle)
+  {
+    Job* resume = MakeResumeJob(handle);
+
+    // The future keeps its job's memory around, so this is safe even if
+    // the job has already finished
+    resume->AddDependency(future_.GetJob());
+    handle.promise().manager->SubmitJob(resume);
+  }
+
+  T await_resume() { return future_.Get(); }
+
+private:
+  JobFuture<T>& future_;
+};
+}
+
+/*
+    Submit a job to the task's manager and wait for it to finish. The job
+    must not have been submitted already
+*/
+inline Detail::SubmitAwaiter Submit(Job* job)
+{
+  return Detail::SubmitAwaiter(job);
+}
+
+/*
+    Submit a batch of jobs to the task's manager at once, and wait for all
+    of them to finish. The jobs must not have been submitted already, and
+    the array must stay put until the task is resumed
+*/
+inline Detail::SubmitAwaiter Submit(Job* const* jobs, size_t count)
+{
+  return Detail::SubmitAwaiter(jobs, count);
+}
+
+/*
+    Wait for some time to pass, using the manager's timers (see
+    Manager::SubmitJobAfter)
+*/
+inline Detail::DelayAwaiter Delay(std::chrono::microseconds delay)
+{
+  return Detail::DelayAwaiter(delay);
+}
+
+/*
+    Wait for a future's job to finish and take its result, rethrowing
+    anything it threw. The future's job must have been submitted
+*/
+template <typename T>
+inline Detail::FutureAwaiter<T> operator co_await(JobFuture<T>& future)
+{
+  return Detail::FutureAwaiter<T>(future);
+}
+
+template <typename T>
+inline Detail::FutureAwaiter<T> operator co_await(JobFuture<T>&& future)
+{
+  return Detail::FutureAwaiter<T>(future);
+}
+}
+
+#endif
+#endif
@@ -0,0 +1,116 @@
+/**************************************************************************
+    Contains implementation of the Chase-Lev work stealing deque used
+    for worker local job storage
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <assert.h>
+
+#include "JobDeque.h"
+
+namespace JobBot
+{
+JobDeque::JobDeque(size_t aCapacity)
+    : top_(0), bottom_(0), buffer_(new std::atomic<Job*>[aCapacity]),
+      mask_(static_cast<std::int64_t>(aCapacity) - 1)
+{
+  // Capacity must be a power of 2 for the bitmask to work
+  assert(aCapacity != 0 && (aCapacity & (aCapacity - 1)) == 0);
+
+  for (size_t i = 0; i < aCapacity; ++i)
+  {
+    buffer_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+JobDeque::~JobDeque() { delete[] buffer_; }
+
+bool JobDeque::Push(Job* job)
+{
+  std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+  std::int64_t top    = top_.load(std::memory_order_acquire);
+
+  // Deque is full, let the caller put the job somewhere else
+  if (bottom - top > mask_)
+  {
+    return false;
+  }
+
+  buffer_[bottom & mask_].store(job, std::memory_order_relaxed);
+
+  // Job must be visible in the buffer before thieves can see the new bottom
+  bottom_.store(bottom + 1, std::memory_order_release);
+
+  return true;
+}
+
+Job* JobDeque::Pop()
+{
+  std::int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+  bottom_.store(bottom, std::memory_order_relaxed);
+
+  // Claim the bottom slot before looking at what thieves have taken
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::int64_t top = top_.load(std::memory_order_relaxed);
+
+  if (top > bottom)
+  {
+    // Deque was empty, put bottom back where it was
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Job* job = buffer_[bottom & mask_].load(std::memory_order_relaxed);
+
+  if (top == bottom)
+  {
+    // This is the last job, so race any thieves for it
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+    {
+      // A thief got it first
+      job = nullptr;
+    }
+
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  return job;
+}
+
+Job* JobDeque::Steal()
+{
+  std::int64_t top = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+  if (top >= bottom)
+  {
+    return nullptr;
+  }
+
+  Job* job = buffer_[top & mask_].load(std::memory_order_relaxed);
+
+  // Race the owner and other thieves for this job
+  if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+  {
+    return nullptr;
+  }
+
+  return job;
+}
+
+size_t JobDeque::Size() const
+{
+  std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+  std::int64_t top    = top_.load(std::memory_order_relaxed);
+
+  return (bottom > top) ? static_cast<size_t>(bottom - top) : 0;
+}
+
+bool JobDeque::Empty() const { return Size() == 0; }
+}
@@ -0,0 +1,105 @@
+/**************************************************************************
+    Declaration of JobDeque, a fixed capacity Chase-Lev work stealing deque
+    that each worker keeps its local jobs in
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBDEQUE_H
+#define _JOBDEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace JobBot
+{
+// Forward declaration
+class Job;
+
+/*
+    Single owner, multiple thief deque of jobs.
+
+    The owning worker pushes and pops at the bottom (LIFO, so recently
+    created child jobs run while their data is still in cache) and any
+    other thread may steal from the top (FIFO, so thieves take the oldest
+    and usually largest pieces of work).
+
+    Based on "Correct and Efficient Work-Stealing for Weak Memory Models"
+    (Le, Pop, Cohen, Zappa Nardelli 2013), without the growable buffer.
+*/
+class JobDeque
+{
+public:
+  /*
+      Create a deque that can hold up to capacity jobs
+
+      capacity - maximum number of jobs, must be a power of 2
+  */
+  explicit JobDeque(size_t capacity);
+
+  /*
+      Free the job buffer (does not touch the jobs themselves)
+  */
+  ~JobDeque();
+
+  /*
+      Copying a deque does not make sense
+  */
+  JobDeque(const JobDeque&) = delete;
+  JobDeque& operator=(const JobDeque&) = delete;
+
+  /*
+      Add a job to the bottom of the deque. Only the owner may call this.
+
+      Returns false if the deque is full, in which case the job was not added
+  */
+  bool Push(Job* job);
+
+  /*
+      Take the most recently pushed job. Only the owner may call this.
+
+      Returns nullptr if the deque is empty
+  */
+  Job* Pop();
+
+  /*
+      Take the oldest job in the deque. Safe to call from any thread.
+
+      Returns nullptr if the deque is empty or another thread won the race
+      for the last job
+  */
+  Job* Steal();
+
+  /*
+      Approximate number of jobs in the deque. Only exact when called by the
+      owner with no thieves active.
+  */
+  size_t Size() const;
+
+  /*
+      Check if the deque looks empty
+  */
+  bool Empty() const;
+
+private:
+  // Size of a cache line, used to keep top_ and bottom_ apart
+  static constexpr size_t scCacheLineSize_ = 64;
+
+  // Index thieves take from. Kept on its own cache line from bottom_ so that
+  // thieves and the owner don't fight over the same line
+  std::atomic<std::int64_t> top_;
+  unsigned char topPadding_[scCacheLineSize_ - sizeof(std::int64_t)];
+  // Index the owner pushes to and pops from
+  std::atomic<std::int64_t> bottom_;
+  unsigned char bottomPadding_[scCacheLineSize_ - sizeof(std::int64_t)];
+
+  // Ring buffer of jobs
+  std::atomic<Job*>* buffer_;
+  // Bitmask to use instead of % for powers of 2
+  const std::int64_t mask_;
+};
+}
+#endif
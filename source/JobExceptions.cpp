@@ -3,10 +3,9 @@
 
     Author:    Jake McLeman
 ***************************************************************************/
-#include <string>
-
 #include "Job.h"
 #include "JobExceptions.h"
+#include "JobPool.h"
 
 namespace JobBot
 {
@@ -29,24 +28,82 @@ JobRejected::~JobRejected()
 
 const char* JobRejected::what() const throw()
 {
-  std::string error;
-  error += "Job was rejected by worker, ";
   switch (mode_)
   {
   case FailureType::NullJob:
-    error += "given job was null";
-    break;
+    return "Job was rejected, given job was null";
   case FailureType::QueueFull:
-    error += "worker's queue was full";
-    break;
+    return "Job was rejected, there was no room left for it";
   default:
-    error += "reason was unknown";
-    break;
+    return "Job was rejected, reason was unknown";
   }
-  return nullptr;
 }
 
 JobRejected::FailureType JobRejected::GetFailureMode() const { return mode_; }
 
 Job* JobRejected::GetJob() const { return guiltyJob_; }
+
+std::atomic_size_t JobErrors::sCount_(0);
+std::unordered_map<std::uint64_t, std::exception_ptr> JobErrors::sEntries_;
+std::mutex JobErrors::sMutex_;
+
+bool JobErrors::Store(const JobHandle& handle, std::exception_ptr exception)
+{
+  std::lock_guard<std::mutex> lock(sMutex_);
+
+  if (!sEntries_.insert(std::make_pair(GetKey(handle), exception)).second)
+  {
+    return false;
+  }
+
+  sCount_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+std::exception_ptr JobErrors::Take(const JobHandle& handle)
+{
+  if (sCount_.load(std::memory_order_acquire) == 0) return nullptr;
+
+  std::exception_ptr exception;
+  {
+    std::lock_guard<std::mutex> lock(sMutex_);
+
+    auto found = sEntries_.find(GetKey(handle));
+    if (found == sEntries_.end()) return nullptr;
+
+    exception = found->second;
+    sEntries_.erase(found);
+    sCount_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // The job's memory was kept for the exception, so it is still this
+  // handle's job there
+  JobPool::GetJob(handle.slot_)->ReleaseException();
+  return exception;
+}
+
+void JobErrors::RethrowIfFailed(const JobHandle& handle)
+{
+  std::exception_ptr exception = Take(handle);
+  if (exception != nullptr)
+  {
+    std::rethrow_exception(exception);
+  }
+}
+
+size_t JobErrors::GetStoredCount()
+{
+  return sCount_.load(std::memory_order_acquire);
+}
+
+std::uint64_t JobErrors::GetKey(const JobHandle& handle)
+{
+  return (static_cast<std::uint64_t>(handle.slot_) << 32) |
+         handle.generation_;
+}
+
+const char* JobCancelled::what() const throw()
+{
+  return "Job was cancelled before it could produce a result";
+}
 }
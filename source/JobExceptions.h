@@ -9,7 +9,13 @@ All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
 #ifndef _JOBEXCEPTIONS_H
 #define _JOBEXCEPTIONS_H
 
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <mutex>
+#include <unordered_map>
+
+#include "JobHandle.h"
 
 namespace JobBot
 {
@@ -59,5 +65,77 @@ private:
   FailureType mode_;
   Job* guiltyJob_;
 };
+
+/*
+    Keeps exceptions thrown by jobs until whoever is waiting on the job
+    picks them up.
+
+    When a job function throws, the exception is stored against the root
+    of its tree, since that is usually what gets waited on, or against the
+    closest job above it that keeps them (see Job::KeepExceptions), as the
+    jobs of futures and tasks do. Waiting on that job with WaitForJob, a
+    JobHandle or a JobFuture then rethrows it on the waiting thread.
+
+    The job's memory isn't reused while an exception is kept for it, so a
+    handle can't miss its job's exception however late it looks. Only jobs
+    something has taken a handle to keep one, since nothing else can wait
+    for it. It stays until it is taken, so a handle to a job that may
+    throw and is never waited on should have it taken with Take.
+
+    Nothing is looked up unless some job has actually thrown, so waiting
+    costs the same as it always did when no job throws, and finishing a
+    job only looks if that job was given an exception.
+*/
+class JobErrors
+{
+public:
+  /*
+      Remember an exception thrown by the job a handle refers to. If that
+      job already has one the first is kept and this returns false
+  */
+  static bool Store(const JobHandle& handle, std::exception_ptr exception);
+
+  /*
+      Take the exception stored for a job, if there is one, so it is only
+      thrown once, and let the job's memory be reused. Also how to throw
+      away one nobody is going to wait for
+  */
+  static std::exception_ptr Take(const JobHandle& handle);
+
+  /*
+      Throw the exception stored for a job, if there is one
+  */
+  static void RethrowIfFailed(const JobHandle& handle);
+
+  /*
+      Number of exceptions stored that nobody has taken yet
+  */
+  static size_t GetStoredCount();
+
+private:
+  /*
+      Key for a handle's job, which stays unique after its memory is reused
+  */
+  static std::uint64_t GetKey(const JobHandle& handle);
+
+  // Number of stored exceptions, checked before bothering with the lock
+  static std::atomic_size_t sCount_;
+  // Stored exceptions, by the slot and generation of the job they are for
+  static std::unordered_map<std::uint64_t, std::exception_ptr> sEntries_;
+  static std::mutex sMutex_;
+};
+
+/*
+    Thrown when asking for the result of a job that was cancelled before it
+    got to run, so never produced one
+*/
+class JobCancelled : public std::exception
+{
+public:
+  /*
+      Gives back a string to say what went wrong
+  */
+  virtual const char* what() const throw();
+};
 }
 #endif
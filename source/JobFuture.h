@@ -0,0 +1,289 @@
+/**************************************************************************
+    Declaration of JobFuture, for getting the value a job returns, along
+    with the Job::Create variants that make them
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBFUTURE_H
+#define _JOBFUTURE_H
+
+#include <assert.h>
+#include <new>
+#include <utility>
+
+#include "Job.h"
+#include "JobExceptions.h"
+#include "JobHandle.h"
+#include "Worker.h"
+
+namespace JobBot
+{
+namespace Detail
+{
+/*
+    Which part of a FutureStorage is alive
+*/
+enum struct FutureState : unsigned char
+{
+  Pending,
+  Ready
+};
+
+/*
+    Payload of a job made from a callable returning T. The callable is
+    only needed until it has run, so the result takes over its space
+*/
+template <typename F, typename T> struct FutureStorage
+{
+  template <typename G>
+  explicit FutureStorage(G&& function)
+      : callable(std::forward<G>(function)), state(FutureState::Pending)
+  {
+  }
+
+  ~FutureStorage()
+  {
+    if (state == FutureState::Pending)
+    {
+      callable.~F();
+    }
+    else
+    {
+      result.~T();
+    }
+  }
+
+  union
+  {
+    F callable;
+    T result;
+  };
+  FutureState state;
+};
+}
+
+/*
+    The value a job will give back once it has finished.
+
+    Made by Job::Create with a callable that returns something. The future
+    keeps the job's memory from being reused until the result has been
+    taken with Get, or the future is destroyed, but doesn't otherwise hold
+    the job up: its parent, successors and callback all go ahead as soon as
+    the job finishes.
+
+    Futures can be moved but not copied, and Get can only be called once.
+*/
+template <typename T> class JobFuture
+{
+public:
+  /*
+      Make a future with no job. Only useful to move another future into
+  */
+  JobFuture() : job_(nullptr), result_(nullptr), state_(nullptr) {}
+
+  JobFuture(JobFuture&& other)
+      : job_(other.job_), handle_(other.handle_), result_(other.result_),
+        state_(other.state_), exception_(std::move(other.exception_))
+  {
+    other.job_ = nullptr;
+  }
+
+  JobFuture& operator=(JobFuture&& other)
+  {
+    if (this != &other)
+    {
+      Reset();
+      job_       = other.job_;
+      handle_    = other.handle_;
+      result_    = other.result_;
+      state_     = other.state_;
+      exception_ = std::move(other.exception_);
+      other.job_ = nullptr;
+    }
+    return *this;
+  }
+
+  JobFuture(const JobFuture&) = delete;
+  JobFuture& operator=(const JobFuture&) = delete;
+
+  /*
+      Let go of the job. If it hasn't finished it still runs, and its
+      result is thrown away
+  */
+  ~JobFuture() { Reset(); }
+
+  /*
+      Get the job that produces the result, to submit it, add dependencies
+      to it or cancel it
+  */
+  Job* GetJob() const { return job_; }
+
+  /*
+      Get a handle to the job that produces the result
+  */
+  JobHandle GetHandle() const { return handle_; }
+
+  /*
+      Does this future still have a result to give
+  */
+  bool IsValid() const { return job_ != nullptr; }
+
+  /*
+      Has the job finished, so Get won't have to wait
+  */
+  bool IsReady() const { return handle_.IsFinished(); }
+
+  /*
+      Wait for the job to finish. If the calling thread has a worker it
+      runs other jobs in the meantime, otherwise it just yields.
+
+      If the job throws, the exception is kept for Get to throw
+  */
+  void Wait() const
+  {
+    if (IsReady()) return;
+
+    try
+    {
+      Worker* worker = Worker::GetThisThreadsWorker();
+      if (worker != nullptr)
+      {
+        worker->WorkWhileWaitingFor(handle_);
+      }
+      else
+      {
+        handle_.Wait();
+      }
+    }
+    catch (...)
+    {
+      exception_ = std::current_exception();
+    }
+  }
+
+  /*
+      Wait for the job to finish and take its result, after which the
+      future is no longer valid
+
+      Rethrows the exception if the job threw one, and throws JobCancelled
+      if the job was cancelled before it ran
+  */
+  T Get()
+  {
+    assert(IsValid());
+    Wait();
+
+    if (*state_ != Detail::FutureState::Ready)
+    {
+      std::exception_ptr exception =
+          (exception_ != nullptr) ? exception_ : JobErrors::Take(handle_);
+      exception_ = nullptr;
+      Reset();
+
+      if (exception != nullptr)
+      {
+        std::rethrow_exception(exception);
+      }
+      throw JobCancelled();
+    }
+
+    // The moved from result is destroyed along with the rest of the payload
+    T result(std::move(*result_));
+    Reset();
+    return result;
+  }
+
+private:
+  friend class Job;
+
+  template <typename F> using Storage = Detail::FutureStorage<F, T>;
+
+  template <typename F>
+  JobFuture(Job* job, Storage<F>* storage)
+      : job_(job), handle_(job->GetHandle()), result_(&storage->result),
+        state_(&storage->state)
+  {
+  }
+
+  /*
+      Create the job for a callable, used by Job::Create
+  */
+  template <typename F, typename G>
+  static JobFuture Make(G&& function, Job* parent, JobType type)
+  {
+    Job* job = Job::CreateChild(JobFunction(&RunCallable<F>, type), parent);
+
+    Storage<F>& storage =
+        job->EmplacePayload<Storage<F>>(std::forward<G>(function));
+
+    // Hold on to the memory until the result has been taken
+    job->Retain();
+
+    // Whatever goes wrong under this job is for the future to throw
+    job->KeepExceptions();
+
+    return JobFuture(job, &storage);
+  }
+
+  /*
+      Job function for jobs made from a callable returning a value. Runs it
+      and puts the result where it was
+  */
+  template <typename F> static void RunCallable(Job* job)
+  {
+    Storage<F>* storage = &job->GetPayload<Storage<F>>();
+
+    T result = Detail::Invoke(storage->callable, job, Detail::TakesJob<F>());
+
+    storage->callable.~F();
+    new (&storage->result) T(std::move(result));
+    storage->state = Detail::FutureState::Ready;
+  }
+
+  /*
+      Let go of the job, if there is one
+  */
+  void Reset()
+  {
+    if (job_ != nullptr)
+    {
+      // Nothing else waits for what the job throws, so don't keep it
+      job_->ForgetHandles();
+      JobErrors::Take(handle_);
+      job_->Release();
+      job_ = nullptr;
+    }
+  }
+
+  // Job producing the result, kept from being reused while this is set
+  Job* job_;
+  JobHandle handle_;
+  // Where the result ends up, and whether it is there yet
+  T* result_;
+  const Detail::FutureState* state_;
+  // Exception the job threw, caught while waiting for it
+  mutable std::exception_ptr exception_;
+};
+
+template <typename F>
+inline typename Detail::FutureFor<F>::type Job::Create(F&& function,
+                                                        JobType type)
+{
+  return CreateChild(std::forward<F>(function), nullptr, type);
+}
+
+template <typename F>
+inline typename Detail::FutureFor<F>::type
+Job::CreateChild(F&& function, Job* parent, JobType type)
+{
+  typedef typename Detail::FutureFor<F>::result Result;
+  typedef typename std::decay<F>::type Callable;
+
+  return JobFuture<Result>::template Make<Callable>(std::forward<F>(function),
+                                                    parent, type);
+}
+}
+#endif
@@ -0,0 +1,55 @@
+/**************************************************************************
+    Contains implementation of JobHandle
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <thread>
+
+#include "Job.h"
+#include "JobExceptions.h"
+#include "JobHandle.h"
+#include "JobPool.h"
+
+namespace JobBot
+{
+JobHandle::JobHandle() : slot_(scNullSlot), generation_(0) {}
+
+JobHandle::JobHandle(std::uint32_t aSlot, std::uint32_t aGeneration)
+    : slot_(aSlot), generation_(aGeneration)
+{
+}
+
+bool JobHandle::IsFinished() const
+{
+  if (slot_ == scNullSlot) return true;
+
+  // Every job that finishes in a slot moves its generation on, so if the
+  // generation has changed this handle's job is long gone
+  return JobPool::GetJob(slot_)->generation_.load(std::memory_order_acquire) !=
+         generation_;
+}
+
+void JobHandle::Wait() const
+{
+  while (!IsFinished())
+  {
+    std::this_thread::yield();
+  }
+
+  JobErrors::RethrowIfFailed(*this);
+}
+
+bool JobHandle::IsValid() const { return slot_ != scNullSlot; }
+
+bool JobHandle::operator==(const JobHandle& other) const
+{
+  return slot_ == other.slot_ && generation_ == other.generation_;
+}
+
+bool JobHandle::operator!=(const JobHandle& other) const
+{
+  return !(*this == other);
+}
+}
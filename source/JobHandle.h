@@ -0,0 +1,81 @@
+/**************************************************************************
+    Declaration of JobHandle, a reference to a job that stays correct after
+    the job has finished and its memory has been reused
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBHANDLE_H
+#define _JOBHANDLE_H
+
+#include <cstdint>
+
+namespace JobBot
+{
+// Forward declaration
+class Job;
+
+/*
+    Lightweight, copyable reference to a job.
+
+    Job memory is recycled as soon as a job finishes, so a plain Job* kept
+    around after that may end up pointing at some newer job. A handle
+    remembers which use of the memory it refers to (the job's slot in the
+    pool and how many jobs have finished in that slot), so it can always
+    tell whether its own job is done without keeping the job alive.
+
+    Get one with Job::GetHandle before submitting the job.
+*/
+class JobHandle
+{
+public:
+  /*
+      Make a handle that doesn't refer to any job. Counts as finished
+  */
+  JobHandle();
+
+  /*
+      Has the job this handle refers to finished (including its children)
+
+      Correct even if the job's memory has since been given to another job
+  */
+  bool IsFinished() const;
+
+  /*
+      Block until the job has finished, yielding this thread while waiting.
+      Rethrows the exception if a job in its tree threw one and it was kept
+      for this job (see JobErrors)
+
+      Worker threads should use Worker::WorkWhileWaitingFor instead, so they
+      can do other jobs while they wait
+  */
+  void Wait() const;
+
+  /*
+      Does this handle refer to a job at all
+  */
+  bool IsValid() const;
+
+  bool operator==(const JobHandle& other) const;
+  bool operator!=(const JobHandle& other) const;
+
+private:
+  // Jobs are the only way to make a handle that refers to something
+  friend class Job;
+  // Exceptions are stored by slot and generation
+  friend class JobErrors;
+
+  JobHandle(std::uint32_t slot, std::uint32_t generation);
+
+  // Slot that handles that don't refer to a job use
+  static constexpr std::uint32_t scNullSlot = 0xFFFFFFFF;
+
+  // Where the job is in the pool
+  std::uint32_t slot_;
+  // Value of the slot's generation while this handle's job was in it
+  std::uint32_t generation_;
+};
+}
+#endif
@@ -0,0 +1,348 @@
+/**************************************************************************
+    Contains implementation of the per-thread slab allocator for jobs
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <new>
+
+#include "Job.h"
+#include "JobExceptions.h"
+#include "JobPool.h"
+
+namespace JobBot
+{
+// need a definition
+constexpr size_t JobPool::scDefaultInitialCapacity;
+constexpr size_t JobPool::scDefaultMaxCapacity;
+
+// Initialize static members of the pool
+std::atomic<JobPool::Segment*> JobPool::sSegments_[scMaxSegments] = {};
+std::atomic_size_t JobPool::sAllocatedSlabs_(0);
+std::atomic_size_t JobPool::sNextSlab_(0);
+std::atomic_size_t JobPool::sMaxCapacity_(scDefaultMaxCapacity);
+std::mutex JobPool::sGrowMutex_;
+JobPool::ThreadCache* JobPool::sCaches_ = nullptr;
+std::mutex JobPool::sCacheMutex_;
+thread_local JobPool::ThreadCacheHolder JobPool::tCache_;
+
+namespace
+{
+// Counters are only ever written by the thread owning them, so an increment
+// does not need to be a locked read-modify-write
+inline void BumpCounter(std::atomic_size_t& counter)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+}
+
+JobPool::ThreadCacheHolder::~ThreadCacheHolder()
+{
+  if (cache == nullptr) return;
+
+  // Jobs from this cache's slabs may still be alive, and will be freed back
+  // to it later, so the cache is kept around for another thread to adopt
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+  cache->orphaned = true;
+}
+
+Job* JobPool::Allocate()
+{
+  ThreadCache* cache = GetThreadCache();
+
+  Job* job = cache->freeList;
+  if (job != nullptr)
+  {
+    cache->freeList = job->nextFree_;
+  }
+  else
+  {
+    job = AllocateSlow(cache);
+  }
+
+  BumpCounter(cache->allocations);
+  return job;
+}
+
+void JobPool::Free(Job* job)
+{
+  ThreadCache* cache = GetThreadCache();
+  ThreadCache* owner = GetOwner(job);
+
+  BumpCounter(cache->frees);
+
+  if (owner == cache)
+  {
+    job->nextFree_  = cache->freeList;
+    cache->freeList = job;
+  }
+  else
+  {
+    // Push onto the owner's remote list. The owner only ever takes the
+    // whole list at once, so there is no ABA problem here
+    Job* head = owner->remoteFreeList.load(std::memory_order_relaxed);
+    do
+    {
+      job->nextFree_ = head;
+    } while (!owner->remoteFreeList.compare_exchange_weak(
+        head, job, std::memory_order_release, std::memory_order_relaxed));
+  }
+}
+
+Job* JobPool::GetJob(std::uint32_t slot)
+{
+  Segment* segment =
+      sSegments_[slot / scSegmentSize].load(std::memory_order_acquire);
+
+  return &segment->jobs[slot % scSegmentSize];
+}
+
+JobPool::Stats JobPool::GetStats()
+{
+  Stats stats = {0, 0, 0, 0, 0};
+
+  stats.capacity =
+      sAllocatedSlabs_.load(std::memory_order_relaxed) * scSlabSize;
+  stats.maxCapacity = sMaxCapacity_.load(std::memory_order_relaxed);
+  stats.reserved = sNextSlab_.load(std::memory_order_relaxed) * scSlabSize;
+
+  size_t allocations = 0;
+  size_t frees       = 0;
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+  for (ThreadCache* cache = sCaches_; cache != nullptr; cache = cache->next)
+  {
+    allocations += cache->allocations.load(std::memory_order_relaxed);
+    frees += cache->frees.load(std::memory_order_relaxed);
+    ++stats.threadCaches;
+  }
+
+  stats.live = (allocations > frees) ? allocations - frees : 0;
+  return stats;
+}
+
+JobPool::ThreadCache* JobPool::GetThreadCache()
+{
+  if (tCache_.cache != nullptr)
+  {
+    return tCache_.cache;
+  }
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+
+  // Prefer taking over a cache from a thread that has exited so its slabs
+  // keep getting used
+  for (ThreadCache* cache = sCaches_; cache != nullptr; cache = cache->next)
+  {
+    if (cache->orphaned)
+    {
+      cache->orphaned = false;
+      tCache_.cache   = cache;
+      return cache;
+    }
+  }
+
+  ThreadCache* cache = new ThreadCache;
+  cache->freeList    = nullptr;
+  cache->remoteFreeList.store(nullptr, std::memory_order_relaxed);
+  cache->slabNext = nullptr;
+  cache->slabEnd  = nullptr;
+  cache->allocations.store(0, std::memory_order_relaxed);
+  cache->frees.store(0, std::memory_order_relaxed);
+  cache->orphaned = false;
+  cache->next     = sCaches_;
+  sCaches_        = cache;
+
+  tCache_.cache = cache;
+  return cache;
+}
+
+Job* JobPool::AllocateSlow(ThreadCache* cache)
+{
+  for (;;)
+  {
+    // Take back everything other threads have finished for us
+    Job* job =
+        cache->remoteFreeList.exchange(nullptr, std::memory_order_acquire);
+    if (job != nullptr)
+    {
+      cache->freeList = job->nextFree_;
+      return job;
+    }
+
+    // Bump through the current slab
+    if (cache->slabNext != cache->slabEnd)
+    {
+      return cache->slabNext++;
+    }
+
+    // Claim a fresh slab
+    if (ClaimSlab(cache))
+    {
+      continue;
+    }
+
+    // Every slab is claimed and the pool is at its limit, so the only jobs
+    // left are ones stuck in caches of threads that have exited, or
+    // waiting to be given back to threads that haven't needed them yet
+    job = ReclaimJobs();
+    if (job != nullptr)
+    {
+      cache->freeList = job->nextFree_;
+      return job;
+    }
+
+    // Pool is full and can't grow, so there is nowhere to put the job
+    throw JobRejected(JobRejected::FailureType::QueueFull, nullptr);
+  }
+}
+
+Job* JobPool::ReclaimJobs()
+{
+  Job* taken = nullptr;
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+  for (ThreadCache* cache = sCaches_; cache != nullptr; cache = cache->next)
+  {
+    // A live thread only ever takes its whole remote list at once, so it
+    // can be taken from under it the same way
+    Job* jobs[] = {
+        cache->orphaned ? cache->freeList : nullptr,
+        cache->remoteFreeList.exchange(nullptr, std::memory_order_acquire)};
+
+    for (Job* job : jobs)
+    {
+      while (job != nullptr)
+      {
+        Job* next      = job->nextFree_;
+        job->nextFree_ = taken;
+        taken          = job;
+        job            = next;
+      }
+    }
+
+    if (!cache->orphaned) continue;
+
+    // Along with whatever was left of its slab
+    cache->freeList = nullptr;
+    while (cache->slabNext != cache->slabEnd)
+    {
+      Job* job       = cache->slabNext++;
+      job->nextFree_ = taken;
+      taken          = job;
+    }
+  }
+
+  return taken;
+}
+
+void JobPool::Reserve(size_t jobs)
+{
+  // Memory past the most the pool may use could never be handed out
+  const size_t most = sMaxCapacity_.load(std::memory_order_relaxed);
+  if (jobs > most) jobs = most;
+
+  size_t slabs = (jobs + scSegmentSize - 1) / scSegmentSize * scSlabsPerSegment;
+
+  std::lock_guard<std::mutex> lock(sGrowMutex_);
+  Grow(slabs);
+}
+
+void JobPool::SetMaxCapacity(size_t jobs)
+{
+  if (jobs > scMaxCapacityLimit) jobs = scMaxCapacityLimit;
+  sMaxCapacity_.store(jobs, std::memory_order_relaxed);
+}
+
+bool JobPool::ClaimSlab(ThreadCache* cache)
+{
+  size_t slab = sNextSlab_.load(std::memory_order_relaxed);
+
+  for (;;)
+  {
+    if (slab >= sAllocatedSlabs_.load(std::memory_order_acquire))
+    {
+      std::lock_guard<std::mutex> lock(sGrowMutex_);
+
+      // Only add a segment if nobody else did while waiting for the lock
+      size_t maxSlabs =
+          sMaxCapacity_.load(std::memory_order_relaxed) / scSlabSize;
+      if (slab >= sAllocatedSlabs_.load(std::memory_order_relaxed) &&
+          slab < maxSlabs)
+      {
+        Grow(slab + 1);
+      }
+
+      if (slab >= sAllocatedSlabs_.load(std::memory_order_relaxed))
+      {
+        return false;
+      }
+    }
+
+    // Take the slab unless another thread beat us to it
+    if (sNextSlab_.compare_exchange_weak(slab, slab + 1,
+                                         std::memory_order_relaxed))
+    {
+      break;
+    }
+  }
+
+  Segment* segment = sSegments_[slab / scSlabsPerSegment].load(
+      std::memory_order_acquire);
+  size_t firstJob = (slab % scSlabsPerSegment) * scSlabSize;
+
+  segment->slabOwners[slab % scSlabsPerSegment] = cache;
+  cache->slabNext = segment->jobs + firstJob;
+  cache->slabEnd  = cache->slabNext + scSlabSize;
+
+  return true;
+}
+
+void JobPool::Grow(size_t slabs)
+{
+  size_t allocated = sAllocatedSlabs_.load(std::memory_order_relaxed);
+
+  while (allocated < slabs && allocated / scSlabsPerSegment < scMaxSegments)
+  {
+    size_t index = allocated / scSlabsPerSegment;
+
+    // Line jobs up with cache lines so no job shares a line with another
+    // and none of a job's atomics straddle two lines. Segments are never
+    // freed, so the unaligned pointer doesn't need to be kept
+    constexpr size_t alignment = Job::TARGET_JOB_SIZE;
+    unsigned char* memory =
+        new unsigned char[scSegmentSize * sizeof(Job) + alignment];
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory);
+    address = (address + alignment - 1) & ~std::uintptr_t(alignment - 1);
+
+    Segment* segment = new Segment;
+    segment->jobs    = reinterpret_cast<Job*>(address);
+    for (size_t i = 0; i < scSegmentSize; ++i)
+    {
+      new (&segment->jobs[i]) Job();
+      segment->jobs[i].slot_ =
+          static_cast<std::uint32_t>(index * scSegmentSize + i);
+    }
+    for (ThreadCache*& owner : segment->slabOwners)
+    {
+      owner = nullptr;
+    }
+
+    // Segment must be visible before anyone can claim slabs from it
+    sSegments_[index].store(segment, std::memory_order_release);
+    allocated += scSlabsPerSegment;
+    sAllocatedSlabs_.store(allocated, std::memory_order_release);
+  }
+}
+
+JobPool::ThreadCache* JobPool::GetOwner(const Job* job)
+{
+  size_t slot      = job->slot_;
+  Segment* segment = sSegments_[slot / scSegmentSize].load(
+      std::memory_order_relaxed);
+
+  return segment->slabOwners[(slot % scSegmentSize) / scSlabSize];
+}
+}
@@ -0,0 +1,219 @@
+/**************************************************************************
+    Declaration of JobPool, the allocator that hands out memory for jobs
+    from per-thread slabs so job creation does not contend between threads
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBPOOL_H
+#define _JOBPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace JobBot
+{
+// Forward declaration
+class Job;
+
+/*
+    Memory manager for jobs.
+
+    Memory is allocated in segments of scSegmentSize jobs as it is needed,
+    up to a configurable maximum. Segments are never moved or freed, so a
+    pointer to a job stays valid for the life of the program.
+
+    Segments are split into slabs of scSlabSize jobs. Each thread that creates
+    jobs claims slabs for itself and keeps a private free list, so in the
+    steady state creating a job is a pop from a thread local list.
+
+    Jobs are given back to the thread that owns their slab when they finish.
+    If a different thread finishes the job it is pushed onto the owner's
+    remote free list, which the owner takes back in one go when its own free
+    list runs dry.
+*/
+class JobPool
+{
+public:
+  /*
+      Snapshot of how much of the pool is being used
+  */
+  struct Stats
+  {
+    // Number of jobs the pool has allocated memory for
+    size_t capacity;
+    // Number of jobs the pool is allowed to grow to
+    size_t maxCapacity;
+    // Number of jobs in slabs that have been claimed by a thread
+    size_t reserved;
+    // Number of jobs that have been allocated and not finished yet
+    size_t live;
+    // Number of threads that have allocated or freed a job
+    size_t threadCaches;
+  };
+
+  /*
+      Get memory for a new job. The returned job has been default constructed
+      or finished, and should be assigned to right away.
+
+      Throws JobRejected with FailureType::QueueFull if every job is in use
+      and the pool is not allowed to grow any further. Before that, jobs
+      other threads have finished are taken from wherever they are waiting
+      to be given back
+  */
+  static Job* Allocate();
+
+  /*
+      Return a finished job to the thread that owns it
+  */
+  static void Free(Job* job);
+
+  /*
+      Get the job that lives in a slot of the pool. The slot must be one
+      that a job has been allocated from
+  */
+  static Job* GetJob(std::uint32_t slot);
+
+  /*
+      Get the current occupancy of the pool
+
+      Counters are gathered from every thread without stopping them, so the
+      result is approximate while jobs are being created or finished
+  */
+  static Stats GetStats();
+
+  /*
+      Make sure memory for at least this many jobs has been allocated
+      (rounded up to a whole number of segments), up to the most the pool
+      may grow to (see SetMaxCapacity)
+  */
+  static void Reserve(size_t jobs);
+
+  /*
+      Set the number of jobs the pool may grow to. The pool is shared by
+      everything in the process, so the most recent call wins.
+
+      Never shrinks the pool below what has already been allocated
+  */
+  static void SetMaxCapacity(size_t jobs);
+
+  // Number of jobs in each slab handed out to a thread
+  static constexpr size_t scSlabSize = 256;
+
+  // Number of jobs allocated each time the pool grows
+  static constexpr size_t scSegmentSize = 4096;
+
+  // Hard limit on the size of the pool, sized so the segment table is small
+  static constexpr size_t scMaxCapacityLimit = 1 << 24;
+
+  // Default number of jobs to allocate up front
+  static constexpr size_t scDefaultInitialCapacity = scSegmentSize;
+
+  // Default number of jobs the pool may grow to
+  static constexpr size_t scDefaultMaxCapacity = 1 << 20;
+
+private:
+  // Number of slabs in each segment
+  static constexpr size_t scSlabsPerSegment = scSegmentSize / scSlabSize;
+  // Number of entries in the segment table
+  static constexpr size_t scMaxSegments = scMaxCapacityLimit / scSegmentSize;
+
+  /*
+      Per thread allocation state
+  */
+  struct ThreadCache
+  {
+    // Jobs freed by the owning thread (owner only)
+    Job* freeList;
+    // Jobs freed by other threads, waiting to be taken back by the owner
+    std::atomic<Job*> remoteFreeList;
+    // Next never used job in the current slab (owner only)
+    Job* slabNext;
+    // End of the current slab (owner only)
+    Job* slabEnd;
+    // Number of jobs allocated by the owner
+    std::atomic_size_t allocations;
+    // Number of jobs freed by the owner, including jobs from other slabs
+    std::atomic_size_t frees;
+    // If the thread that owned this cache has exited
+    bool orphaned;
+    // Next cache in the list of all caches
+    ThreadCache* next;
+  };
+
+  /*
+      Owns the calling thread's cache, releasing it when the thread exits
+  */
+  struct ThreadCacheHolder
+  {
+    ThreadCache* cache = nullptr;
+    ~ThreadCacheHolder();
+  };
+
+  /*
+      Get the calling thread's cache, creating or adopting one if needed
+  */
+  static ThreadCache* GetThreadCache();
+
+  /*
+      Find a job when the cache's free list is empty
+  */
+  static Job* AllocateSlow(ThreadCache* cache);
+
+  /*
+      Take every job sitting in caches whose thread has exited, and every
+      job other threads have finished for caches that are still in use.
+      Jobs on a live thread's own free list can only be taken by it
+  */
+  static Job* ReclaimJobs();
+
+  /*
+      Claim the next unused slab for a thread, growing the pool if needed
+
+      Returns false if the pool is full
+  */
+  static bool ClaimSlab(ThreadCache* cache);
+
+  /*
+      Allocate segments until there are at least this many slabs.
+      Must be called with sGrowMutex_ held.
+  */
+  static void Grow(size_t slabs);
+
+  /*
+      Find the cache that owns the slab a job is in
+  */
+  static ThreadCache* GetOwner(const Job* job);
+
+  /*
+      A chunk of jobs along with who owns each of its slabs
+  */
+  struct Segment
+  {
+    Job* jobs;
+    ThreadCache* slabOwners[scSlabsPerSegment];
+  };
+
+  // Every segment allocated so far, in order
+  static std::atomic<Segment*> sSegments_[scMaxSegments];
+  // Number of slabs in allocated segments
+  static std::atomic_size_t sAllocatedSlabs_;
+  // Next slab that has not been claimed by a thread
+  static std::atomic_size_t sNextSlab_;
+  // Number of jobs the pool may grow to
+  static std::atomic_size_t sMaxCapacity_;
+  // Held while adding segments
+  static std::mutex sGrowMutex_;
+
+  // Every cache that has been created, guarded by sCacheMutex_
+  static ThreadCache* sCaches_;
+  static std::mutex sCacheMutex_;
+
+  static thread_local ThreadCacheHolder tCache_;
+};
+}
+#endif
@@ -6,7 +6,10 @@
     Jake McLeman
 ******************************************************************************/
 
+#include <algorithm>
 #include <assert.h>
+#include <limits>
+#include <system_error>
 #include <thread>
 
 #include "Job.h"
@@ -14,17 +17,70 @@
 
 namespace JobBot
 {
-Manager::Manager(size_t aNumWorkers)
+namespace
+{
+// Random numbers for threads that aren't workers
+thread_local XorShift tRandom;
+
+/*
+    Get the random number generator to use on this thread
+*/
+XorShift& GetRandom(Worker* worker)
+{
+  return (worker != nullptr) ? worker->GetRandom() : tRandom;
+}
+}
+
+Manager::Manager(size_t aNumWorkers, size_t aInitialJobCapacity,
+                 size_t aMaxJobCapacity,
+                 const Worker::IdlePolicy& aIdlePolicy)
     : workersWorking_(false),
       numWorkers_((aNumWorkers == 0) ? std::thread::hardware_concurrency()
-                                     : aNumWorkers)
+                                     : aNumWorkers),
+      idlePolicy_(aIdlePolicy), waitingClasses_(0), servedClasses_(0),
+      agingTime_(scDefaultAgingTime_), trackWaits_(false), sleepingWorkers_(0),
+      timerWatcher_(nullptr), sleepingWaiters_(0), blockedWorkers_(0),
+      compensatingWorkers_(0),
+      maxCompensatingWorkers_(scDefaultMaxCompensatingWorkers_),
+      compensationDelay_(scDefaultCompensationDelay_), watcherAsleep_(true),
+      spareCompensators_(0), recalledCompensators_(0),
+      stopCompensating_(false), sleepingCompensators_(0),
+      exitedIdleStats_(), exitedPriorityStats_(), exitedDeadlineStats_()
 {
+  for (std::atomic<std::uint32_t>& lastServed : lastServed_)
+  {
+    lastServed.store(0, std::memory_order_relaxed);
+  }
+
+  if (aMaxJobCapacity != 0)
+  {
+    JobPool::SetMaxCapacity(aMaxJobCapacity);
+  }
+  JobPool::Reserve(aInitialJobCapacity);
+
   workers_.reserve(numWorkers_);
 
   StartWorkers();
 }
 
-Manager::~Manager() { StopWorkers(); }
+Manager::~Manager()
+{
+  StopWorkers();
+
+  // Jobs still waiting on a timer are cancelled, the same as CancelTimer
+  // does, so whatever is waiting on them or their parents finds out. With
+  // the workers gone they are finished here rather than submitted
+  std::vector<Job*> held;
+  timers_.Clear(held);
+  for (Job* job : held)
+  {
+    job->Cancel();
+    if (!job->DeferUntilReady(this))
+    {
+      job->Run();
+    }
+  }
+}
 
 bool Manager::SubmitJob(Job* job)
 {
@@ -33,83 +89,902 @@ bool Manager::SubmitJob(Job* job)
     throw JobRejected(JobRejected::FailureType::NullJob, job);
   }
 
-  if (job->MatchesType(JobType::Important))
-    jobs[static_cast<size_t>(JobType::Important)].enqueue(job);
-  else if (job->MatchesType(JobType::IO))
-    jobs[static_cast<size_t>(JobType::IO)].enqueue(job);
-  else if (job->MatchesType(JobType::Huge))
-    jobs[static_cast<size_t>(JobType::Huge)].enqueue(job);
-  else if (job->MatchesType(JobType::Graphics))
-    jobs[static_cast<size_t>(JobType::Graphics)].enqueue(job);
-  else if (job->MatchesType(JobType::Tiny))
-    jobs[static_cast<size_t>(JobType::Tiny)].enqueue(job);
-  else
-    jobs[static_cast<size_t>(JobType::Misc)].enqueue(job);
+  // Jobs still waiting on other jobs are submitted by whichever of those
+  // finishes last
+  if (job->DeferUntilReady(this))
+  {
+    return true;
+  }
+
+  // Once the job is in a queue it may be finished and recycled at any time,
+  // so don't look at it after that
+  JobType type      = job->GetType();
+  unsigned priority = job->GetPriority();
+
+  job->submitTime_ = GetSubmitTime();
 
-  // Wake up any workers that went to sleep because there was no work to do
+  // Jobs with a deadline are taken soonest deadline first, rather than by
+  // who is closest, so they all go in one queue for their type
+  if (job->deadline_ != 0)
+  {
+    deadlineJobs_[static_cast<size_t>(type)].Push(job, job->deadline_);
+
+    // Pairs with WaitForWork, the same as the fence in MarkWaiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    WakeWorkers(type, 1);
+    return true;
+  }
+
+  // Jobs made by a worker go in its own queue where they are cheap to
+  // get back out, anything else goes in the shared queue for its type
+  Worker* worker = GetThisThreadsWorker();
+  if (worker == nullptr || !worker->PushLocalJob(job))
+  {
+    jobs[static_cast<size_t>(type)][priority].enqueue(job);
+  }
+
+  MarkWaiting(GetClassBit(type, priority));
+
+  // Wake up a worker that went to sleep because there was no work to do
   // since there is now
-  // Need to wake up all of them to avoid waking up a worker that can't do this
-  // job
-  JobNotifier.notify_all();
+  WakeWorkers(type, 1);
+
+  return true;
+}
+
+bool Manager::SubmitJobs(Job* const* aJobs, size_t count)
+{
+  constexpr size_t numTypes = static_cast<size_t>(JobType::NumJobTypes);
+
+  // Check everything up front so a bad batch is rejected as a whole
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (aJobs[i] == nullptr)
+    {
+      throw JobRejected(JobRejected::FailureType::NullJob, nullptr);
+    }
+  }
+
+  // Jobs waiting to go into each shared queue, added a chunk at a time
+  constexpr size_t chunkSize = 64;
+  Job* chunks[scNumJobClasses_][chunkSize];
+  size_t chunkCounts[scNumJobClasses_] = {};
+  // Tokens are only made for queues that actually get used
+  std::unique_ptr<moodycamel::ProducerToken> tokens[scNumJobClasses_];
+
+  size_t typeCounts[numTypes] = {};
+  std::uint32_t classes       = 0;
+  bool deadlines              = false;
+  Worker* worker              = GetThisThreadsWorker();
+
+  const std::uint32_t submitTime = GetSubmitTime();
+
+  // Once a job has been handed to a queue another worker may finish and
+  // recycle it, so each job is only looked at once
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (aJobs[i]->DeferUntilReady(this))
+    {
+      continue;
+    }
+
+    JobType type      = aJobs[i]->GetType();
+    unsigned priority = aJobs[i]->GetPriority();
+    ++typeCounts[static_cast<size_t>(type)];
+
+    aJobs[i]->submitTime_ = submitTime;
+
+    if (aJobs[i]->deadline_ != 0)
+    {
+      deadlineJobs_[static_cast<size_t>(type)].Push(aJobs[i],
+                                                    aJobs[i]->deadline_);
+      deadlines = true;
+      continue;
+    }
+
+    classes |= GetClassBit(type, priority);
+
+    // Jobs made by a worker go in its own queue until it fills up
+    if (worker != nullptr && worker->PushLocalJob(aJobs[i]))
+    {
+      continue;
+    }
+
+    size_t index = GetClassIndex(type, priority);
+    chunks[index][chunkCounts[index]++] = aJobs[i];
+    if (chunkCounts[index] == chunkSize)
+    {
+      FlushJobChunk(jobs[static_cast<size_t>(type)][priority], tokens[index],
+                    chunks[index], chunkSize);
+      chunkCounts[index] = 0;
+    }
+  }
+
+  for (size_t index = 0; index < scNumJobClasses_; ++index)
+  {
+    if (chunkCounts[index] != 0)
+    {
+      FlushJobChunk(jobs[index % numTypes][index / numTypes], tokens[index],
+                    chunks[index], chunkCounts[index]);
+    }
+  }
+
+  if (classes != 0)
+  {
+    MarkWaiting(classes);
+  }
+  else if (deadlines)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  for (size_t type = 0; type < numTypes; ++type)
+  {
+    if (typeCounts[type] != 0)
+    {
+      WakeWorkers(JobType(type), typeCounts[type]);
+    }
+  }
+
+  return true;
+}
+
+TimerWheel::TimerID Manager::SubmitJobAfter(Job* job,
+                                            std::chrono::microseconds delay)
+{
+  if (job == nullptr)
+  {
+    throw JobRejected(JobRejected::FailureType::NullJob, job);
+  }
+
+  bool earliest          = false;
+  TimerWheel::TimerID id = timers_.Add(job, delay, earliest);
+  if (earliest)
+  {
+    WakeForTimers();
+  }
+  return id;
+}
+
+TimerWheel::TimerID Manager::SubmitJobEvery(std::chrono::microseconds period,
+                                            std::function<Job*()> makeJob)
+{
+  bool earliest          = false;
+  TimerWheel::TimerID id = timers_.AddPeriodic(std::move(makeJob), period,
+                                               earliest);
+  if (earliest)
+  {
+    WakeForTimers();
+  }
+  return id;
+}
+
+bool Manager::CancelTimer(TimerWheel::TimerID id)
+{
+  Job* job = nullptr;
+  if (!timers_.Cancel(id, job)) return false;
+
+  if (job != nullptr)
+  {
+    job->Cancel();
+    SubmitJob(job);
+  }
+  return true;
+}
 
+bool Manager::PollTimers()
+{
+  if (!timers_.IsDue()) return false;
+
+  std::vector<Job*> due;
+  timers_.Expire(due);
+  if (due.empty()) return false;
+
+  SubmitJobs(due.data(), due.size());
   return true;
 }
 
-Worker* Manager::GetWorkerByThreadID(std::thread::id id)
+void Manager::WakeForTimers()
+{
+  // Pairs with WaitForWork. Either the watcher sees the new timer when it
+  // works out how long to sleep, or it is seen here and woken to look again
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  Worker* watcher = timerWatcher_.load();
+  if (watcher != nullptr)
+  {
+    WakeWorker(*watcher);
+    return;
+  }
+
+  // Nobody is watching, so wake someone to start
+  if (sleepingWorkers_.load(std::memory_order_relaxed) == 0) return;
+  for (Worker* worker : workers_)
+  {
+    if (WakeWorker(*worker)) return;
+  }
+}
+
+void Manager::FlushJobChunk(moodycamel::ConcurrentQueue<Job*>& queue,
+                            std::unique_ptr<moodycamel::ProducerToken>& token,
+                            Job* const* chunk, size_t count)
+{
+  if (!token)
+  {
+    token.reset(new moodycamel::ProducerToken(queue));
+  }
+
+  // Making a token can fail if memory is tight, in which case the queue's
+  // tokenless path still works
+  if (token->valid())
+  {
+    queue.enqueue_bulk(*token, chunk, count);
+  }
+  else
+  {
+    queue.enqueue_bulk(chunk, count);
+  }
+}
+
+Job* Manager::WaitForWork(Worker& worker, std::chrono::microseconds timeout)
+{
+  std::uint32_t epoch = worker.parker_.PrepareToPark();
+
+  worker.sleeping_.store(true);
+  ++sleepingWorkers_;
+
+  // Only workers waiting on something else sleep with a timeout
+  const bool waiting = timeout != std::chrono::microseconds::zero();
+  if (waiting)
+  {
+    worker.sleepingWhileWaiting_.store(true);
+    ++sleepingWaiters_;
+  }
+
+  const bool compensating = worker.workerMode_ == Worker::Mode::Compensating;
+  if (compensating)
+  {
+    ++sleepingCompensators_;
+  }
+
+  // The first worker to go to sleep keeps an eye on the timers for
+  // everyone else. Workers that never sleep can't, and compensating ones
+  // may retire at any time
+  Worker* noWatcher   = nullptr;
+  const bool watching =
+      worker.keepWorking_ && !compensating &&
+      timerWatcher_.compare_exchange_strong(noWatcher, &worker);
+
+  // Anyone submitting work from here on sees this worker as asleep, so
+  // looking once more can't miss a job
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  Job* job = nullptr;
+  if (worker.keepWorking_)
+  {
+    PollTimers();
+    job = RequestJob(worker);
+  }
+
+  // Whatever finished the job this worker waits on has already looked for
+  // sleeping waiters, and may not have seen this one. The same goes for a
+  // worker that stopped blocking while a compensating one has no work, so
+  // one that isn't needed any more goes to retire instead
+  if (worker.keepWorking_ && job == nullptr &&
+      !(waiting && worker.IsDoneWaiting()) &&
+      !(compensating &&
+        compensatingWorkers_.load() > blockedWorkers_.load()))
+  {
+    if (watching)
+    {
+      const std::chrono::microseconds untilDue = timers_.GetTimeUntilDue();
+      if (untilDue != std::chrono::microseconds::max() &&
+          (timeout == std::chrono::microseconds::zero() || untilDue < timeout))
+      {
+        // Zero would mean sleeping until woken
+        timeout = std::max(untilDue, std::chrono::microseconds(1));
+      }
+    }
+
+    if (timeout == std::chrono::microseconds::zero())
+    {
+      worker.parker_.Park(epoch);
+    }
+    else
+    {
+      worker.parker_.ParkFor(epoch, timeout);
+    }
+  }
+
+  // If nobody woke this worker (it found a job, timed out or was stopped)
+  // take it back off the sleeping count
+  const bool woken = !worker.sleeping_.exchange(false);
+  if (!woken)
+  {
+    --sleepingWorkers_;
+  }
+
+  if (waiting)
+  {
+    worker.sleepingWhileWaiting_.store(false);
+    --sleepingWaiters_;
+  }
+
+  if (compensating)
+  {
+    --sleepingCompensators_;
+  }
+
+  if (watching)
+  {
+    timerWatcher_.store(nullptr);
+
+    // Off to do something other than the timers, so hand them over to
+    // another sleeping worker
+    if ((woken || job != nullptr) && worker.keepWorking_ &&
+        timers_.GetTimerCount() != 0)
+    {
+      WakeForTimers();
+    }
+  }
+
+  return job;
+}
+
+bool Manager::WakeWorker(Worker& worker)
+{
+  // Only one waker gets to flip the flag, so the count stays right
+  if (worker.sleeping_.load() && worker.sleeping_.exchange(false))
+  {
+    --sleepingWorkers_;
+    worker.parker_.Unpark();
+    return true;
+  }
+
+  return false;
+}
+
+void Manager::WakeWorkers(JobType type, size_t jobCount)
+{
+  // MarkWaiting has already fenced, so either a worker going to sleep sees
+  // the new jobs or this sees that it is asleep
+  if (sleepingWorkers_.load(std::memory_order_relaxed) == 0) return;
+
+  for (Worker* worker : workers_)
+  {
+    if (jobCount == 0) return;
+
+    if (worker->GetSpecialization().Accepts(type) && WakeWorker(*worker))
+    {
+      --jobCount;
+    }
+  }
+
+  // Compensating workers take anything
+  if (jobCount != 0)
+  {
+    WakeCompensators(jobCount);
+  }
+}
+
+void Manager::WakeWaiters()
+{
+  // Waiters count themselves before their last look at what they wait on,
+  // and the job that finished did so with a locked operation, so either
+  // the waiter sees it finished or it is seen here
+  if (sleepingWaiters_.load() == 0) return;
+
+  for (Worker* worker : workers_)
+  {
+    if (worker->sleepingWhileWaiting_.load())
+    {
+      WakeWorker(*worker);
+    }
+  }
+
+  WakeCompensators(sleepingWaiters_.load(), true);
+}
+
+void Manager::WakeAllWorkers()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  for (Worker* worker : workers_)
+  {
+    WakeWorker(*worker);
+  }
+
+  WakeCompensators(std::numeric_limits<size_t>::max());
+}
+
+void Manager::WakeCompensators(size_t count, bool waitersOnly)
+{
+  if (sleepingCompensators_.load() == 0) return;
+
+  std::lock_guard<std::mutex> lock(compensatingMutex_);
+  for (Worker* worker : compensators_)
+  {
+    if (count == 0) return;
+
+    if ((!waitersOnly || worker->sleepingWhileWaiting_.load()) &&
+        WakeWorker(*worker))
+    {
+      --count;
+    }
+  }
+}
+
+Worker* Manager::GetWorkerByThreadID(std::thread::id id)
+{
+  // Only used to look up other threads' workers, GetThisThreadsWorker
+  // doesn't need to search
+  for (Worker* worker : workers_)
+  {
+    if (worker->GetThreadID() == id)
+    {
+      return worker;
+    }
+  }
+
+  return nullptr;
+}
+
+Worker* Manager::GetThisThreadsWorker()
+{
+  return Worker::GetThisThreadsWorker(this);
+}
+
+Worker* Manager::GetRandomWorker()
+{
+  if (workers_.empty()) return nullptr;
+
+  XorShift& random = GetRandom(GetThisThreadsWorker());
+  return workers_[random.NextBelow(
+      static_cast<std::uint32_t>(workers_.size()))];
+}
+
+Worker* Manager::GetBusiestWorker()
+{
+  if (workers_.empty()) return nullptr;
+
+  Worker* busiest     = workers_[0];
+  size_t busiestCount = busiest->GetLocalJobCount();
+
+  for (size_t i = 1; i < workers_.size(); ++i)
+  {
+    size_t count = workers_[i]->GetLocalJobCount();
+    if (count > busiestCount)
+    {
+      busiest      = workers_[i];
+      busiestCount = count;
+    }
+  }
+
+  return busiest;
+}
+
+Manager* Manager::GetInstance()
+{
+  static Manager man;
+  return &man;
+}
+
+void Manager::RunJob(Job* job) { GetInstance()->SubmitJob(job); }
+
+void Manager::WaitForJob(Job* job)
+{
+  GetInstance()->GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+}
+
+void Manager::WaitForJob(const JobHandle& handle)
+{
+  GetInstance()->GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+}
+
+Job* Manager::RequestJob(Worker& worker)
+{
+  const bool earliestDeadlineFirst =
+      worker.GetSpecialization().earliestDeadlineFirst;
+
+  Job* job  = nullptr;
+  bool aged = false;
+
+  // A sleeping worker wakes up in time for the next timer, but while every
+  // worker is busy the ones asking for work have to look. That only costs
+  // reading the clock while there are timers
+  if (timerWatcher_.load(std::memory_order_relaxed) == nullptr)
+  {
+    PollTimers();
+  }
+
+  // Frame critical work beats everything for the workers that are there
+  // for it
+  if (earliestDeadlineFirst)
+  {
+    job = TakeDeadlineJob(worker, false);
+  }
+
+  // Every so often give work that is about to be late, or has been passed
+  // over for too long, a turn, and keep at it until none of that work is
+  // left
+  if (job == nullptr && --worker.requestsUntilAging_ == 0)
+  {
+    job = TakeDeadlineJob(worker, true);
+    if (job == nullptr)
+    {
+      job  = FindAgedJob(worker);
+      aged = (job != nullptr);
+    }
+
+    worker.requestsUntilAging_ =
+        (job != nullptr) ? 1 : scAgingCheckInterval_;
+  }
+
+  // Otherwise take the most urgent job there is. Most levels are empty
+  // most of the time, so skip those without looking in every queue
+  const std::uint32_t waiting =
+      waitingClasses_.load(std::memory_order_relaxed) &
+      worker.acceptedClasses_;
+  for (unsigned priority = 0;
+       job == nullptr && priority < Job::NUM_PRIORITIES; ++priority)
+  {
+    if (waiting & (GetLevelBits() << (priority * scNumJobTypes_)))
+    {
+      job = FindJob(worker, priority, waiting);
+    }
+  }
+
+  // Nothing else to do, so get ahead on work with a deadline
+  if (job == nullptr && !earliestDeadlineFirst)
+  {
+    job = TakeDeadlineJob(worker, false);
+  }
+
+  if (job != nullptr && (aged || job->submitTime_ != 0))
+  {
+    const bool timed = (job->submitTime_ != 0);
+
+    // Ticks aren't exact, so a job taken right away can look like it was
+    // taken before it was submitted
+    std::int32_t wait =
+        timed ? static_cast<std::int32_t>(GetTicks() - job->submitTime_) : 0;
+    worker.CountJob(job->GetPriority(),
+                    static_cast<std::uint32_t>(std::max(wait, 0)), timed,
+                    aged);
+  }
+
+  return job;
+}
+
+Job* Manager::FindJob(Worker& worker, unsigned priority,
+                      std::uint32_t waiting)
+{
+  const Worker::Specialization& specialization = worker.GetSpecialization();
+  constexpr size_t numPriorities = scNumJobTypes_ - 1;
+
+  Job* job     = nullptr;
+  JobType type = JobType::Null;
+
+  // Important jobs come first no matter where they are
+  if (waiting & GetClassBit(JobType::Important, priority))
+  {
+    type = JobType::Important;
+    job  = TakeJob(worker, type, priority);
+  }
+
+  // Then anything this worker made itself
+  for (size_t i = 0; job == nullptr && i < numPriorities; ++i)
+  {
+    type = specialization.priorities[i];
+    if (type != JobType::Null && (waiting & GetClassBit(type, priority)))
+    {
+      job = worker.PopLocalJob(type, priority);
+    }
+  }
+
+  // Then anything submitted from outside the workers
+  for (size_t i = 0; job == nullptr && i < numPriorities; ++i)
+  {
+    type = specialization.priorities[i];
+    if (type != JobType::Null && (waiting & GetClassBit(type, priority)))
+    {
+      TryGetJob(type, priority, worker, job);
+    }
+  }
+
+  // Finally go take work from other workers
+  for (size_t i = 0; job == nullptr && i < numPriorities; ++i)
+  {
+    type = specialization.priorities[i];
+    if (type != JobType::Null && (waiting & GetClassBit(type, priority)))
+    {
+      job = StealJob(type, &worker, priority);
+    }
+  }
+
+  if (job != nullptr)
+  {
+    MarkServed(type, priority);
+    return job;
+  }
+
+  // Nothing this worker takes is waiting at this level after all
+  for (size_t cleared = 0; cleared < scNumJobTypes_; ++cleared)
+  {
+    if (waiting & GetClassBit(JobType(cleared), priority))
+    {
+      ClearWaiting(JobType(cleared), priority);
+    }
+  }
+
+  return nullptr;
+}
+
+Job* Manager::FindAgedJob(Worker& worker)
+{
+  const std::uint32_t agingTime = agingTime_.load(std::memory_order_relaxed);
+  if (agingTime == 0) return nullptr;
+
+  const Worker::Specialization& specialization = worker.GetSpecialization();
+  constexpr size_t numPriorities = scNumJobTypes_ - 1;
+
+  const std::uint32_t now = GetTicks();
+
+  // Anything served since someone last checked isn't being passed over
+  std::uint32_t served = 0;
+  if (servedClasses_.load(std::memory_order_relaxed) != 0)
+  {
+    served = servedClasses_.exchange(0, std::memory_order_relaxed);
+    for (size_t index = 0; index < scNumJobClasses_; ++index)
+    {
+      if (served & (1u << index))
+      {
+        lastServed_[index].store(now, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  const std::uint32_t waiting =
+      waitingClasses_.load(std::memory_order_relaxed) & ~served;
+
+  for (unsigned priority = 0; priority < Job::NUM_PRIORITIES; ++priority)
+  {
+    // Less urgent jobs are allowed to wait longer
+    const std::int32_t limit =
+        static_cast<std::int32_t>(agingTime * (priority + 1));
+
+    for (size_t i = 0; i <= numPriorities; ++i)
+    {
+      JobType type = (i == 0) ? JobType::Important
+                              : specialization.priorities[i - 1];
+      if (type == JobType::Null || !(waiting & GetClassBit(type, priority)))
+      {
+        continue;
+      }
+
+      std::atomic<std::uint32_t>& lastServed =
+          lastServed_[GetClassIndex(type, priority)];
+      if (static_cast<std::int32_t>(
+              now - lastServed.load(std::memory_order_relaxed)) <= limit)
+      {
+        continue;
+      }
+
+      // Taking one job doesn't mean the rest aren't still being passed
+      // over, so the class stays aged until it is served as usual or runs
+      // out of jobs
+      Job* job = TakeJob(worker, type, priority);
+      if (job != nullptr)
+      {
+        return job;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+Job* Manager::TakeDeadlineJob(Worker& worker, bool dueSoon)
+{
+  const Worker::Specialization& specialization = worker.GetSpecialization();
+  constexpr size_t numPriorities = scNumJobTypes_ - 1;
+
+  // Find the soonest deadline of any type without taking any locks
+  DeadlineQueue* soonest = nullptr;
+  std::uint32_t deadline = 0;
+  for (size_t i = 0; i <= numPriorities; ++i)
+  {
+    JobType type = (i == 0) ? JobType::Important
+                            : specialization.priorities[i - 1];
+    if (type == JobType::Null) continue;
+
+    DeadlineQueue& queue = deadlineJobs_[static_cast<size_t>(type)];
+    std::uint32_t earliest;
+    if (queue.Peek(earliest) &&
+        (soonest == nullptr ||
+         static_cast<std::int32_t>(earliest - deadline) < 0))
+    {
+      soonest  = &queue;
+      deadline = earliest;
+    }
+  }
+
+  if (soonest == nullptr) return nullptr;
+
+  if (dueSoon)
+  {
+    const std::int32_t window = static_cast<std::int32_t>(
+        agingTime_.load(std::memory_order_relaxed));
+    if (static_cast<std::int32_t>(deadline - GetTicks()) > window)
+    {
+      return nullptr;
+    }
+  }
+
+  // Someone may have beaten this worker to it, in which case the next
+  // soonest is just as good
+  return soonest->Pop();
+}
+
+Job* Manager::TakeJob(Worker& worker, JobType type, unsigned priority)
+{
+  Job* job = worker.PopLocalJob(type, priority);
+  if (job == nullptr && !TryGetJob(type, priority, worker, job))
+  {
+    job = StealJob(type, &worker, priority);
+  }
+  return job;
+}
+
+void Manager::MarkWaiting(std::uint32_t classes)
+{
+  // Pairs with ClearWaiting and WaitForWork. Either they see the new jobs,
+  // or this sees that the flags were cleared or the worker is asleep
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  std::uint32_t unmarked =
+      classes & ~waitingClasses_.load(std::memory_order_relaxed);
+  if (unmarked == 0) return;
+
+  // Nothing of these sorts was waiting, so aging starts counting now
+  const std::uint32_t now = GetTicks();
+  for (size_t index = 0; index < scNumJobClasses_; ++index)
+  {
+    if (unmarked & (1u << index))
+    {
+      lastServed_[index].store(now, std::memory_order_relaxed);
+    }
+  }
+
+  waitingClasses_.fetch_or(unmarked, std::memory_order_relaxed);
+}
+
+void Manager::ClearWaiting(JobType type, unsigned priority)
+{
+  const std::uint32_t bit = GetClassBit(type, priority);
+  waitingClasses_.fetch_and(~bit, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Anything submitted from here on marks itself again, but a worker can
+  // miss a job by losing a race for it, so check nothing was left behind
+  bool stillWaiting =
+      jobs[static_cast<size_t>(type)][priority].size_approx() != 0;
+  for (size_t i = 0; !stillWaiting && i < workers_.size(); ++i)
+  {
+    stillWaiting = (workers_[i]->GetLocalJobCount(type, priority) != 0);
+  }
+
+  if (stillWaiting)
+  {
+    waitingClasses_.fetch_or(bit, std::memory_order_relaxed);
+  }
+}
+
+void Manager::MarkServed(JobType type, unsigned priority)
 {
-  /*
-      TODO consider optimizing this linear search
-
-      Potentially workers could be in a different data
-      structure to speed this up?
-  */
-  for (Worker* worker : workers_)
+  // Read first so the shared flags are only written once between aging
+  // checks, rather than for every job
+  const std::uint32_t bit = GetClassBit(type, priority);
+  if (!(servedClasses_.load(std::memory_order_relaxed) & bit))
   {
-    if (worker->GetThreadID() == id)
-    {
-      return worker;
-    }
+    servedClasses_.fetch_or(bit, std::memory_order_relaxed);
   }
+}
 
-  return nullptr;
+std::uint32_t Manager::GetTicks()
+{
+  return static_cast<std::uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
 }
 
-Worker* Manager::GetThisThreadsWorker()
+std::uint32_t Manager::GetSubmitTime() const
 {
-  return GetWorkerByThreadID(std::this_thread::get_id());
+  if (!trackWaits_.load(std::memory_order_relaxed)) return 0;
+
+  // 0 means the job isn't timed, so skip over it on the rare occasion the
+  // ticks wrap around to it
+  std::uint32_t ticks = GetTicks();
+  return (ticks != 0) ? ticks : 1;
 }
 
-Worker* Manager::GetRandomWorker()
+size_t Manager::GetClassIndex(JobType type, unsigned priority)
 {
-  return workers_[std::rand() % workers_.size()];
+  return priority * scNumJobTypes_ + static_cast<size_t>(type);
 }
 
-Manager* Manager::GetInstance()
+std::uint32_t Manager::GetClassBit(JobType type, unsigned priority)
 {
-  static Manager man;
-  return &man;
+  static_assert(scNumJobClasses_ <= 32,
+                "Too many types and priorities of job for waitingClasses_");
+
+  return 1u << GetClassIndex(type, priority);
 }
 
-void Manager::RunJob(Job* job) { GetInstance()->SubmitJob(job); }
+std::uint32_t Manager::GetLevelBits() { return (1u << scNumJobTypes_) - 1; }
 
-void Manager::WaitForJob(Job* job)
+std::uint32_t
+Manager::GetAcceptedClasses(const Worker::Specialization& specialization)
 {
-  GetInstance()->GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+  std::uint32_t types = 1u << static_cast<size_t>(JobType::Important);
+  for (JobType type : specialization.priorities)
+  {
+    if (type != JobType::Null)
+    {
+      types |= 1u << static_cast<size_t>(type);
+    }
+  }
+
+  std::uint32_t classes = 0;
+  for (unsigned priority = 0; priority < Job::NUM_PRIORITIES; ++priority)
+  {
+    classes |= types << (priority * scNumJobTypes_);
+  }
+  return classes;
 }
 
-Job* Manager::RequestJob(const Worker::Specialization& workerSpecialization)
+Job* Manager::StealJob(JobType type, Worker* thief, unsigned priority)
 {
-  Job* job;
+  const std::uint32_t numWorkers = static_cast<std::uint32_t>(workers_.size());
+  if (numWorkers == 0) return nullptr;
+
+  XorShift& random = GetRandom(thief);
 
-  if (TryGetJob(JobType::Important, job))
+  // Look at two random workers and try the one with more waiting jobs of
+  // this sort. That sends thieves to overloaded workers without having to
+  // look at every worker's queues
+  Worker* first  = workers_[random.NextBelow(numWorkers)];
+  Worker* second = workers_[random.NextBelow(numWorkers)];
+  if (first == thief) first = second;
+  if (second == thief) second = first;
+
+  if (first != thief)
   {
-    return job;
+    Worker* victim =
+        (second->GetLocalJobCount(type, priority) >
+         first->GetLocalJobCount(type, priority))
+            ? second
+            : first;
+
+    Job* job = victim->StealLocalJob(type, priority);
+    if (job != nullptr)
+    {
+      return job;
+    }
   }
 
-  for (unsigned i = 0; i < static_cast<size_t>(JobType::NumJobTypes) - 1; ++i)
+  // Otherwise check everyone so a job is never missed, starting at a
+  // random victim so thieves spread out instead of all hitting the first
+  // worker
+  const std::uint32_t start = random.NextBelow(numWorkers);
+  for (std::uint32_t i = 0; i < numWorkers; ++i)
   {
-    JobType toTry = workerSpecialization.priorities[i];
-    if (toTry != JobType::Null && TryGetJob(toTry, job))
+    Worker* victim = workers_[(start + i) % numWorkers];
+    if (victim == thief) continue;
+
+    Job* job = victim->StealLocalJob(type, priority);
+    if (job != nullptr)
     {
       return job;
     }
@@ -118,9 +993,49 @@ Job* Manager::RequestJob(const Worker::Specialization& workerSpecialization)
   return nullptr;
 }
 
-bool Manager::TryGetJob(JobType type, Job*& job)
+bool Manager::TryGetJob(JobType type, unsigned priority, Worker& worker,
+                        Job*& job)
 {
-  return jobs[static_cast<size_t>(type)].try_dequeue(job);
+  moodycamel::ConcurrentQueue<Job*>& queue =
+      jobs[static_cast<size_t>(type)][priority];
+
+  // Take a fair share of what is waiting, leaving the rest for other workers
+  size_t waiting = queue.size_approx();
+  if (waiting == 0) return false;
+
+  size_t batchSize = waiting / workers_.size();
+  if (batchSize < 1 || worker.GetMode() == Worker::Mode::Compensating)
+  {
+    // Compensating workers would only have to put the rest back
+    batchSize = 1;
+  }
+  if (batchSize > scMaxJobBatch_) batchSize = scMaxJobBatch_;
+
+  Job* batch[scMaxJobBatch_];
+  size_t count = queue.try_dequeue_bulk(batch, batchSize);
+  if (count == 0) return false;
+
+  job = batch[0];
+
+  // Keep the rest locally, pushed in reverse so they come back out in the
+  // order they were submitted
+  for (size_t i = count - 1; i > 0; --i)
+  {
+    if (!worker.PushLocalJob(batch[i]))
+    {
+      queue.enqueue(batch[i]);
+    }
+  }
+
+  // While the batch was out of every queue another worker may have found
+  // nothing of this sort and cleared its flag, which would leave the rest
+  // of the batch where nobody looks
+  if (count > 1)
+  {
+    MarkWaiting(GetClassBit(type, priority));
+  }
+
+  return true;
 }
 
 void Manager::StartNewWorker(Worker::Mode mode)
@@ -135,7 +1050,7 @@ void Manager::StartNewWorker(Worker::Mode mode)
       sizeof(primarySpecs) / sizeof(primarySpecs[0]);
   // Counter to use to circularly move through above array when chosing
   // specializations for new primary workers
-  static unsigned primaryCounter = 0;
+  static std::atomic_uint primaryCounter(0);
 
   const Worker::Specialization* specialization;
   if (mode == Worker::Mode::Volunteer)
@@ -158,21 +1073,39 @@ void Manager::StartNewWorker(Worker::Mode mode)
   }
 
   workerMutex_.lock();
-  workers_.push_back(new Worker(this, mode, *specialization));
+  workers_.push_back(new Worker(this, mode, *specialization, idlePolicy_,
+                                fiberStacks_.get()));
 
-  Worker* worker = workers_.back();
+  Worker* worker           = workers_.back();
+  worker->acceptedClasses_ = GetAcceptedClasses(*specialization);
   workerMutex_.unlock();
 
   if (worker->GetMode() == Worker::Mode::Primary)
   {
+    // Workers steal from each other, so nobody starts until every worker
+    // is in the vector and it has stopped changing
+    while (!workersWorking_)
+    {
+      std::this_thread::yield();
+    }
+
     worker->Start();
   }
 }
 
+size_t Manager::GetStartedWorkerCount()
+{
+  std::lock_guard<std::mutex> lock(workerMutex_);
+  return workers_.size();
+}
+
 void Manager::StopWorkers()
 {
   if (!workersWorking_) return;
 
+  // Compensating workers steal from the others, so they go first
+  StopCompensatingWorkers();
+
   // Ask all workers to stop working
   for (Worker* worker : workers_)
   {
@@ -181,7 +1114,7 @@ void Manager::StopWorkers()
 
   // Let every sleeping worker know that now would be a great
   // time to wake up so they can see that I asked them to shut down
-  JobNotifier.notify_all();
+  WakeAllWorkers();
 
   // Wait for all workers to stop working
   for (Worker* worker : workers_)
@@ -189,12 +1122,20 @@ void Manager::StopWorkers()
     worker->Stop();
   }
 
+  // Jobs left in a worker's own queues would go with it, so hand them to
+  // the shared queues for whichever workers run next
+  for (Worker* worker : workers_)
+  {
+    RequeueLocalJobs(*worker);
+  }
+
   // Free all workers seperately so that no one trys
   // to steal from a deleted worker
   for (Worker* worker : workers_)
   {
     delete worker;
   }
+  workers_.clear();
 
   // Join all threads
   while (!threads_.empty())
@@ -206,10 +1147,48 @@ void Manager::StopWorkers()
   workersWorking_ = false;
 }
 
+void Manager::RequeueLocalJobs(Worker& worker)
+{
+  std::uint32_t classes = 0;
+
+  for (size_t type = 0; type < scNumJobTypes_; ++type)
+  {
+    for (unsigned priority = 0; priority < Job::NUM_PRIORITIES; ++priority)
+    {
+      // The worker has stopped, so nobody else is taking from its queues
+      Job* job = worker.StealLocalJob(JobType(type), priority);
+      while (job != nullptr)
+      {
+        jobs[type][priority].enqueue(job);
+        classes |= GetClassBit(JobType(type), priority);
+        job = worker.StealLocalJob(JobType(type), priority);
+      }
+    }
+  }
+
+  if (classes != 0)
+  {
+    MarkWaiting(classes);
+  }
+}
+
 void Manager::StartWorkers()
 {
   if (workersWorking_) return;
 
+  blockedWorkers_      = 0;
+  compensatingWorkers_ = 0;
+  stopCompensating_    = false;
+
+  // New workers start their stats from nothing, so compensating ones that
+  // went with the old workers don't count any more either
+  {
+    std::lock_guard<std::mutex> lock(compensatingMutex_);
+    exitedIdleStats_     = Worker::IdleStats();
+    exitedPriorityStats_ = Worker::PriorityStats();
+    exitedDeadlineStats_ = Worker::DeadlineStats();
+  }
+
   // Start the main thread worker in volunteer mode
   StartNewWorker(Worker::Mode::Volunteer);
 
@@ -220,10 +1199,416 @@ void Manager::StartWorkers()
     threads_.emplace_back([&]() { StartNewWorker(Worker::Mode::Primary); });
   }
 
+  // Wait for every thread to add its worker before letting any of them go
+  while (GetStartedWorkerCount() < numWorkers_)
+  {
+    std::this_thread::yield();
+  }
+
   workersWorking_ = true;
+
+  // Don't hand control back until every primary worker is actually running,
+  // otherwise stopping right away could miss a worker that hasn't started
+  for (Worker* worker : workers_)
+  {
+    while (worker->GetMode() == Worker::Mode::Primary && !worker->IsWorking())
+    {
+      std::this_thread::yield();
+    }
+  }
+}
+
+const Worker::IdlePolicy& Manager::GetIdlePolicy() const
+{
+  return idlePolicy_;
+}
+
+void Manager::SetIdlePolicy(const Worker::IdlePolicy& aIdlePolicy)
+{
+  // Workers copy the policy when they are made, so make new ones
+  const bool wasWorking = workersWorking_;
+  StopWorkers();
+
+  idlePolicy_ = aIdlePolicy;
+
+  if (wasWorking)
+  {
+    StartWorkers();
+  }
+}
+
+bool Manager::SetFiberMode(bool useFibers, size_t stackSize)
+{
+  if (useFibers && !Fiber::scSupported) return false;
+
+  // Workers are given their stacks when they are made, so make new ones
+  const bool wasWorking = workersWorking_;
+  StopWorkers();
+
+  fiberStacks_.reset(useFibers ? new FiberStackPool(stackSize) : nullptr);
+
+  if (wasWorking)
+  {
+    StartWorkers();
+  }
+
+  return true;
+}
+
+bool Manager::GetFiberMode() const { return fiberStacks_ != nullptr; }
+
+void Manager::BeginBlocking()
+{
+  if (GetThisThreadsWorker() == nullptr) return;
+
+  ++blockedWorkers_;
+
+  // The watcher brings in a compensating worker if this block lasts, and
+  // only has to be told about it if it isn't keeping an eye out already
+  if (maxCompensatingWorkers_.load() == 0 || !watcherAsleep_.load()) return;
+
+  std::lock_guard<std::mutex> lock(compensatingMutex_);
+  if (stopCompensating_) return;
+
+  if (!blockingWatcher_.joinable())
+  {
+    try
+    {
+      blockingWatcher_ = std::thread(&Manager::WatchBlockedWorkers, this);
+    }
+    catch (const std::system_error&)
+    {
+      // Out of threads, so blocked workers leave their cores idle, at
+      // least until the next one blocks
+      return;
+    }
+  }
+
+  blockingStarted_.notify_one();
+}
+
+void Manager::EndBlocking()
+{
+  if (GetThisThreadsWorker() == nullptr) return;
+
+  // Compensating workers see this once they finish what they are doing,
+  // and one that has nothing to do is woken to see it
+  --blockedWorkers_;
+  WakeCompensators(1);
+}
+
+void Manager::SetMaxCompensatingWorkers(size_t count)
+{
+  maxCompensatingWorkers_ = count;
+}
+
+size_t Manager::GetMaxCompensatingWorkers() const
+{
+  return maxCompensatingWorkers_;
+}
+
+void Manager::SetCompensationDelay(std::chrono::microseconds delay)
+{
+  const std::chrono::microseconds longest(1 << 24);
+  if (delay > longest) delay = longest;
+  if (delay.count() < 0) delay = std::chrono::microseconds::zero();
+
+  compensationDelay_.store(static_cast<std::uint32_t>(delay.count()),
+                           std::memory_order_relaxed);
+}
+
+std::chrono::microseconds Manager::GetCompensationDelay() const
+{
+  return std::chrono::microseconds(
+      compensationDelay_.load(std::memory_order_relaxed));
+}
+
+size_t Manager::GetCompensatingWorkerCount() const
+{
+  return compensatingWorkers_;
+}
+
+void Manager::StartCompensatingWorker()
+{
+  if (stopCompensating_) return;
+
+  if (spareCompensators_ > recalledCompensators_)
+  {
+    ++recalledCompensators_;
+    compensatorRecalled_.notify_one();
+    return;
+  }
+
+  try
+  {
+    compensatingThreads_.emplace_back(&Manager::RunCompensatingWorker, this);
+  }
+  catch (const std::system_error&)
+  {
+    // Out of threads, so the blocked worker's core goes idle after all
+    --compensatingWorkers_;
+  }
+}
+
+void Manager::WatchBlockedWorkers()
+{
+  std::unique_lock<std::mutex> lock(compensatingMutex_);
+  watcherAsleep_ = false;
+
+  // Blocked workers that could have another fill in for them
+  auto fillable = [this]() {
+    return std::min(blockedWorkers_.load(), maxCompensatingWorkers_.load());
+  };
+
+  bool idle = false;
+  while (!stopCompensating_)
+  {
+    const size_t blocked = fillable();
+    if (blocked <= compensatingWorkers_.load())
+    {
+      if (idle)
+      {
+        // Nothing has needed filling in for a while, so sleep until a
+        // worker blocks
+        watcherAsleep_ = true;
+        blockingStarted_.wait(lock, [this, &fillable]() {
+          return stopCompensating_ ||
+                 fillable() > compensatingWorkers_.load();
+        });
+        watcherAsleep_ = false;
+        idle           = false;
+      }
+      else
+      {
+        // Keep looking for a while first, so workers that block often
+        // don't have to wake the watcher each time
+        blockingStarted_.wait_for(lock, GetCompensationDelay(), [this]() {
+          return stopCompensating_.load();
+        });
+        idle = true;
+      }
+      continue;
+    }
+    idle = false;
+
+    // Give the blocked workers the chance to carry on by themselves
+    blockingStarted_.wait_for(lock, GetCompensationDelay(), [this]() {
+      return stopCompensating_.load();
+    });
+    if (stopCompensating_) break;
+
+    // Only fill in for as many workers as were blocked all along. This is
+    // rough, as some blocks may have ended and others begun in the meantime
+    const size_t most = std::min(blocked, fillable());
+
+    size_t compensating = compensatingWorkers_.load();
+    while (compensating < most)
+    {
+      if (compensatingWorkers_.compare_exchange_weak(compensating,
+                                                     compensating + 1))
+      {
+        StartCompensatingWorker();
+        ++compensating;
+      }
+    }
+  }
+}
+
+void Manager::RunCompensatingWorker()
+{
+  Worker worker(this, Worker::Mode::Compensating,
+                Worker::Specialization::None, idlePolicy_, fiberStacks_.get());
+  worker.acceptedClasses_ = GetAcceptedClasses(Worker::Specialization::None);
+  worker.keepWorking_     = true;
+  worker.isWorking_       = true;
+
+  std::unique_lock<std::mutex> lock(compensatingMutex_);
+  compensators_.push_back(&worker);
+  while (!stopCompensating_)
+  {
+    lock.unlock();
+
+    // Submitting jobs wakes compensating workers after the others, so they
+    // can sleep until there is work
+    while (!stopCompensating_ && !RetireCompensatingWorker())
+    {
+      worker.DoSingleJob(false);
+    }
+
+    lock.lock();
+
+    // Keep the thread for the next time a worker blocks
+    ++spareCompensators_;
+    compensatorRecalled_.wait(lock, [this]() {
+      return stopCompensating_ || recalledCompensators_ != 0;
+    });
+    --spareCompensators_;
+    if (recalledCompensators_ != 0)
+    {
+      --recalledCompensators_;
+    }
+  }
+
+  // The worker goes with this thread, so keep what it counted
+  exitedIdleStats_ += worker.GetIdleStats();
+  exitedPriorityStats_ += worker.GetPriorityStats();
+  exitedDeadlineStats_ += worker.GetDeadlineStats();
+  compensators_.erase(
+      std::find(compensators_.begin(), compensators_.end(), &worker));
+
+  worker.keepWorking_ = false;
+  worker.isWorking_   = false;
+}
+
+bool Manager::RetireCompensatingWorker()
+{
+  size_t compensating = compensatingWorkers_.load();
+  while (compensating > blockedWorkers_.load())
+  {
+    if (compensatingWorkers_.compare_exchange_weak(compensating,
+                                                   compensating - 1))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Manager::StopCompensatingWorkers()
+{
+  {
+    std::lock_guard<std::mutex> lock(compensatingMutex_);
+    stopCompensating_ = true;
+    compensatorRecalled_.notify_all();
+    blockingStarted_.notify_all();
+
+    // Ones asleep waiting for work need waking too, and must not go back
+    // to sleep
+    for (Worker* worker : compensators_)
+    {
+      worker->StopAfterCurrentTask();
+      WakeWorker(*worker);
+    }
+  }
+
+  // No more are started once stopCompensating_ is set, and only the
+  // watcher starts them
+  if (blockingWatcher_.joinable())
+  {
+    blockingWatcher_.join();
+  }
+  watcherAsleep_ = true;
+
+  for (std::thread& thread : compensatingThreads_)
+  {
+    thread.join();
+  }
+  compensatingThreads_.clear();
+
+  spareCompensators_    = 0;
+  recalledCompensators_ = 0;
+}
+
+Worker::IdleStats Manager::GetIdleStats()
+{
+  Worker::IdleStats stats = {};
+
+  {
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    for (Worker* worker : workers_)
+    {
+      stats += worker->GetIdleStats();
+    }
+  }
+
+  AddCompensatorStats(&stats, nullptr, nullptr);
+  return stats;
+}
+
+void Manager::SetPriorityAging(std::chrono::microseconds agingTime)
+{
+  // Kept well clear of where tick differences wrap around
+  const std::chrono::microseconds longest(1 << 24);
+  if (agingTime > longest) agingTime = longest;
+  if (agingTime.count() < 0) agingTime = std::chrono::microseconds::zero();
+
+  agingTime_.store(static_cast<std::uint32_t>(agingTime.count()),
+                   std::memory_order_relaxed);
+}
+
+std::chrono::microseconds Manager::GetPriorityAging() const
+{
+  return std::chrono::microseconds(
+      agingTime_.load(std::memory_order_relaxed));
+}
+
+void Manager::SetWaitTracking(bool track)
+{
+  trackWaits_.store(track, std::memory_order_relaxed);
+}
+
+bool Manager::GetWaitTracking() const
+{
+  return trackWaits_.load(std::memory_order_relaxed);
+}
+
+Worker::PriorityStats Manager::GetPriorityStats()
+{
+  Worker::PriorityStats stats = {};
+
+  {
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    for (Worker* worker : workers_)
+    {
+      stats += worker->GetPriorityStats();
+    }
+  }
+
+  AddCompensatorStats(nullptr, &stats, nullptr);
+  return stats;
+}
+
+Worker::DeadlineStats Manager::GetDeadlineStats()
+{
+  Worker::DeadlineStats stats = {};
+
+  {
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    for (Worker* worker : workers_)
+    {
+      stats += worker->GetDeadlineStats();
+    }
+  }
+
+  AddCompensatorStats(nullptr, nullptr, &stats);
+  return stats;
+}
+
+void Manager::AddCompensatorStats(Worker::IdleStats* idle,
+                                  Worker::PriorityStats* priority,
+                                  Worker::DeadlineStats* deadline)
+{
+  std::lock_guard<std::mutex> lock(compensatingMutex_);
+
+  if (idle != nullptr) *idle += exitedIdleStats_;
+  if (priority != nullptr) *priority += exitedPriorityStats_;
+  if (deadline != nullptr) *deadline += exitedDeadlineStats_;
+
+  for (Worker* worker : compensators_)
+  {
+    if (idle != nullptr) *idle += worker->GetIdleStats();
+    if (priority != nullptr) *priority += worker->GetPriorityStats();
+    if (deadline != nullptr) *deadline += worker->GetDeadlineStats();
+  }
 }
 
 void RunJob(Job* job) { JobBot::Manager::RunJob(job); }
 
 void WaitForJob(Job* job) { JobBot::Manager::WaitForJob(job); }
+
+void WaitForJob(const JobHandle& handle)
+{
+  JobBot::Manager::WaitForJob(handle);
+}
 }
@@ -10,13 +10,21 @@
 #ifndef _MANAGER_H
 #define _MANAGER_H
 
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
 #include "../includes/moodycamel/concurrentqueue.h"
 
+#include "DeadlineQueue.h"
+#include "Fiber.h"
 #include "JobExceptions.h"
+#include "JobPool.h"
+#include "TimerWheel.h"
 #include "Worker.h"
 
 namespace JobBot
@@ -29,31 +37,99 @@ public:
 
       If numWorkers is 0, system will start one worker for
       each available core in the machine
+
+      initialJobCapacity - number of jobs to allocate memory for up front
+      maxJobCapacity - number of jobs the job pool may grow to before
+                       creating a job throws JobRejected (QueueFull).
+                       The job pool is shared by all managers, so 0
+                       leaves whatever limit it already has alone
+      idlePolicy - how workers wait when there is no work to do
   */
-  Manager(size_t numWorkers = 0);
+  Manager(size_t numWorkers         = 0,
+          size_t initialJobCapacity = JobPool::scDefaultInitialCapacity,
+          size_t maxJobCapacity     = 0,
+          const Worker::IdlePolicy& idlePolicy = Worker::IdlePolicy::Balanced);
 
   /*
-      Shut down and join all the workers
+      Shut down and join all the workers. Jobs still waiting on timers from
+      SubmitJobAfter are cancelled and finished, as if by CancelTimer
   */
   ~Manager();
 
   /*
       Throw a job at the workers for them to complete
+
+      If the job has dependencies that haven't finished yet, it is held
+      back until they have (see Job::AddDependency)
   */
   bool SubmitJob(Job* job);
 
+  /*
+      Throw a whole batch of jobs at the workers at once
+
+      Jobs are grouped by type and added to each queue in bulk, and
+      sleeping workers are only woken once for the whole batch, so this
+      is much cheaper than calling SubmitJob for each job.
+
+      Throws JobRejected if any of the jobs is null, in which case none of
+      the jobs are submitted
+  */
+  bool SubmitJobs(Job* const* jobs, size_t count);
+
+  /*
+      Submit a job once delay has passed, rather than right away. Until
+      then it waits in the manager's timer wheel without tying up a worker.
+
+      One sleeping worker always wakes up in time for the next timer, and
+      while none is asleep the workers check the timers whenever they look
+      for work, so the job is submitted within a fraction of a millisecond
+      of being due unless every worker is stuck in a long job. A manager
+      with a single worker only checks while the thread that made it is
+      waiting on a job.
+
+      Returns an id for cancelling the timer with CancelTimer
+  */
+  TimerWheel::TimerID SubmitJobAfter(Job* job,
+                                     std::chrono::microseconds delay);
+
+  /*
+      Call makeJob and submit the job it returns every period, starting
+      one period from now, until the timer is cancelled with CancelTimer.
+      makeJob is called by whichever worker finds the timer due, so it
+      should be quick, and may return nullptr to skip a run. Runs that are
+      missed by more than a whole period are skipped rather than made up
+
+      Returns an id for cancelling the timer with CancelTimer
+  */
+  TimerWheel::TimerID SubmitJobEvery(std::chrono::microseconds period,
+                                     std::function<Job*()> makeJob);
+
+  /*
+      Stop a timer from SubmitJobAfter or SubmitJobEvery. A job that was
+      waiting on the timer is cancelled and submitted, so its parent and
+      anything depending on it can still finish. A periodic job that has
+      already been made still runs
+
+      Returns false if the timer already went off, or there is no such
+      timer
+  */
+  bool CancelTimer(TimerWheel::TimerID id);
+
   /*
       Get a worker based on its thread ID
   */
   Worker* GetWorkerByThreadID(std::thread::id id);
 
   /*
-      Get the worker who's thread ID matches the current thread
+      Get this manager's worker that lives on the current thread
+
+      Returns nullptr if the current thread isn't one of this manager's
   */
   Worker* GetThisThreadsWorker();
 
   /*
-      Get a random worker (for stealing/assigning jobs)
+      Get a random worker (for stealing/assigning jobs), or nullptr if the
+      workers aren't running
   */
   Worker* GetRandomWorker();
 
@@ -61,8 +137,9 @@ public:
       Get the worker that currently has the longest
       work queue.
 
-      Guaranteed to always return a valid worker, but that
-      worker may have an empty queue
+      Returns nullptr if the workers aren't running, otherwise a
+      worker that may have an empty queue. Queue lengths are read without
+      stopping anyone, so are only approximate
   */
   Worker* GetBusiestWorker();
 
@@ -79,21 +156,87 @@ public:
   /*
       Tell this threads worker to work while waiting for a job
 
-      Will block until job is complete
+      Will block until job is complete, then rethrows the exception if the
+      job (or a job in its tree) threw one
   */
   static void WaitForJob(Job* job);
 
   /*
-      Request a job for a worker with these parameters
+      Tell this threads worker to work while waiting for the job a handle
+      refers to
+
+      Will block until job is complete, then rethrows the exception if the
+      job (or a job in its tree) threw one
   */
-  Job* RequestJob(const Worker::Specialization& workerSpecialization);
+  static void WaitForJob(const JobHandle& handle);
 
-  // Worker threads wait for this to tell them there are jobs
-  std::condition_variable JobNotifier;
+  /*
+      Find a job for a worker to do, following its specialization
+
+      Jobs are taken a priority level at a time, most urgent first. Within
+      a level Important jobs are taken first, then the worker's own local
+      queues are drained, then the shared queues, and finally jobs are
+      stolen from other workers.
+
+      Every so often the worker first looks for jobs that have been passed
+      over for too long (see SetPriorityAging) and takes one of those
+      instead, so a steady stream of urgent work can't starve the rest
+
+      Jobs with a deadline are kept apart from all of that. Workers that
+      schedule earliest deadline first take the one due soonest before
+      anything else, and other workers take them when they find nothing
+      else to do, or while looking for aged jobs if one is due within the
+      aging time
+  */
+  Job* RequestJob(Worker& worker);
+
+  /*
+      Steal a job of the given type and priority from some worker other
+      than the thief
+
+      Two random workers are compared and the one with more of those jobs
+      is tried first, before falling back to checking every worker. thief
+      may be nullptr when stealing from a thread that isn't a worker
+
+      Returns nullptr if no other worker had such a job
+  */
+  Job* StealJob(JobType type, Worker* thief,
+                unsigned priority = Job::DEFAULT_PRIORITY);
+
+  /*
+      Put a worker to sleep until there is work it can do
+
+      Does one last check for work after the worker is marked as sleeping,
+      so a job submitted at the same time is never missed. Returns that job
+      if there was one, otherwise nullptr once the worker has been woken
+
+      timeout - longest to sleep for, or zero to sleep until woken. A
+                worker sleeping with a timeout is waiting on something
+                besides new work, so WakeWaiters wakes it too
+  */
+  Job* WaitForWork(Worker& worker, std::chrono::microseconds timeout =
+                                       std::chrono::microseconds::zero());
+
+  /*
+      Wake up every worker that went to sleep while waiting on a job or
+      condition, after a job has finished in case it was that one. Cheap
+      when nobody is
+  */
+  void WakeWaiters();
+
+  /*
+      Wake a specific worker if it is sleeping
+
+      Returns true if the worker was asleep
+  */
+  bool WakeWorker(Worker& worker);
 
   /*
       Stop all worker threads associated with this manager
       Stop the workers and free their associated memory
+
+      Must be called from the thread that started the workers, since that
+      thread's volunteer worker is freed too
   */
   void StopWorkers();
 
@@ -104,6 +247,170 @@ public:
   */
   void StartWorkers();
 
+  /*
+      Get how workers wait when there is no work to do
+  */
+  const Worker::IdlePolicy& GetIdlePolicy() const;
+
+  /*
+      Change how workers wait when there is no work to do
+
+      If the workers are running they are restarted to pick up the new
+      policy (which also resets their idle stats), so this must be called
+      from the thread that created the manager and never from inside a job
+  */
+  void SetIdlePolicy(const Worker::IdlePolicy& idlePolicy);
+
+  /*
+      Get the combined idle stats of all workers, to see how much time is
+      spent spinning, yielding and sleeping. Compensating workers count too,
+      including ones that have exited since the workers were started
+  */
+  Worker::IdleStats GetIdleStats();
+
+  /*
+      Run jobs on fibers, so a job waiting on another (WaitForJob, or
+      WorkWhileWaitingFor on its worker) is put aside on its own stack
+      while the worker gets on with other jobs, and carries on as soon as
+      what it waited on is done. Without fibers the worker runs other jobs
+      on top of the waiting one, which can't carry on until every one of
+      them has finished, however long they wait themselves.
+
+      Each worker keeps the fibers it makes, with stacks from a pool shared
+      by the manager. Stacks have a guard page, so overflowing one crashes
+      rather than corrupting memory. A fiber never moves to another thread,
+      so jobs can still use thread locals. Off by default.
+
+      Like SetIdlePolicy, the workers are restarted, so this must be called
+      from the thread that created the manager and never from inside a job
+
+      stackSize - size of each fiber's stack in bytes, rounded up to whole
+                  pages
+
+      Returns false, changing nothing, if fibers aren't supported here
+      (only Linux on x86-64 and AArch64)
+  */
+  bool SetFiberMode(bool useFibers,
+                    size_t stackSize = FiberStackPool::scDefaultStackSize);
+
+  /*
+      Are jobs being run on fibers
+  */
+  bool GetFiberMode() const;
+
+  /*
+      Tell the manager the calling worker is about to block (on a lock, a
+      file, the network...) until EndBlocking, so it should have another
+      worker take its place in the meantime. IO jobs, and other jobs marked
+      with Job::SetBlocking, are counted as blocking for as long as they
+      run without calling this.
+
+      Does nothing on threads that aren't one of this manager's workers
+  */
+  void BeginBlocking();
+
+  /*
+      The calling worker is done blocking, after BeginBlocking
+  */
+  void EndBlocking();
+
+  /*
+      Set how many workers can be filling in for blocked ones at once.
+
+      A worker is blocked while it runs an IO job (unless the job was
+      marked with Job::SetBlocking(false)) or another job marked with
+      Job::SetBlocking(true), or between BeginBlocking and EndBlocking.
+      Once a worker has been blocked for longer than the compensation delay
+      (see SetCompensationDelay), a compensating worker is woken, or
+      started if there are none spare, to keep the cores busy with
+      everything else. It takes any sort of job, including blocking ones
+      (which block it in turn and bring in another), and retires as soon as
+      it finishes a job or runs out of work once there are more
+      compensating workers than blocked ones. Retired ones are kept asleep
+      for the next time a worker blocks, until the workers are stopped.
+
+      Defaults to 64. Zero turns compensating off, so blocked workers just
+      leave their cores idle
+  */
+  void SetMaxCompensatingWorkers(size_t count);
+
+  /*
+      Get how many workers can be filling in for blocked ones at once
+  */
+  size_t GetMaxCompensatingWorkers() const;
+
+  /*
+      Set how long a worker has to be blocked before a compensating worker
+      fills in for it. Most blocks are over sooner than a compensating
+      worker could be woken, so this saves bringing one in for each of
+      them. Blocked workers are only looked at every so often, so this is
+      approximate.
+
+      Defaults to 1 ms. Zero brings in a compensating worker as soon as a
+      worker blocks
+  */
+  void SetCompensationDelay(std::chrono::microseconds delay);
+
+  /*
+      Get how long a worker has to be blocked before another fills in
+  */
+  std::chrono::microseconds GetCompensationDelay() const;
+
+  /*
+      Get how many workers are filling in for blocked ones right now
+  */
+  size_t GetCompensatingWorkerCount() const;
+
+  /*
+      Set how long jobs can be passed over for more urgent work before they
+      are taken anyway. Jobs at priority p can wait (p + 1) times this long,
+      so urgent jobs that are passed over still go before less urgent ones.
+      How long a job has waited is only checked every few job requests, so
+      this is approximate.
+
+      Defaults to 2 ms. Zero turns aging off, so less urgent jobs only run
+      once there is nothing more urgent to do
+  */
+  void SetPriorityAging(std::chrono::microseconds agingTime);
+
+  /*
+      Get how long jobs can be passed over before they are aged
+  */
+  std::chrono::microseconds GetPriorityAging() const;
+
+  /*
+      Start or stop timing how long each job waits between being submitted
+      and being taken by a worker. Off by default, since it reads the clock
+      twice for every job. Only jobs submitted while it is on are timed
+  */
+  void SetWaitTracking(bool track);
+
+  /*
+      Is the wait of each job being timed
+  */
+  bool GetWaitTracking() const;
+
+  /*
+      Get the combined wait times and aging counts of all workers at each
+      priority, to check that no level is being starved. Compensating
+      workers count too, as for GetIdleStats
+  */
+  Worker::PriorityStats GetPriorityStats();
+
+  /*
+      Get how many jobs with a deadline all the workers ran, and how many
+      of them missed it. Compensating workers count too, as for
+      GetIdleStats
+  */
+  Worker::DeadlineStats GetDeadlineStats();
+
+  /*
+      Get the current time in ticks (microseconds), which is what job
+      submit times and deadlines are kept in. Wraps around every hour or
+      so, so only differences between nearby ticks mean anything
+  */
+  static std::uint32_t GetTicks();
+
 private:
   /*
       Vector of the workers this manager is controlling
@@ -131,26 +438,308 @@ private:
   // Number of worker threads this manager should use
   const size_t numWorkers_;
 
-  // Maximum length of a worker's queue
-  static constexpr size_t sMaxWorkerQueueLength_ = 4096;
+  // How this manager's workers wait when there is no work
+  Worker::IdlePolicy idlePolicy_;
+
+  // Stacks for workers to run jobs on, or nullptr if they don't use fibers
+  std::unique_ptr<FiberStackPool> fiberStacks_;
 
-  // Array of specialized queues for each type of job
-  moodycamel::ConcurrentQueue<Job*>
-      jobs[static_cast<size_t>(JobType::NumJobTypes)];
+  // Number of types of job, and of queues each priority has
+  static constexpr size_t scNumJobTypes_ =
+      static_cast<size_t>(JobType::NumJobTypes);
+  // Number of queues of each sort, one per type and priority
+  static constexpr size_t scNumJobClasses_ =
+      scNumJobTypes_ * Job::NUM_PRIORITIES;
+
+  // Queues for jobs submitted from threads that are not one of this
+  // manager's workers (or whose worker's local queue was full).
+  // One queue for each type and priority of job
+  moodycamel::ConcurrentQueue<Job*> jobs[scNumJobTypes_][Job::NUM_PRIORITIES];
+
+  // Jobs with a deadline, one queue for each type of job. Workers take
+  // them from here whoever submitted them, since they go by deadline
+  // rather than by who is closest
+  DeadlineQueue deadlineJobs_[scNumJobTypes_];
+
+  // One bit for each type and priority that might have jobs waiting in
+  // some queue, so workers don't have to search every queue of every
+  // worker to find the few that have anything in them. Set by whoever
+  // adds a job, cleared by a worker that finds nothing of that sort
+  std::atomic<std::uint32_t> waitingClasses_;
+
+  // One bit for each type and priority a job has been taken from since a
+  // worker last looked for jobs that have waited too long
+  std::atomic<std::uint32_t> servedClasses_;
+
+  // Roughly when a job of each type and priority was last taken, or when
+  // one started waiting if there were none before, in ticks. Indexed by
+  // GetClassIndex
+  std::atomic<std::uint32_t> lastServed_[scNumJobClasses_];
+
+  // How long jobs can be passed over before they are aged, in ticks
+  std::atomic<std::uint32_t> agingTime_;
+
+  // If jobs are stamped with when they were submitted
+  std::atomic_bool trackWaits_;
+
+  // Number of job requests a worker makes between looking for jobs that
+  // have waited too long
+  static constexpr unsigned scAgingCheckInterval_ = 32;
+
+  // Aging time managers start with, in ticks
+  static constexpr std::uint32_t scDefaultAgingTime_ = 2000;
+
+  /*
+      Get the time to stamp jobs being submitted now with, or 0 if waits
+      aren't being timed
+  */
+  std::uint32_t GetSubmitTime() const;
+
+  /*
+      Get the index of a type and priority of job, for lastServed_
+  */
+  static size_t GetClassIndex(JobType type, unsigned priority);
 
   /*
-      Attempt to get a job of specified type.
+      Get the bit in waitingClasses_ for a type and priority of job
+  */
+  static std::uint32_t GetClassBit(JobType type, unsigned priority);
+
+  /*
+      Get the bits in waitingClasses_ for every type of job at priority 0.
+      Shift left by priority * scNumJobTypes_ for the other priorities
+  */
+  static std::uint32_t GetLevelBits();
+
+  /*
+      Get the bits in waitingClasses_ for every type and priority of job a
+      worker with the given specialization takes
+  */
+  static std::uint32_t
+  GetAcceptedClasses(const Worker::Specialization& specialization);
+
+  /*
+      Find the job a worker should do at one priority, following its
+      specialization. Returns nullptr if there is none
+
+      waiting - waitingClasses_, less anything the worker doesn't take
+  */
+  Job* FindJob(Worker& worker, unsigned priority, std::uint32_t waiting);
+
+  /*
+      Find a job of a type the worker takes that has waited longer than it
+      is allowed to. Returns nullptr if there is none
+  */
+  Job* FindAgedJob(Worker& worker);
+
+  /*
+      Take the job with the earliest deadline of the types the worker
+      takes. Returns nullptr if there is none
+
+      dueSoon - only take it if the deadline is within the aging time, or
+                has passed
+  */
+  Job* TakeDeadlineJob(Worker& worker, bool dueSoon);
+
+  /*
+      Take a job of the given type and priority from the worker's own
+      queue, the shared queue or another worker, in that order
+  */
+  Job* TakeJob(Worker& worker, JobType type, unsigned priority);
+
+  /*
+      Flag some types and priorities of job as having jobs waiting, after
+      those jobs have been added to their queues
+
+      classes - bits from GetClassBit for the jobs that were added
+  */
+  void MarkWaiting(std::uint32_t classes);
+
+  /*
+      Stop workers looking for a type and priority of job, unless there
+      still are some of them waiting somewhere
+  */
+  void ClearWaiting(JobType type, unsigned priority);
+
+  /*
+      Note that a job of the given type and priority was taken, so the
+      rest of them aren't being passed over
+  */
+  void MarkServed(JobType type, unsigned priority);
+
+  /*
+      Attempt to get a job of specified type and priority.
+
+      When the shared queue has plenty of jobs, a batch is taken at once and
+      everything but the returned job goes into the worker's local queue
+      (where other workers can still steal it). The batch size scales with
+      how many jobs are waiting so one worker never takes more than its
+      share.
 
       Returns true if successful, false otherwise.
       If successful, pointer to retrived job is placed in 'job' reference.
       If unsuccessful, job is not modified
   */
-  bool TryGetJob(JobType type, Job*& job);
+  bool TryGetJob(JobType type, unsigned priority, Worker& worker, Job*& job);
+
+  // Most jobs a worker will take from a shared queue at once
+  static constexpr size_t scMaxJobBatch_ = 32;
+
+  // Number of workers currently asleep waiting for work
+  std::atomic_size_t sleepingWorkers_;
+
+  // Delayed and periodic jobs waiting to be submitted
+  TimerWheel timers_;
+
+  // Sleeping worker that wakes up in time for the next timer, or nullptr
+  // if none is. Only one does, so they don't all wake for every timer
+  std::atomic<Worker*> timerWatcher_;
+
+  /*
+      Submit the jobs of any timers that are due. Returns true if there
+      were any
+  */
+  bool PollTimers();
+
+  /*
+      Make sure some worker wakes up in time for the timer that is now the
+      next one due. Must come after the timer is added
+  */
+  void WakeForTimers();
+
+  /*
+      Add a chunk of jobs of one type and priority to the shared queue for
+      them, making a producer token for the queue if there isn't one yet
+  */
+  void FlushJobChunk(moodycamel::ConcurrentQueue<Job*>& queue,
+                     std::unique_ptr<moodycamel::ProducerToken>& token,
+                     Job* const* chunk, size_t count);
+
+  /*
+      Wake up enough sleeping workers to handle some new jobs. Only workers
+      that will take that type of job are woken. Must come after
+      MarkWaiting, whose fence makes sure either the jobs are seen by a
+      worker going to sleep or the worker is seen to be asleep here
+
+      type - type of the jobs that were just submitted
+      jobCount - number of jobs that were just submitted
+  */
+  void WakeWorkers(JobType type, size_t jobCount);
+
+  /*
+      Wake up every sleeping worker
+  */
+  void WakeAllWorkers();
+
+  // Number of workers asleep while waiting on something other than work
+  std::atomic_size_t sleepingWaiters_;
 
   /*
       Function that will be spun up on threads for each worker
   */
   void StartNewWorker(Worker::Mode mode);
+
+  /*
+      Number of workers that have been created so far
+  */
+  size_t GetStartedWorkerCount();
+
+  /*
+      Move every job left in a stopped worker's local queues to the shared
+      queues, so they still get run once it is gone
+  */
+  void RequeueLocalJobs(Worker& worker);
+
+  // Number of workers blocked, and of compensating workers filling in for
+  // them (not counting retired ones)
+  std::atomic_size_t blockedWorkers_;
+  std::atomic_size_t compensatingWorkers_;
+  // Most compensating workers there can be at once
+  std::atomic_size_t maxCompensatingWorkers_;
+  // How long a worker is blocked before another fills in, in microseconds
+  std::atomic<std::uint32_t> compensationDelay_;
+
+  // Thread that brings in compensating workers once workers have been
+  // blocked for long enough, started the first time one blocks
+  std::thread blockingWatcher_;
+  // What the watcher sleeps on
+  std::condition_variable blockingStarted_;
+  // Set while the watcher is asleep or hasn't been started, so workers
+  // that block only take the lock to tell it when they have to
+  std::atomic_bool watcherAsleep_;
+
+  // Threads of every compensating worker, retired or not
+  std::vector<std::thread> compensatingThreads_;
+  // Number of retired compensating workers, and how many of those have
+  // been asked to come back
+  size_t spareCompensators_;
+  size_t recalledCompensators_;
+  // Set when the workers are being stopped, so compensating ones go too
+  std::atomic_bool stopCompensating_;
+  // Protects the compensating threads and counts of spares
+  std::mutex compensatingMutex_;
+  // What retired compensating workers sleep on
+  std::condition_variable compensatorRecalled_;
+
+  // Compensating workers that are running, retired or not
+  std::vector<Worker*> compensators_;
+  // Number of those asleep waiting for work, checked before bothering
+  // with the lock to wake them
+  std::atomic_size_t sleepingCompensators_;
+  // Stats of compensating workers that have exited since the workers were
+  // started, so the jobs they ran still count
+  Worker::IdleStats exitedIdleStats_;
+  Worker::PriorityStats exitedPriorityStats_;
+  Worker::DeadlineStats exitedDeadlineStats_;
+
+  // Compensating workers allowed at once by default
+  static constexpr size_t scDefaultMaxCompensatingWorkers_ = 64;
+  // Compensation delay managers start with, in microseconds
+  static constexpr std::uint32_t scDefaultCompensationDelay_ = 1000;
+
+  /*
+      Wake up to count compensating workers that are asleep, since they
+      aren't in workers_ for the other wake ups to find
+
+      waitersOnly - only wake those waiting on something other than work
+  */
+  void WakeCompensators(size_t count, bool waitersOnly = false);
+
+  /*
+      Add the stats of every compensating worker, running or exited, to
+      the ones given
+  */
+  void AddCompensatorStats(Worker::IdleStats* idle,
+                           Worker::PriorityStats* priority,
+                           Worker::DeadlineStats* deadline);
+
+  /*
+      Bring back a retired compensating worker, or start a new one. Must be
+      called with compensatingMutex_ locked
+  */
+  void StartCompensatingWorker();
+
+  /*
+      Function the blocking watcher's thread runs. Brings in compensating
+      workers for workers that stay blocked past the compensation delay
+  */
+  void WatchBlockedWorkers();
+
+  /*
+      Function compensating workers' threads run
+  */
+  void RunCompensatingWorker();
+
+  /*
+      Retire a compensating worker if there are more of them than blocked
+      workers. Returns true if the caller should retire
+  */
+  bool RetireCompensatingWorker();
+
+  /*
+      Stop every compensating worker and join their threads
+  */
+  void StopCompensatingWorkers();
 };
 
 /*
@@ -161,8 +750,15 @@ void RunJob(Job* job);
 /*
 Tell this threads worker to work while waiting for a job
 
-Will block until job is complete
+Will block until job is complete, then rethrows any exception it threw
 */
 void WaitForJob(Job* job);
+
+/*
+Tell this threads worker to work while waiting for the job a handle refers to
+
+Will block until job is complete, then rethrows any exception it threw
+*/
+void WaitForJob(const JobHandle& handle);
 }
 #endif
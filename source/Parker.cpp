@@ -0,0 +1,97 @@
+/**************************************************************************
+    Contains implementation of Parker, using futexes where available
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include "Parker.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace JobBot
+{
+#ifdef __linux__
+namespace
+{
+long Futex(std::atomic<std::uint32_t>* address, int op, std::uint32_t value,
+           const timespec* timeout = nullptr)
+{
+  return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(address), op,
+                 value, timeout, nullptr, 0);
+}
+}
+#endif
+
+Parker::Parker() : epoch_(0) {}
+
+std::uint32_t Parker::PrepareToPark() const
+{
+  return epoch_.load(std::memory_order_acquire);
+}
+
+void Parker::Park(std::uint32_t epoch)
+{
+#ifdef __linux__
+  // Futex only sleeps if the epoch is still what we saw, and may return
+  // early on signals, so keep going until it really changes
+  while (epoch_.load(std::memory_order_acquire) == epoch)
+  {
+    Futex(&epoch_, FUTEX_WAIT_PRIVATE, epoch);
+  }
+#else
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (epoch_.load(std::memory_order_acquire) == epoch)
+  {
+    condition_.wait(lock);
+  }
+#endif
+}
+
+bool Parker::ParkFor(std::uint32_t epoch, std::chrono::microseconds timeout)
+{
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point deadline = Clock::now() + timeout;
+
+#ifdef __linux__
+  while (epoch_.load(std::memory_order_acquire) == epoch)
+  {
+    Clock::time_point now = Clock::now();
+    if (now >= deadline) return false;
+
+    // Futex timeouts are relative, so work out how long is left each time
+    std::chrono::nanoseconds left = deadline - now;
+    timespec relative;
+    relative.tv_sec  = static_cast<time_t>(left.count() / 1000000000);
+    relative.tv_nsec = static_cast<long>(left.count() % 1000000000);
+
+    Futex(&epoch_, FUTEX_WAIT_PRIVATE, epoch, &relative);
+  }
+  return true;
+#else
+  std::unique_lock<std::mutex> lock(mutex_);
+  return condition_.wait_until(lock, deadline, [&]() {
+    return epoch_.load(std::memory_order_acquire) != epoch;
+  });
+#endif
+}
+
+void Parker::Unpark()
+{
+#ifdef __linux__
+  epoch_.fetch_add(1, std::memory_order_release);
+  Futex(&epoch_, FUTEX_WAKE_PRIVATE, 1);
+#else
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_.fetch_add(1, std::memory_order_release);
+  }
+  condition_.notify_one();
+#endif
+}
+}
@@ -0,0 +1,81 @@
+/**************************************************************************
+    Declaration of Parker, the primitive a single worker thread sleeps on
+    while it has nothing to do
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _PARKER_H
+#define _PARKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace JobBot
+{
+/*
+    Lets one thread sleep until another thread wakes it, without losing
+    wake ups that happen between deciding to sleep and actually sleeping.
+
+    Usage for the sleeping thread:
+      epoch = PrepareToPark()
+      publish that this thread is about to sleep, then check for work again
+      Park(epoch) if there was still nothing to do
+
+    Any Unpark after PrepareToPark makes the matching Park return right away.
+
+    Uses a futex on Linux and a condition variable everywhere else.
+*/
+class Parker
+{
+public:
+  Parker();
+
+  /*
+      Parkers are tied to the address of their counter, so can't be copied
+  */
+  Parker(const Parker&) = delete;
+  Parker& operator=(const Parker&) = delete;
+
+  /*
+      Get the value to pass to Park. Call before the final check for work
+  */
+  std::uint32_t PrepareToPark() const;
+
+  /*
+      Sleep until Unpark is called. Returns right away if Unpark was called
+      since the PrepareToPark that returned epoch
+  */
+  void Park(std::uint32_t epoch);
+
+  /*
+      Like Park, but gives up once timeout has passed
+
+      Returns true if woken by Unpark, false if the time ran out
+  */
+  bool ParkFor(std::uint32_t epoch, std::chrono::microseconds timeout);
+
+  /*
+      Wake the parked thread, or stop it from parking if it is about to
+  */
+  void Unpark();
+
+private:
+  // Bumped by every Unpark
+  std::atomic<std::uint32_t> epoch_;
+
+#ifndef __linux__
+  std::mutex mutex_;
+  std::condition_variable condition_;
+#endif
+};
+}
+#endif
@@ -0,0 +1,234 @@
+/**************************************************************************
+    Contains implementation of PayloadArena
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <new>
+
+#include "PayloadArena.h"
+
+namespace JobBot
+{
+thread_local PayloadArena::ThreadCacheHolder PayloadArena::tCache_;
+PayloadArena::ThreadCache* PayloadArena::sCaches_ = nullptr;
+std::mutex PayloadArena::sCacheMutex_;
+
+void* PayloadArena::Allocate(size_t size)
+{
+  static_assert(scMinBlockSize << (scNumSizeClasses - 1) == scMaxBlockSize,
+                "Size classes must cover scMinBlockSize to scMaxBlockSize");
+
+  ThreadCache& cache = *GetThreadCache();
+  size_t sizeClass   = GetSizeClass(size);
+  BlockHeader* header;
+
+  if (sizeClass < scNumSizeClasses &&
+      (cache.freeLists[sizeClass] != nullptr ||
+       TakeRemoteBlocks(cache, sizeClass)))
+  {
+    header                     = cache.freeLists[sizeClass];
+    cache.freeLists[sizeClass] = header->next;
+    --cache.counts[sizeClass];
+
+    Uncount(cache.counters.cachedBlocks, 1);
+    Uncount(cache.counters.cachedBytes, header->size);
+  }
+  else
+  {
+    size_t blockSize = (sizeClass < scNumSizeClasses)
+                           ? (scMinBlockSize << sizeClass)
+                           : size;
+    header = static_cast<BlockHeader*>(
+        ::operator new(sizeof(BlockHeader) + blockSize));
+    header->size  = blockSize;
+    header->owner = &cache;
+
+    Count(cache.counters.heapAllocations, 1);
+  }
+
+  Count(cache.counters.allocations, 1);
+  Count(cache.counters.allocatedBytes, header->size);
+
+  return header + 1;
+}
+
+void PayloadArena::Free(void* block)
+{
+  if (block == nullptr) return;
+
+  ThreadCache& cache  = *GetThreadCache();
+  BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+  size_t sizeClass    = GetSizeClass(header->size);
+
+  Count(cache.counters.frees, 1);
+  Count(cache.counters.freedBytes, header->size);
+
+  if (sizeClass == scNumSizeClasses)
+  {
+    ::operator delete(header);
+  }
+  else if (header->owner != &cache)
+  {
+    // Push onto the owner's remote list. The owner only ever takes the
+    // whole list at once, so there is no ABA problem here
+    std::atomic<BlockHeader*>& remote =
+        header->owner->remoteFreeLists[sizeClass];
+    BlockHeader* head = remote.load(std::memory_order_relaxed);
+    do
+    {
+      header->next = head;
+    } while (!remote.compare_exchange_weak(
+        head, header, std::memory_order_release, std::memory_order_relaxed));
+  }
+  else if (cache.counts[sizeClass] < scMaxCachedBlocks)
+  {
+    header->next               = cache.freeLists[sizeClass];
+    cache.freeLists[sizeClass] = header;
+    ++cache.counts[sizeClass];
+
+    Count(cache.counters.cachedBlocks, 1);
+    Count(cache.counters.cachedBytes, header->size);
+  }
+  else
+  {
+    ::operator delete(header);
+  }
+}
+
+PayloadArena::Stats PayloadArena::GetStats()
+{
+  Stats stats = {0, 0, 0, 0, 0, 0};
+
+  size_t allocations = 0, frees = 0, allocatedBytes = 0, freedBytes = 0;
+  auto gather = [&](const Counters& counters) {
+    allocations += counters.allocations.load(std::memory_order_relaxed);
+    frees += counters.frees.load(std::memory_order_relaxed);
+    allocatedBytes += counters.allocatedBytes.load(std::memory_order_relaxed);
+    freedBytes += counters.freedBytes.load(std::memory_order_relaxed);
+    stats.cachedBlocks += counters.cachedBlocks.load(std::memory_order_relaxed);
+    stats.cachedBytes += counters.cachedBytes.load(std::memory_order_relaxed);
+    stats.heapAllocations +=
+        counters.heapAllocations.load(std::memory_order_relaxed);
+  };
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+  for (ThreadCache* cache = sCaches_; cache != nullptr; cache = cache->next)
+  {
+    gather(cache->counters);
+    ++stats.threadCaches;
+  }
+
+  // Blocks can be freed on a different thread than they were allocated
+  // on, so only the totals mean anything
+  stats.liveBlocks = (allocations > frees) ? allocations - frees : 0;
+  stats.liveBytes =
+      (allocatedBytes > freedBytes) ? allocatedBytes - freedBytes : 0;
+  return stats;
+}
+
+size_t PayloadArena::GetSizeClass(size_t size)
+{
+  size_t sizeClass = 0;
+  for (size_t blockSize = scMinBlockSize; blockSize < size; blockSize <<= 1)
+  {
+    if (++sizeClass == scNumSizeClasses) break;
+  }
+  return sizeClass;
+}
+
+void PayloadArena::Count(std::atomic_size_t& counter, size_t amount)
+{
+  // Only the owning thread writes, so there is no need for a locked add
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+void PayloadArena::Uncount(std::atomic_size_t& counter, size_t amount)
+{
+  counter.store(counter.load(std::memory_order_relaxed) - amount,
+                std::memory_order_relaxed);
+}
+
+PayloadArena::ThreadCache* PayloadArena::GetThreadCache()
+{
+  if (tCache_.cache != nullptr)
+  {
+    return tCache_.cache;
+  }
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+
+  // Prefer taking over a cache from a thread that has exited, so the
+  // blocks coming back to it get used
+  for (ThreadCache* cache = sCaches_; cache != nullptr; cache = cache->next)
+  {
+    if (cache->orphaned)
+    {
+      cache->orphaned = false;
+      tCache_.cache   = cache;
+      return cache;
+    }
+  }
+
+  // Value initialized, so the lists and counters all start at zero
+  ThreadCache* cache = new ThreadCache();
+  cache->next        = sCaches_;
+  sCaches_           = cache;
+
+  tCache_.cache = cache;
+  return cache;
+}
+
+bool PayloadArena::TakeRemoteBlocks(ThreadCache& cache, size_t sizeClass)
+{
+  BlockHeader* blocks = cache.remoteFreeLists[sizeClass].exchange(
+      nullptr, std::memory_order_acquire);
+  if (blocks == nullptr) return false;
+
+  // They were all handed out by this thread, so there are never more than
+  // it had live at once
+  size_t count = 0;
+  size_t bytes = 0;
+  BlockHeader* last = blocks;
+  for (;;)
+  {
+    ++count;
+    bytes += last->size;
+    if (last->next == nullptr) break;
+    last = last->next;
+  }
+
+  last->next                 = cache.freeLists[sizeClass];
+  cache.freeLists[sizeClass] = blocks;
+  cache.counts[sizeClass] += count;
+
+  Count(cache.counters.cachedBlocks, count);
+  Count(cache.counters.cachedBytes, bytes);
+  return true;
+}
+
+PayloadArena::ThreadCacheHolder::~ThreadCacheHolder()
+{
+  if (cache == nullptr) return;
+
+  // Nothing is waiting on the blocks this thread kept, so give them back,
+  // but leave the cache for blocks still out to come back to
+  for (size_t i = 0; i < scNumSizeClasses; ++i)
+  {
+    while (cache->freeLists[i] != nullptr)
+    {
+      BlockHeader* following = cache->freeLists[i]->next;
+      Uncount(cache->counters.cachedBlocks, 1);
+      Uncount(cache->counters.cachedBytes, cache->freeLists[i]->size);
+      ::operator delete(cache->freeLists[i]);
+      cache->freeLists[i] = following;
+    }
+    cache->counts[i] = 0;
+  }
+
+  std::lock_guard<std::mutex> lock(sCacheMutex_);
+  cache->orphaned = true;
+}
+}
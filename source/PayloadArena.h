@@ -0,0 +1,186 @@
+/**************************************************************************
+    Declaration of PayloadArena, the allocator for job payloads that are too
+    big to fit inside a job
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _PAYLOADARENA_H
+#define _PAYLOADARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace JobBot
+{
+/*
+    Hands out blocks for payloads that don't fit in a job's padding.
+
+    Blocks are rounded up to a power of two size class between
+    scMinBlockSize and scMaxBlockSize. Each thread (so each worker) keeps a
+    free list per size class, so once a program has warmed up, getting and
+    giving back a block never touches the heap or another thread's lock.
+    Anything larger than scMaxBlockSize goes straight to the heap.
+
+    Blocks go back to the thread that allocated them. A block freed on a
+    different thread is pushed onto the owner's remote free list for its
+    size class, which the owner takes back in one go when its own list runs
+    dry, the same way JobPool does for jobs. So a thread that only creates
+    jobs keeps getting its blocks back from the workers that run them.
+    When a thread exits its cache is kept for the next new thread to
+    adopt, since blocks it handed out may still come back to it.
+
+    Blocks are aligned to scBlockAlignment.
+*/
+class PayloadArena
+{
+public:
+  /*
+      Snapshot of how much memory payloads are using
+  */
+  struct Stats
+  {
+    // Number of blocks handed out and not given back yet
+    size_t liveBlocks;
+    // Bytes in those blocks, counting the whole size class
+    size_t liveBytes;
+    // Number of blocks sitting in free lists waiting to be reused
+    size_t cachedBlocks;
+    // Bytes in those blocks
+    size_t cachedBytes;
+    // Number of blocks that had to come from the heap
+    size_t heapAllocations;
+    // Number of threads that have allocated or freed a block, including
+    // caches left by threads that have exited
+    size_t threadCaches;
+  };
+
+  /*
+      Get a block of at least size bytes
+  */
+  static void* Allocate(size_t size);
+
+  /*
+      Give back a block from Allocate. Safe to call from any thread
+  */
+  static void Free(void* block);
+
+  /*
+      Get the current use of the arena
+
+      Counters are gathered from every thread without stopping them, so the
+      result is approximate while payloads are being allocated or freed
+  */
+  static Stats GetStats();
+
+  // Smallest block handed out
+  static constexpr size_t scMinBlockSize = 64;
+  // Largest block kept in the per thread lists
+  static constexpr size_t scMaxBlockSize = 4096;
+  // Alignment of every block
+  static constexpr size_t scBlockAlignment = 16;
+  // Most blocks of each size a thread keeps around before giving them back
+  // to the heap
+  static constexpr size_t scMaxCachedBlocks = 64;
+
+private:
+  // Number of size classes from scMinBlockSize to scMaxBlockSize
+  static constexpr size_t scNumSizeClasses = 7;
+
+  struct ThreadCache;
+
+  /*
+      Sits just in front of every block
+  */
+  struct alignas(scBlockAlignment) BlockHeader
+  {
+    // Usable size of the block
+    size_t size;
+    // Next block in a free list while the block is not in use
+    BlockHeader* next;
+    // Cache of the thread that allocated the block, which it goes back to
+    ThreadCache* owner;
+  };
+
+  /*
+      Counters kept by each thread. Only the owning thread changes them, so
+      they are atomic just to be read by GetStats
+  */
+  struct Counters
+  {
+    std::atomic_size_t allocations;
+    std::atomic_size_t frees;
+    std::atomic_size_t allocatedBytes;
+    std::atomic_size_t freedBytes;
+    std::atomic_size_t cachedBlocks;
+    std::atomic_size_t cachedBytes;
+    std::atomic_size_t heapAllocations;
+  };
+
+  /*
+      Free lists for one thread. Never deleted, since blocks handed out
+      from it may be freed back to it after the thread has exited
+  */
+  struct ThreadCache
+  {
+    // Blocks freed by the owning thread (owner only)
+    BlockHeader* freeLists[scNumSizeClasses];
+    // Number of blocks in each of freeLists (owner only)
+    size_t counts[scNumSizeClasses];
+    // Blocks freed by other threads, waiting to be taken back by the owner
+    std::atomic<BlockHeader*> remoteFreeLists[scNumSizeClasses];
+    Counters counters;
+    // If the thread that owned this cache has exited
+    bool orphaned;
+    // Next cache in the list of all caches
+    ThreadCache* next;
+  };
+
+  /*
+      Owns the calling thread's cache, giving it up when the thread exits
+  */
+  struct ThreadCacheHolder
+  {
+    ThreadCache* cache = nullptr;
+    ~ThreadCacheHolder();
+  };
+
+  /*
+      Get the calling thread's cache, creating or adopting one if needed
+  */
+  static ThreadCache* GetThreadCache();
+
+  /*
+      Move the blocks other threads have freed back into one of the calling
+      thread's lists, returning false if there weren't any
+  */
+  static bool TakeRemoteBlocks(ThreadCache& cache, size_t sizeClass);
+
+  /*
+      Get the size class that fits size bytes, or scNumSizeClasses if it
+      is too big for any of them
+  */
+  static size_t GetSizeClass(size_t size);
+
+  /*
+      Add to one of the calling thread's counters
+  */
+  static void Count(std::atomic_size_t& counter, size_t amount);
+
+  /*
+      Take away from one of the calling thread's counters
+  */
+  static void Uncount(std::atomic_size_t& counter, size_t amount);
+
+  static thread_local ThreadCacheHolder tCache_;
+
+  // Every cache ever made, for gathering stats and adopting
+  static ThreadCache* sCaches_;
+  // Protects sCaches_ and the orphaned flags
+  static std::mutex sCacheMutex_;
+};
+}
+#endif
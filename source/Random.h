@@ -0,0 +1,80 @@
+/**************************************************************************
+    Declaration of XorShift, a small and fast random number generator for
+    choosing workers to steal from
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _JOBBOT_RANDOM_H
+#define _JOBBOT_RANDOM_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace JobBot
+{
+/*
+    xorshift64* generator (Vigna 2014)
+
+    Not thread safe, each thread keeps its own so there is no shared state
+    to fight over like there is with std::rand. Nowhere near good enough
+    for anything but spreading work around.
+*/
+class XorShift
+{
+public:
+  /*
+      Create a generator with a seed that differs from every other
+      generator made in this process
+  */
+  XorShift() : state_(Mix(NextSeed())) {}
+
+  /*
+      Get the next random number
+  */
+  std::uint32_t Next()
+  {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return static_cast<std::uint32_t>((state_ * 0x2545F4914F6CDD1DULL) >> 32);
+  }
+
+  /*
+      Get a random number in [0, bound). bound must not be 0
+  */
+  std::uint32_t NextBelow(std::uint32_t bound)
+  {
+    // Multiply and shift instead of modulo, it's faster and just as even
+    return static_cast<std::uint32_t>(
+        (static_cast<std::uint64_t>(Next()) * bound) >> 32);
+  }
+
+private:
+  std::uint64_t state_;
+
+  /*
+      Get a number no other generator has been seeded with
+  */
+  static std::uint64_t NextSeed()
+  {
+    static std::atomic<std::uint64_t> sSeedCounter(0);
+    return ++sSeedCounter;
+  }
+
+  /*
+      Spread the bits of a counter out into a good seed (splitmix64
+      finalizer). Never returns 0, which xorshift can't leave
+  */
+  static std::uint64_t Mix(std::uint64_t value)
+  {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    value = value ^ (value >> 31);
+    return (value != 0) ? value : 1;
+  }
+};
+}
+#endif
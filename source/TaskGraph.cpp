@@ -0,0 +1,128 @@
+/**************************************************************************
+    Contains implementation of TaskGraph
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <thread>
+
+#include "Manager.h"
+#include "TaskGraph.h"
+
+namespace JobBot
+{
+namespace
+{
+// Never actually run, only finished by the graph's nodes
+void GraphRunJobFunc(Job* job) { (void)job; }
+JobFunction GraphRunJob(GraphRunJobFunc);
+}
+
+TaskGraph::TaskGraph()
+    : runJob_(Job::Create(GraphRunJob, this)), manager_(nullptr),
+      finished_(true)
+{
+  runJob_->MakeReusable();
+  runJob_->SetCallback(JobFunction(RunFinished));
+}
+
+TaskGraph::~TaskGraph()
+{
+  Wait();
+
+  for (Job* job : jobs_)
+  {
+    job->ReleaseReusable();
+  }
+  runJob_->ReleaseReusable();
+}
+
+TaskGraph::Node TaskGraph::AddNode(const JobFunction& function)
+{
+  Job* job = Job::CreateChild(function, runJob_);
+  job->MakeReusable();
+
+  jobs_.push_back(job);
+  dependencyCounts_.push_back(0);
+
+  return static_cast<Node>(jobs_.size() - 1);
+}
+
+void TaskGraph::AddDependency(Node before, Node after)
+{
+  Job* beforeJob = jobs_[before];
+
+  Job::Successor edge = {
+      jobs_[after], beforeJob->successors_.load(std::memory_order_relaxed)};
+  edges_.push_back(edge);
+  beforeJob->successors_.store(&edges_.back(), std::memory_order_relaxed);
+
+  ++dependencyCounts_[after];
+}
+
+size_t TaskGraph::GetNodeCount() const { return jobs_.size(); }
+
+void TaskGraph::Run(Manager& manager)
+{
+  manager_ = &manager;
+
+  if (jobs_.empty()) return;
+
+  finished_ = false;
+
+  // Reset everything before anything starts, since nodes release each
+  // other as soon as they finish. The run job waits for every node plus
+  // the hold released below
+  runJob_->ResetForReuse(nullptr, 0, static_cast<int>(jobs_.size()) + 1);
+
+  roots_.clear();
+  for (size_t i = 0; i < jobs_.size(); ++i)
+  {
+    jobs_[i]->ResetForReuse(&manager, dependencyCounts_[i], 1);
+
+    if (dependencyCounts_[i] == 0)
+    {
+      roots_.push_back(jobs_[i]);
+    }
+  }
+
+  // Everything else is submitted by the nodes it depends on
+  manager.SubmitJobs(roots_.data(), roots_.size());
+
+  runJob_->Finish();
+}
+
+bool TaskGraph::IsFinished() const { return finished_; }
+
+void TaskGraph::Wait()
+{
+  Worker* worker =
+      (manager_ != nullptr) ? manager_->GetThisThreadsWorker() : nullptr;
+
+  if (worker != nullptr)
+  {
+    worker->WorkWhileWaitingFor(finished_);
+  }
+  else
+  {
+    while (!finished_)
+    {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TaskGraph::RunAndWait(Manager& manager)
+{
+  Run(manager);
+  Wait();
+}
+
+void TaskGraph::Cancel() { runJob_->Cancel(); }
+
+void TaskGraph::RunFinished(Job* job)
+{
+  job->GetData<TaskGraph*>()->finished_ = true;
+}
+}
@@ -0,0 +1,164 @@
+/**************************************************************************
+    Declaration of TaskGraph, a set of jobs and the dependencies between
+    them that is built once and run as many times as needed
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _TASKGRAPH_H
+#define _TASKGRAPH_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "Job.h"
+
+namespace JobBot
+{
+// Forward declaration
+class Manager;
+
+/*
+    A graph of jobs that can be run over and over, for work that has the
+    same shape every time (like a frame).
+
+    Each node is a job function with some data, and edges say which nodes
+    have to finish before others can start. The jobs for the nodes are
+    made when the graph is built and kept for the life of the graph, so
+    running it again only has to reset a few counters rather than creating
+    and linking up every job from scratch.
+
+    Node data can be changed between runs with GetData.
+
+    Usage:
+      TaskGraph graph;
+      TaskGraph::Node a = graph.AddNode(UpdateJob, &world);
+      TaskGraph::Node b = graph.AddNode(RenderJob, &world);
+      graph.AddDependency(a, b);
+
+      every frame:
+        graph.RunAndWait(manager);
+*/
+class TaskGraph
+{
+public:
+  // Identifies a node within its graph
+  typedef std::uint32_t Node;
+
+  TaskGraph();
+
+  /*
+      Waits for any run in progress to finish, then gives all of the
+      graph's jobs back to the pool
+  */
+  ~TaskGraph();
+
+  /*
+      Graphs own their jobs, so can't be copied
+  */
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  /*
+      Add a node that runs the given function
+
+      Nodes can create and submit child jobs while they run like any other
+      job, and are only finished once those children are
+  */
+  Node AddNode(const JobFunction& function);
+
+  /*
+      Add a node that runs the given function with some data
+  */
+  template <typename T>
+  Node AddNode(const JobFunction& function, const T& data);
+
+  /*
+      Make after wait for before to finish every time the graph is run.
+      The graph must not have any cycles, or it will never finish
+  */
+  void AddDependency(Node before, Node after);
+
+  /*
+      Get the data of a node, to read it or change it for the next run.
+      Must not be used on a node that is running
+  */
+  template <typename T> T& GetData(Node node);
+
+  /*
+      Number of nodes in the graph
+  */
+  size_t GetNodeCount() const;
+
+  /*
+      Start running the graph on the given manager's workers
+
+      The graph must not be changed or run again until this run has
+      finished
+  */
+  void Run(Manager& manager);
+
+  /*
+      Has the last run finished
+  */
+  bool IsFinished() const;
+
+  /*
+      Wait for the last run to finish. Works on other jobs while waiting if
+      this thread is one of the manager's workers
+  */
+  void Wait();
+
+  /*
+      Run the graph and wait for it to finish
+  */
+  void RunAndWait(Manager& manager);
+
+  /*
+      Skip every node of the current run that hasn't started yet
+  */
+  void Cancel();
+
+private:
+  // Job for each node
+  std::vector<Job*> jobs_;
+  // Number of dependencies each node has
+  std::vector<std::uint32_t> dependencyCounts_;
+  // Links from each node to the nodes that depend on it. A deque so
+  // pointers into it stay valid as it grows
+  std::deque<Job::Successor> edges_;
+  // Nodes with no dependencies, handed to the manager at the start of a run
+  std::vector<Job*> roots_;
+
+  // Parent of every node, finishes once all of them have for this run
+  Job* runJob_;
+  // Manager of the current or last run
+  Manager* manager_;
+  // If the last run has finished
+  std::atomic_bool finished_;
+
+  /*
+      Callback of runJob_, marks the run as finished
+  */
+  static void RunFinished(Job* job);
+};
+
+template <typename T>
+inline TaskGraph::Node TaskGraph::AddNode(const JobFunction& function,
+                                          const T& data)
+{
+  Node node = AddNode(function);
+  jobs_[node]->SetData<T>(data);
+  return node;
+}
+
+template <typename T> inline T& TaskGraph::GetData(Node node)
+{
+  return jobs_[node]->GetData<T>();
+}
+}
+#endif
@@ -0,0 +1,369 @@
+/**************************************************************************
+    Contains implementation of TimerWheel
+
+    Author:
+    Jake McLeman
+***************************************************************************/
+
+#include <assert.h>
+
+#include "TimerWheel.h"
+
+namespace JobBot
+{
+// need a definition
+constexpr std::uint64_t TimerWheel::scTickLength;
+constexpr size_t TimerWheel::scSlotsPerLevel;
+constexpr size_t TimerWheel::scNumLevels;
+
+TimerWheel::TimerWheel()
+    : start_(std::chrono::steady_clock::now()), slots_(), currentTick_(0),
+      count_(0), nextID_(1), nextDue_(scNeverDue_), timerCount_(0)
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+  for (auto& level : slots_)
+  {
+    for (Timer* timer : level)
+    {
+      while (timer != nullptr)
+      {
+        Timer* next = timer->next;
+        delete timer;
+        timer = next;
+      }
+    }
+  }
+}
+
+TimerWheel::TimerID TimerWheel::Add(Job* job, std::chrono::microseconds delay,
+                                    bool& earliest)
+{
+  if (delay.count() < 0) delay = std::chrono::microseconds::zero();
+
+  Timer* timer  = new Timer();
+  timer->due    = GetTime() + static_cast<std::uint64_t>(delay.count());
+  timer->period = 0;
+  timer->job    = job;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Schedule(timer, earliest);
+}
+
+TimerWheel::TimerID
+TimerWheel::AddPeriodic(std::function<Job*()> makeJob,
+                        std::chrono::microseconds period, bool& earliest)
+{
+  // Anything shorter than a tick would go off every time the wheel is
+  // looked at anyway
+  std::uint64_t length = static_cast<std::uint64_t>(
+      (period.count() > 0) ? period.count() : 0);
+  if (length < scTickLength) length = scTickLength;
+
+  Timer* timer   = new Timer();
+  timer->due     = GetTime() + length;
+  timer->period  = length;
+  timer->job     = nullptr;
+  timer->makeJob = std::move(makeJob);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Schedule(timer, earliest);
+}
+
+bool TimerWheel::Cancel(TimerID id, Job*& job)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto found = timers_.find(id);
+  if (found == timers_.end()) return false;
+
+  // Finding the timer's slot would mean searching it, so leave the timer
+  // there to be thrown away when the slot comes up
+  Timer* timer     = found->second;
+  timer->cancelled = true;
+  job              = timer->job;
+  timer->job       = nullptr;
+
+  timers_.erase(found);
+  timerCount_.store(timers_.size(), std::memory_order_relaxed);
+  return true;
+}
+
+void TimerWheel::Clear(std::vector<Job*>& jobs)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto& level : slots_)
+  {
+    for (Timer*& slot : level)
+    {
+      while (slot != nullptr)
+      {
+        Timer* timer = slot;
+        slot         = timer->next;
+
+        if (!timer->cancelled && timer->job != nullptr)
+        {
+          jobs.push_back(timer->job);
+        }
+        delete timer;
+      }
+    }
+  }
+
+  count_ = 0;
+  timers_.clear();
+  timerCount_.store(0, std::memory_order_relaxed);
+  UpdateNextDue();
+}
+
+void TimerWheel::Expire(std::vector<Job*>& jobs)
+{
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+
+  const std::uint64_t now    = GetTime();
+  const std::uint64_t target = now / scTickLength;
+
+  // Timers that went off, in the order they were due
+  Timer* expired     = nullptr;
+  Timer** expiredEnd = &expired;
+
+  while (currentTick_ < target)
+  {
+    // Nothing to go off, so the wheel can jump straight there
+    if (count_ == 0)
+    {
+      currentTick_ = target;
+      break;
+    }
+
+    ++currentTick_;
+
+    // When a level wraps back around to its first slot, the next slot of
+    // the level above is now in reach. Highest level first, since its
+    // timers may land in the slot of a lower level that is about to be
+    // cascaded
+    size_t wrapped = 0;
+    while (wrapped + 1 < scNumLevels &&
+           (currentTick_ &
+            ((std::uint64_t(1) << (scSlotBits_ * (wrapped + 1))) - 1)) == 0)
+    {
+      ++wrapped;
+    }
+    for (size_t level = wrapped; level > 0; --level)
+    {
+      Cascade(level);
+    }
+
+    Timer*& slot = slots_[0][currentTick_ & (scSlotsPerLevel - 1)];
+    while (slot != nullptr)
+    {
+      Timer* timer = slot;
+      slot         = timer->next;
+      --count_;
+
+      timer->next = nullptr;
+      *expiredEnd = timer;
+      expiredEnd  = &timer->next;
+    }
+  }
+
+  // Periodic timers that went off, which stay in timers_ so they can still
+  // be cancelled while their jobs are being made
+  Timer* firing = nullptr;
+
+  while (expired != nullptr)
+  {
+    Timer* timer = expired;
+    expired      = timer->next;
+
+    if (timer->cancelled)
+    {
+      delete timer;
+    }
+    else if (timer->period == 0)
+    {
+      jobs.push_back(timer->job);
+      timers_.erase(timer->id);
+      delete timer;
+    }
+    else
+    {
+      timer->next = firing;
+      firing      = timer;
+    }
+  }
+
+  timerCount_.store(timers_.size(), std::memory_order_relaxed);
+  UpdateNextDue();
+
+  if (firing == nullptr) return;
+
+  // Making jobs is up to the user, who may well add timers while doing so
+  lock.unlock();
+  for (Timer* timer = firing; timer != nullptr; timer = timer->next)
+  {
+    Job* job = timer->makeJob();
+    if (job != nullptr)
+    {
+      jobs.push_back(job);
+    }
+  }
+  lock.lock();
+
+  while (firing != nullptr)
+  {
+    Timer* timer = firing;
+    firing       = timer->next;
+
+    if (timer->cancelled)
+    {
+      delete timer;
+      continue;
+    }
+
+    // Stay on schedule, unless a whole run was missed
+    timer->due += timer->period;
+    if (timer->due <= now)
+    {
+      timer->due = now + timer->period;
+    }
+    Insert(timer, currentTick_ + 1);
+  }
+
+  UpdateNextDue();
+}
+
+bool TimerWheel::IsDue() const
+{
+  const std::uint64_t nextDue = nextDue_.load(std::memory_order_relaxed);
+  return nextDue != scNeverDue_ && GetTime() / scTickLength >= nextDue;
+}
+
+std::chrono::microseconds TimerWheel::GetTimeUntilDue() const
+{
+  const std::uint64_t nextDue = nextDue_.load(std::memory_order_relaxed);
+  if (nextDue == scNeverDue_) return std::chrono::microseconds::max();
+
+  const std::uint64_t due = nextDue * scTickLength;
+  const std::uint64_t now = GetTime();
+  return std::chrono::microseconds((due > now) ? due - now : 0);
+}
+
+size_t TimerWheel::GetTimerCount() const
+{
+  return timerCount_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t TimerWheel::GetTime() const
+{
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_)
+          .count());
+}
+
+TimerWheel::TimerID TimerWheel::Schedule(Timer* timer, bool& earliest)
+{
+  timer->id        = nextID_++;
+  timer->cancelled = false;
+  timers_[timer->id] = timer;
+
+  const std::uint64_t lastDue = nextDue_.load(std::memory_order_relaxed);
+  Insert(timer, currentTick_ + 1);
+  UpdateNextDue();
+  earliest = nextDue_.load(std::memory_order_relaxed) < lastDue;
+
+  timerCount_.store(timers_.size(), std::memory_order_relaxed);
+  return timer->id;
+}
+
+void TimerWheel::Insert(Timer* timer, std::uint64_t soonest)
+{
+  // Rounded up, so timers never go off early
+  std::uint64_t tick = (timer->due + scTickLength - 1) / scTickLength;
+  if (tick < soonest) tick = soonest;
+
+  const std::uint64_t delta = tick - currentTick_;
+
+  size_t level = 0;
+  while (level + 1 < scNumLevels &&
+         delta >= (std::uint64_t(1) << (scSlotBits_ * (level + 1))))
+  {
+    ++level;
+  }
+
+  // Too far out for even the last level, so wait at the far end of it
+  // and be cascaded down again from there
+  const std::uint64_t reach = std::uint64_t(1)
+                              << (scSlotBits_ * scNumLevels);
+  if (delta >= reach)
+  {
+    tick = currentTick_ + reach - 1;
+  }
+
+  Timer*& slot =
+      slots_[level][(tick >> (scSlotBits_ * level)) & (scSlotsPerLevel - 1)];
+  timer->next = slot;
+  slot        = timer;
+  ++count_;
+}
+
+void TimerWheel::Cascade(size_t level)
+{
+  assert(level > 0 && level < scNumLevels);
+
+  Timer*& slot = slots_[level][(currentTick_ >> (scSlotBits_ * level)) &
+                               (scSlotsPerLevel - 1)];
+  Timer* timer = slot;
+  slot         = nullptr;
+
+  while (timer != nullptr)
+  {
+    Timer* next = timer->next;
+    --count_;
+
+    if (timer->cancelled)
+    {
+      delete timer;
+    }
+    else
+    {
+      // Anything due on this very tick goes in the slot about to expire
+      Insert(timer, currentTick_);
+    }
+    timer = next;
+  }
+}
+
+void TimerWheel::UpdateNextDue()
+{
+  std::uint64_t nextDue = scNeverDue_;
+
+  if (count_ != 0)
+  {
+    // The first level holds the ticks right after this one
+    for (std::uint64_t tick = currentTick_ + 1;
+         tick < currentTick_ + scSlotsPerLevel; ++tick)
+    {
+      if (slots_[0][tick & (scSlotsPerLevel - 1)] != nullptr)
+      {
+        nextDue = tick;
+        break;
+      }
+    }
+
+    // Otherwise everything is further out, so come back when the first
+    // level wraps around and brings some of it closer
+    if (nextDue == scNeverDue_)
+    {
+      nextDue = ((currentTick_ >> scSlotBits_) + 1) << scSlotBits_;
+    }
+  }
+
+  nextDue_.store(nextDue, std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,206 @@
+/**************************************************************************
+    Declaration of TimerWheel, which holds on to jobs until it is time for
+    them to be submitted
+
+    Author:
+    Jake McLeman
+
+    All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
+***************************************************************************/
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace JobBot
+{
+// Forward Declarations
+class Job;
+
+/*
+    Hierarchical timer wheel (Varghese and Lauck 1987) for delayed and
+    periodic jobs.
+
+    Time is cut into ticks of scTickLength microseconds. The first level has
+    a slot for each of the next scSlotsPerLevel ticks, and each level after
+    that has slots covering scSlotsPerLevel times as many ticks as the one
+    below. Adding or cancelling a timer is constant time no matter how many
+    there are, and when the first level comes back around to its first slot
+    the timers in the matching slot of the next level are spread out over
+    the level below.
+
+    The wheel has no thread of its own. Whoever calls Expire moves it up to
+    the current time and gets back the jobs that are due, so timers are
+    only as punctual as the calls to Expire. Timers never go off early.
+*/
+class TimerWheel
+{
+public:
+  // Identifies a timer for cancelling it. 0 is never a timer
+  typedef std::uint64_t TimerID;
+
+  // Microseconds in each tick of the wheel
+  static constexpr std::uint64_t scTickLength = 256;
+  // Number of slots in each level of the wheel
+  static constexpr size_t scSlotsPerLevel = 64;
+  // Number of levels. Anything further out than the last level reaches
+  // (about 71 minutes) waits in the last level until it is in reach
+  static constexpr size_t scNumLevels = 4;
+
+  TimerWheel();
+
+  /*
+      Throws away every timer still waiting, without submitting any jobs
+  */
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  /*
+      Hold on to a job until delay has passed
+
+      earliest - set to true if this is now the first timer due, so
+                 whoever is waiting on the wheel needs to know
+  */
+  TimerID Add(Job* job, std::chrono::microseconds delay, bool& earliest);
+
+  /*
+      Make a job with makeJob every period, starting one period from now,
+      until the timer is cancelled. A run that is missed by more than a
+      whole period is skipped rather than made up
+
+      earliest - set to true if this is now the first timer due
+  */
+  TimerID AddPeriodic(std::function<Job*()> makeJob,
+                      std::chrono::microseconds period, bool& earliest);
+
+  /*
+      Stop a timer from going off
+
+      job - set to the job the timer was holding, which the caller is now
+            responsible for, or nullptr for periodic timers
+
+      Returns false if there was no such timer, or it already went off
+  */
+  bool Cancel(TimerID id, Job*& job);
+
+  /*
+      Throw away every timer, due or not, handing back the jobs the ones
+      that only go off once were holding. Must not be called while Expire
+      is being called
+
+      jobs - where the jobs that were being held are added
+  */
+  void Clear(std::vector<Job*>& jobs);
+
+  /*
+      Take the jobs of every timer that is due, making new jobs for the
+      periodic ones. Does nothing if another thread is already doing it
+
+      jobs - where the jobs that are due are added
+  */
+  void Expire(std::vector<Job*>& jobs);
+
+  /*
+      Is a timer due, so Expire has something to do. Only reads the clock
+      if there are any timers
+  */
+  bool IsDue() const;
+
+  /*
+      Get how long until Expire next needs to be called, or
+      microseconds::max() if there are no timers. Zero if it is overdue
+  */
+  std::chrono::microseconds GetTimeUntilDue() const;
+
+  /*
+      Number of timers waiting to go off
+  */
+  size_t GetTimerCount() const;
+
+private:
+  struct Timer
+  {
+    // Microseconds after the wheel started that the timer is due
+    std::uint64_t due;
+    // Microseconds between runs, or 0 for timers that only go off once
+    std::uint64_t period;
+    // Job to submit for timers that only go off once
+    Job* job;
+    // Makes the job for each run of a periodic timer
+    std::function<Job*()> makeJob;
+    TimerID id;
+    // Cancelled timers are left where they are until their slot comes up
+    bool cancelled;
+    // Next timer in the same slot
+    Timer* next;
+  };
+
+  // Bits of a tick used to pick the slot in each level
+  static constexpr unsigned scSlotBits_ = 6;
+  static_assert((1u << scSlotBits_) == scSlotsPerLevel,
+                "scSlotBits_ must match scSlotsPerLevel");
+
+  // nextDue_ when there are no timers
+  static constexpr std::uint64_t scNeverDue_ = ~std::uint64_t(0);
+
+  /*
+      Get the microseconds since the wheel was made
+  */
+  std::uint64_t GetTime() const;
+
+  /*
+      Add a timer with its id and due time filled in. Must hold the lock
+  */
+  TimerID Schedule(Timer* timer, bool& earliest);
+
+  /*
+      Put a timer in the slot for when it is due. Must hold the lock
+
+      soonest - earliest tick the timer can go off on. Timers that are
+                already due go off then
+  */
+  void Insert(Timer* timer, std::uint64_t soonest);
+
+  /*
+      Put every timer in a slot of a higher level in the levels below, now
+      that they are closer. Must hold the lock
+  */
+  void Cascade(size_t level);
+
+  /*
+      Work out when Expire next needs to be called. Must hold the lock
+  */
+  void UpdateNextDue();
+
+  // When the wheel was made, which times in the wheel are measured from
+  const std::chrono::steady_clock::time_point start_;
+
+  // Timers in each slot of each level, in no particular order
+  Timer* slots_[scNumLevels][scSlotsPerLevel];
+  // Every tick up to and including this one has been expired
+  std::uint64_t currentTick_;
+  // Number of timers in slots_, counting cancelled ones
+  size_t count_;
+  // Timers that haven't gone off or been cancelled, by id
+  std::unordered_map<TimerID, Timer*> timers_;
+  // Id to give the next timer
+  TimerID nextID_;
+  // Protects everything above
+  mutable std::mutex mutex_;
+
+  // Tick at which Expire next has something to do, or scNeverDue_
+  std::atomic<std::uint64_t> nextDue_;
+  // Copy of timers_.size() for reading without the lock
+  std::atomic_size_t timerCount_;
+};
+}
+#endif
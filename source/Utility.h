@@ -48,7 +48,22 @@ public:
                              ParallelForJobFunction<T> function, T* data,
                              size_t size, size_t chunkSize);
 
+  /*
+      Creates a parallel for job that submits its chunks in batches
+
+      Works the same as ParallelForJob, but the chunk jobs are handed to the
+      manager with SubmitJobs, which is much cheaper when there are lots of
+      chunks
+  */
+  template <typename T>
+  static Job* ParallelForBulkJob(Manager* manager,
+                                 ParallelForJobFunction<T> function, T* data,
+                                 size_t size, size_t chunkSize);
+
 private:
+  // Number of chunk jobs the bulk splitter submits at once
+  static constexpr size_t scBulkSubmitSize = 64;
+
   /*
       Data for the job that does the splitting into jobs
   */
@@ -77,6 +92,11 @@ private:
   */
   template <typename T> static void ParallelForSplitterFunction(Job* job);
 
+  /*
+      Job function to split off all the jobs, submitting them in batches
+  */
+  template <typename T> static void ParallelForBulkSplitterFunction(Job* job);
+
   /*
       Job function that hands of the call to the tidier interface
       of the users ParallelForJobFunction
@@ -117,6 +137,51 @@ inline void Utilities::ParallelForSplitterFunction(Job* job)
   job->SetAllowCompletion(true);
 }
 
+template <typename T>
+inline Job* Utilities::ParallelForBulkJob(Manager* manager,
+                                          ParallelForJobFunction<T> function,
+                                          T* data, size_t size,
+                                          size_t chunkSize)
+{
+  ParallelForSplitterData<T> splitterData = {function, data, size, chunkSize,
+                                             manager};
+  return Job::Create<ParallelForSplitterData<T>>(
+      ParallelForBulkSplitterFunction<T>, splitterData);
+}
+
+template <typename T>
+inline void Utilities::ParallelForBulkSplitterFunction(Job* job)
+{
+  ParallelForSplitterData<T>& jobData =
+      job->GetData<ParallelForSplitterData<T>>();
+
+  Job* batch[scBulkSubmitSize];
+  size_t batchCount = 0;
+
+  job->SetAllowCompletion(false);
+
+  for (size_t i = 0; i < jobData.size; i += jobData.chunkSize)
+  {
+    // Create data for a parallel for job
+    ParallelForJobData<T> data = {
+        jobData.function, jobData.data + i,
+        std::min(jobData.chunkSize, jobData.size - i)};
+    batch[batchCount++] =
+        Job::CreateChild<ParallelForJobData<T>>(ParallelForJob<T>, data, job);
+
+    // Send a full batch to the manager
+    if (batchCount == scBulkSubmitSize)
+    {
+      jobData.manager->SubmitJobs(batch, batchCount);
+      batchCount = 0;
+    }
+  }
+
+  jobData.manager->SubmitJobs(batch, batchCount);
+
+  job->SetAllowCompletion(true);
+}
+
 template <typename T> inline void Utilities::ParallelForJob(Job* job)
 {
   ParallelForJobData<T>& data = job->GetData<ParallelForJobData<T>>();
@@ -125,3 +190,4 @@ template <typename T> inline void Utilities::ParallelForJob(Job* job)
   data.function(job, data.data, data.size);
 }
 }
+#endif
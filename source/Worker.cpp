@@ -10,6 +10,10 @@
 #ifdef _DEBUG
 #include <assert.h>
 #endif
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) ||         \
+    defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 #include "Job.h"
 #include "JobExceptions.h"
@@ -18,27 +22,188 @@
 
 namespace JobBot
 {
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/*
+    Tell the CPU this is a spin loop, so it can save power and give the
+    other hyperthread on the core more of a chance to run
+*/
+inline void CpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) ||         \
+    defined(_M_X64)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Checks for the things a worker can wait on
+
+bool IsJobFinished(const void* job)
+{
+  return static_cast<const Job*>(job)->IsFinished();
+}
+
+bool IsHandleFinished(const void* handle)
+{
+  return static_cast<const JobHandle*>(handle)->IsFinished();
+}
+
+bool IsConditionSet(const void* condition)
+{
+  return *static_cast<const std::atomic_bool*>(condition);
+}
+}
+
+thread_local Worker* Worker::tThreadsWorkers_ = nullptr;
+
 Worker::Worker(Manager* aManager, Mode aMode,
-               const Specialization& aSpecialization)
+               const Specialization& aSpecialization,
+               const IdlePolicy& aIdlePolicy,
+               FiberStackPool* aFiberStacks)
     : manager_(aManager), workerMode_(aMode),
       workerSpecialization_(aSpecialization),
       threadID_(std::this_thread::get_id()), keepWorking_(false),
-      isWorking_(false)
+      isWorking_(false), sleeping_(false), sleepingWhileWaiting_(false),
+      nextOnThread_(tThreadsWorkers_),
+      idlePolicy_(aIdlePolicy), idleSteps_(0), acceptedClasses_(~0u),
+      requestsUntilAging_(1), deadlineJobs_(0), missedDeadlines_(0),
+      totalLateness_(0), maxLateness_(0), fiberStacks_(aFiberStacks),
+      threadFiber_(nullptr), currentFiber_(nullptr), waitDone_(nullptr),
+      waitingFor_(nullptr)
+{
+  // Workers are always made on the thread they will work on
+  tThreadsWorkers_ = this;
+
+  for (auto& queues : localJobs_)
+  {
+    for (JobDeque*& queue : queues)
+    {
+      queue = new JobDeque(scLocalQueueCapacity_);
+    }
+  }
+
+  for (size_t i = 0; i < NumIdlePhases; ++i)
+  {
+    idleCounts_[i].store(0, std::memory_order_relaxed);
+    idleTimes_[i].store(0, std::memory_order_relaxed);
+  }
+
+  for (unsigned i = 0; i < Job::NUM_PRIORITIES; ++i)
+  {
+    timedJobs_[i].store(0, std::memory_order_relaxed);
+    totalWaits_[i].store(0, std::memory_order_relaxed);
+    maxWaits_[i].store(0, std::memory_order_relaxed);
+    agedJobs_[i].store(0, std::memory_order_relaxed);
+  }
+
+  if (fiberStacks_ != nullptr)
+  {
+    threadFiber_  = new Fiber();
+    currentFiber_ = threadFiber_;
+  }
+}
+
+Worker::~Worker()
 {
+  // Primary workers have already left their thread by the time they are
+  // deleted, but volunteers are deleted on their own thread
+  if (threadID_ == std::this_thread::get_id())
+  {
+    LeaveThread();
+  }
+
+  for (auto& queues : localJobs_)
+  {
+    for (JobDeque* queue : queues)
+    {
+      delete queue;
+    }
+  }
+
+  // Fibers are drained before the worker stops, so by now every other fiber
+  // is idle between jobs
+  for (Fiber* fiber : fibers_)
+  {
+    fiberStacks_->Free(fiber->GetStack());
+    delete fiber;
+  }
+  delete threadFiber_;
 }
 
 Worker::Specialization Worker::Specialization::None = {
     {JobType::Huge, JobType::Graphics, JobType::Misc, JobType::IO,
-     JobType::Tiny}};
+     JobType::Tiny},
+    false};
 Worker::Specialization Worker::Specialization::IO = {
     {JobType::IO, JobType::Huge, JobType::Misc, JobType::Graphics,
-     JobType::Tiny}};
+     JobType::Tiny},
+    false};
 Worker::Specialization Worker::Specialization::Graphics = {
     {JobType::Graphics, JobType::Tiny, JobType::Misc, JobType::Null,
-     JobType::Null}};
+     JobType::Null},
+    true};
 Worker::Specialization Worker::Specialization::RealTime = {
     {JobType::Tiny, JobType::Misc, JobType::Graphics, JobType::Null,
-     JobType::Null}};
+     JobType::Null},
+    true};
+
+const Worker::IdlePolicy Worker::IdlePolicy::LowLatency = {
+    256, 64, 4096, std::chrono::microseconds(20),
+    std::chrono::microseconds(200)};
+const Worker::IdlePolicy Worker::IdlePolicy::Balanced = {
+    32, 32, 16, std::chrono::microseconds(50), std::chrono::microseconds(1000)};
+const Worker::IdlePolicy Worker::IdlePolicy::PowerSaving = {
+    0, 1, 0, std::chrono::microseconds(100), std::chrono::microseconds(4000)};
+
+Worker::IdleStats& Worker::IdleStats::operator+=(const IdleStats& other)
+{
+  spinCount += other.spinCount;
+  yieldCount += other.yieldCount;
+  parkCount += other.parkCount;
+  spinTime += other.spinTime;
+  yieldTime += other.yieldTime;
+  parkTime += other.parkTime;
+  return *this;
+}
+
+Worker::PriorityStats& Worker::PriorityStats::
+operator+=(const PriorityStats& other)
+{
+  for (unsigned i = 0; i < Job::NUM_PRIORITIES; ++i)
+  {
+    timedJobs[i] += other.timedJobs[i];
+    totalWait[i] += other.totalWait[i];
+    maxWait[i] = std::max(maxWait[i], other.maxWait[i]);
+    agedJobs[i] += other.agedJobs[i];
+  }
+  return *this;
+}
+
+Worker::DeadlineStats& Worker::DeadlineStats::
+operator+=(const DeadlineStats& other)
+{
+  deadlineJobs += other.deadlineJobs;
+  missedDeadlines += other.missedDeadlines;
+  totalLateness += other.totalLateness;
+  maxLateness = std::max(maxLateness, other.maxLateness);
+  return *this;
+}
+
+bool Worker::Specialization::Accepts(JobType type) const
+{
+  if (type == JobType::Important) return true;
+
+  for (JobType accepted : priorities)
+  {
+    if (accepted == type) return true;
+  }
+
+  return false;
+}
 
 void Worker::WorkWhileWaitingFor(Job* aWaitJob)
 {
@@ -47,14 +212,27 @@ void Worker::WorkWhileWaitingFor(Job* aWaitJob)
 
   aWaitJob->SetAllowCompletion(false);
 
-  while (!aWaitJob->IsFinished())
-  {
-    DoSingleJob();
-  }
+  WaitUntil(&IsJobFinished, aWaitJob);
 
+  // The job is still being held open, so its handle is still current
+  JobHandle handle = aWaitJob->GetHandle();
   aWaitJob->SetAllowCompletion(true);
 
   isWorking_ = wasWorking;
+
+  JobErrors::RethrowIfFailed(handle);
+}
+
+void Worker::WorkWhileWaitingFor(const JobHandle& handle)
+{
+  bool wasWorking = isWorking_;
+  isWorking_      = true;
+
+  WaitUntil(&IsHandleFinished, &handle);
+
+  isWorking_ = wasWorking;
+
+  JobErrors::RethrowIfFailed(handle);
 }
 
 void Worker::WorkWhileWaitingFor(std::atomic_bool& condition)
@@ -62,10 +240,7 @@ void Worker::WorkWhileWaitingFor(std::atomic_bool& condition)
   bool wasWorking = isWorking_;
   isWorking_      = true;
 
-  while (!condition)
-  {
-    DoSingleJob();
-  }
+  WaitUntil(&IsConditionSet, &condition);
 
   isWorking_ = wasWorking;
 }
@@ -80,8 +255,20 @@ void Worker::Stop()
 {
   keepWorking_ = false;
 
+  // A volunteer stopping itself is the last chance for its fibers that are
+  // still waiting to finish their jobs
+  if (threadID_ == std::this_thread::get_id())
+  {
+    DrainFibers();
+  }
+
+  // Wake the worker if it is asleep so it can see it has been stopped
+  manager_->WakeWorker(*this);
+
   while (isWorking_)
-    ;
+  {
+    std::this_thread::yield();
+  }
 }
 
 void Worker::StopAfterCurrentTask() { keepWorking_ = false; }
@@ -92,46 +279,479 @@ std::thread::id Worker::GetThreadID() const { return threadID_; }
 
 bool Worker::IsWorking() const { return isWorking_; }
 
+bool Worker::UsesFibers() const { return fiberStacks_ != nullptr; }
+
+const Worker::Specialization& Worker::GetSpecialization() const
+{
+  return workerSpecialization_;
+}
+
+bool Worker::PushLocalJob(Job* job)
+{
+  if (workerMode_ == Mode::Compensating) return false;
+
+  return localJobs_[static_cast<size_t>(job->GetType())][job->GetPriority()]
+      ->Push(job);
+}
+
+Job* Worker::PopLocalJob(JobType type, unsigned priority)
+{
+  JobDeque* queue = localJobs_[static_cast<size_t>(type)][priority];
+
+  // Popping from an empty deque still costs a fence, and most of them are
+  // empty most of the time
+  return queue->Empty() ? nullptr : queue->Pop();
+}
+
+Job* Worker::StealLocalJob(JobType type, unsigned priority)
+{
+  return localJobs_[static_cast<size_t>(type)][priority]->Steal();
+}
+
+size_t Worker::GetLocalJobCount() const
+{
+  size_t count = 0;
+  for (const auto& queues : localJobs_)
+  {
+    for (const JobDeque* queue : queues)
+    {
+      count += queue->Size();
+    }
+  }
+  return count;
+}
+
+size_t Worker::GetLocalJobCount(JobType type) const
+{
+  size_t count = 0;
+  for (const JobDeque* queue : localJobs_[static_cast<size_t>(type)])
+  {
+    count += queue->Size();
+  }
+  return count;
+}
+
+size_t Worker::GetLocalJobCount(JobType type, unsigned priority) const
+{
+  return localJobs_[static_cast<size_t>(type)][priority]->Size();
+}
+
+XorShift& Worker::GetRandom() { return random_; }
+
+Worker* Worker::GetThisThreadsWorker(const Manager* manager)
+{
+  for (Worker* worker = tThreadsWorkers_; worker != nullptr;
+       worker         = worker->nextOnThread_)
+  {
+    if (worker->manager_ == manager)
+    {
+      return worker;
+    }
+  }
+
+  return nullptr;
+}
+
+Worker* Worker::GetThisThreadsWorker() { return tThreadsWorkers_; }
+
+Manager* Worker::GetManager() const { return manager_; }
+
+void Worker::LeaveThread()
+{
+  for (Worker** link = &tThreadsWorkers_; *link != nullptr;
+       link          = &(*link)->nextOnThread_)
+  {
+    if (*link == this)
+    {
+      *link = nextOnThread_;
+      return;
+    }
+  }
+}
+
+const Worker::IdlePolicy& Worker::GetIdlePolicy() const { return idlePolicy_; }
+
+Worker::IdleStats Worker::GetIdleStats() const
+{
+  IdleStats stats;
+  stats.spinCount  = idleCounts_[Spin].load(std::memory_order_relaxed);
+  stats.yieldCount = idleCounts_[Yield].load(std::memory_order_relaxed);
+  stats.parkCount  = idleCounts_[Park].load(std::memory_order_relaxed);
+  stats.spinTime   = idleTimes_[Spin].load(std::memory_order_relaxed);
+  stats.yieldTime  = idleTimes_[Yield].load(std::memory_order_relaxed);
+  stats.parkTime   = idleTimes_[Park].load(std::memory_order_relaxed);
+  return stats;
+}
+
+Worker::PriorityStats Worker::GetPriorityStats() const
+{
+  PriorityStats stats;
+  for (unsigned i = 0; i < Job::NUM_PRIORITIES; ++i)
+  {
+    stats.timedJobs[i] = timedJobs_[i].load(std::memory_order_relaxed);
+    stats.totalWait[i] = totalWaits_[i].load(std::memory_order_relaxed);
+    stats.maxWait[i]   = maxWaits_[i].load(std::memory_order_relaxed);
+    stats.agedJobs[i]  = agedJobs_[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void Worker::CountJob(unsigned priority, std::uint32_t wait, bool timed,
+                      bool aged)
+{
+  // Only this worker writes these, so there is no need for locked adds
+  if (timed)
+  {
+    timedJobs_[priority].store(
+        timedJobs_[priority].load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    totalWaits_[priority].store(
+        totalWaits_[priority].load(std::memory_order_relaxed) + wait,
+        std::memory_order_relaxed);
+    if (wait > maxWaits_[priority].load(std::memory_order_relaxed))
+    {
+      maxWaits_[priority].store(wait, std::memory_order_relaxed);
+    }
+  }
+
+  if (aged)
+  {
+    agedJobs_[priority].store(
+        agedJobs_[priority].load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+  }
+}
+
+Worker::DeadlineStats Worker::GetDeadlineStats() const
+{
+  DeadlineStats stats;
+  stats.deadlineJobs    = deadlineJobs_.load(std::memory_order_relaxed);
+  stats.missedDeadlines = missedDeadlines_.load(std::memory_order_relaxed);
+  stats.totalLateness   = totalLateness_.load(std::memory_order_relaxed);
+  stats.maxLateness     = maxLateness_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void Worker::CountDeadline(std::uint32_t deadline)
+{
+  // Only this worker writes these, so there is no need for locked adds
+  deadlineJobs_.store(deadlineJobs_.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+
+  const std::int32_t lateness =
+      static_cast<std::int32_t>(Manager::GetTicks() - deadline);
+  if (lateness <= 0) return;
+
+  missedDeadlines_.store(missedDeadlines_.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+  totalLateness_.store(totalLateness_.load(std::memory_order_relaxed) +
+                           static_cast<std::uint64_t>(lateness),
+                       std::memory_order_relaxed);
+  if (static_cast<std::uint64_t>(lateness) >
+      maxLateness_.load(std::memory_order_relaxed))
+  {
+    maxLateness_.store(static_cast<std::uint64_t>(lateness),
+                       std::memory_order_relaxed);
+  }
+}
+
 void Worker::DoWork()
 {
   isWorking_ = true;
 
+  if (fiberStacks_ != nullptr)
+  {
+    // Run every job on a fiber, so even the first one to wait can be put
+    // aside. This only comes back once the worker is stopped
+    WaitUntil(&IsStopped, this);
+    DrainFibers();
+  }
+
   while (keepWorking_)
   {
-    DoSingleJob();
+    DoSingleJob(false);
   }
 
+  // The manager may delete this worker as soon as it stops working, so
+  // get off the thread's list first
+  LeaveThread();
+
   isWorking_ = false;
 }
 
-void Worker::DoSingleJob()
+void Worker::DoSingleJob(bool waiting)
 {
-  static std::mutex waitMutex;
   Job* job = GetAJob();
 
+  // If no job was found by any method, be a good citizen and step aside
+  // so that other processes on CPU can happen
+  if (job == nullptr)
+  {
+    job = Idle(waiting);
+  }
+
 #ifdef _DEBUG
   if (job != nullptr && job->GetUnfinishedJobCount() > 0)
 #else
   if (job != nullptr)
 #endif
   {
+    idleSteps_ = 0;
+
+    // The job can be reused as soon as it has run, so look first
+    const std::uint32_t deadline = job->deadline_;
+    const bool blocking          = job->IsBlocking();
+
+    // Blocking jobs leave the core idle, so have another worker use it in
+    // the meantime
+    if (blocking)
+    {
+      manager_->BeginBlocking();
+    }
+
     job->Run();
+
+    // Whoever is waiting on this job, or anything it finished, can go
+    manager_->WakeWaiters();
+
+    if (blocking)
+    {
+      manager_->EndBlocking();
+    }
+
+    if (deadline != 0)
+    {
+      CountDeadline(deadline);
+    }
+  }
+}
+
+Job* Worker::Idle(bool waiting)
+{
+  const unsigned spinSteps      = idlePolicy_.spinSteps;
+  const unsigned yieldSteps     = idlePolicy_.yieldSteps;
+  const Clock::time_point start = Clock::now();
+
+  IdlePhase phase = Park;
+  if (idleSteps_ < spinSteps)
+  {
+    phase = Spin;
+  }
+  else if (idleSteps_ - spinSteps < yieldSteps)
+  {
+    phase = Yield;
+  }
+
+  // Counted up front so a worker that is asleep right now still shows up
+  idleCounts_[phase].fetch_add(1, std::memory_order_relaxed);
+
+  Job* job = nullptr;
+  if (phase == Spin)
+  {
+    // Back off exponentially so a long spin doesn't hammer the queues
+    unsigned pauses = idlePolicy_.maxSpinPauses;
+    if (idleSteps_ < 31 && (1u << idleSteps_) < pauses)
+    {
+      pauses = 1u << idleSteps_;
+    }
+
+    for (unsigned i = 0; i < pauses; ++i)
+    {
+      CpuRelax();
+    }
+  }
+  else if (phase == Yield)
+  {
+    std::this_thread::yield();
+  }
+  else if (waiting)
+  {
+    // Finished jobs wake this worker, but a condition can be set by
+    // anything, so only sleep for a while, longer each time
+    const unsigned parks = idleSteps_ - spinSteps - yieldSteps;
+    std::chrono::microseconds timeout = idlePolicy_.maxParkTime;
+    if (parks < 31 && idlePolicy_.minParkTime * (1u << parks) < timeout)
+    {
+      timeout = idlePolicy_.minParkTime * (1u << parks);
+    }
+
+    job = manager_->WaitForWork(*this, timeout);
   }
   else
   {
-    // If no job was found by any method, be a good citizen and step aside
-    // so that other processes on CPU can happen
-    if (workerMode_ == Mode::Volunteer)
+    // Sleep until there is work, or take the work that showed up while
+    // getting ready to sleep
+    job = manager_->WaitForWork(*this);
+  }
+
+  // Don't wrap around and go back to spinning after a very long idle
+  if (idleSteps_ != static_cast<unsigned>(-1)) ++idleSteps_;
+
+  idleTimes_[phase].fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           start)
+          .count(),
+      std::memory_order_relaxed);
+
+  return job;
+}
+
+Job* Worker::GetAJob() { return manager_->RequestJob(*this); }
+
+void Worker::WaitUntil(bool (*isDone)(const void*), const void* waitingFor)
+{
+  if (isDone(waitingFor)) return;
+
+  // However long this worker was idle before, this wait is new
+  idleSteps_ = 0;
+
+  if (fiberStacks_ != nullptr && SuspendFiber(isDone, waitingFor)) return;
+
+  // Waits can be nested, and only the innermost one can end
+  bool (*outerDone)(const void*) = waitDone_;
+  const void* outerWaitingFor    = waitingFor_;
+  waitDone_                      = isDone;
+  waitingFor_                    = waitingFor;
+
+  while (!isDone(waitingFor))
+  {
+    DoSingleJob(true);
+  }
+
+  waitDone_   = outerDone;
+  waitingFor_ = outerWaitingFor;
+}
+
+bool Worker::SuspendFiber(bool (*isDone)(const void*),
+                          const void* waitingFor)
+{
+  FiberWait wait = {currentFiber_, isDone, waitingFor};
+  fiberWaits_.push_back(wait);
+
+  // Pick up something that is done waiting if there is anything, otherwise
+  // look for more work on a fiber that is free
+  Fiber* next = TakeReadyFiber();
+  if (next == currentFiber_)
+  {
+    // Finished waiting already
+    return true;
+  }
+
+  if (next == nullptr && !idleFibers_.empty())
+  {
+    next = idleFibers_.back();
+    idleFibers_.pop_back();
+  }
+
+  if (next == nullptr)
+  {
+    void* stack = fiberStacks_->Allocate();
+    if (stack == nullptr)
     {
-      std::this_thread::yield();
+      // Out of stacks, so wait the old fashioned way
+      fiberWaits_.pop_back();
+      return false;
     }
-    else
+
+    next = new Fiber(stack, fiberStacks_->GetStackSize(), &RunFiber, this);
+    fibers_.push_back(next);
+  }
+
+  SwitchFiber(next);
+  return true;
+}
+
+Fiber* Worker::TakeReadyFiber()
+{
+  for (size_t i = 0; i < fiberWaits_.size(); ++i)
+  {
+    const FiberWait& wait = fiberWaits_[i];
+
+    if (wait.isDone(wait.waitingFor))
+    {
+      Fiber* fiber = wait.fiber;
+      fiberWaits_.erase(fiberWaits_.begin() + i);
+      return fiber;
+    }
+  }
+
+  return nullptr;
+}
+
+void Worker::SwitchFiber(Fiber* fiber)
+{
+  Fiber* from   = currentFiber_;
+  currentFiber_ = fiber;
+  from->SwitchTo(*fiber);
+}
+
+void Worker::RunFiber(void* worker)
+{
+  Worker* self = static_cast<Worker*>(worker);
+
+  for (;;)
+  {
+    // Fibers that are done waiting go first, since their jobs are already
+    // under way
+    Fiber* ready = self->TakeReadyFiber();
+    if (ready != nullptr)
     {
-      std::unique_lock<std::mutex> uniqueWait(waitMutex);
-      manager_->JobNotifier.wait(uniqueWait);
+      self->idleFibers_.push_back(self->currentFiber_);
+      self->SwitchFiber(ready);
+      continue;
     }
+
+    // Nothing says when a waiting fiber is done, so don't sleep for long
+    // unless all there is to wait for is being stopped
+    self->DoSingleJob(!self->WaitsOnlyForStop());
+  }
+}
+
+bool Worker::IsStopped(const void* worker)
+{
+  return !static_cast<const Worker*>(worker)->keepWorking_;
+}
+
+bool Worker::IsDrained(const void* worker)
+{
+  const Worker* self = static_cast<const Worker*>(worker);
+
+  for (const FiberWait& wait : self->fiberWaits_)
+  {
+    if (wait.fiber != self->threadFiber_) return false;
   }
+
+  return true;
 }
 
-Job* Worker::GetAJob() { return manager_->RequestJob(workerSpecialization_); }
+void Worker::DrainFibers()
+{
+  if (fiberStacks_ == nullptr || currentFiber_ != threadFiber_) return;
+
+  // Fibers never move to another thread, so the ones still waiting have to
+  // be seen through here
+  bool wasWorking = isWorking_;
+  isWorking_      = true;
+
+  WaitUntil(&IsDrained, this);
+
+  isWorking_ = wasWorking;
+}
+
+bool Worker::WaitsOnlyForStop() const
+{
+  return fiberWaits_.size() == 1 && fiberWaits_[0].isDone == &IsStopped;
+}
+
+bool Worker::IsDoneWaiting() const
+{
+  if (waitDone_ != nullptr && waitDone_(waitingFor_)) return true;
+
+  for (const FiberWait& wait : fiberWaits_)
+  {
+    if (wait.isDone(wait.waitingFor)) return true;
+  }
+
+  return false;
+}
 }
@@ -12,7 +12,17 @@ All content copyright 2017 DigiPen (USA) Corporation, all rights reserved.
 
 #include "../includes/moodycamel/concurrentqueue.h"
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <thread>
+#include <vector>
+
+#include "Fiber.h"
+#include "Job.h"
+#include "JobDeque.h"
+#include "JobHandle.h"
+#include "Parker.h"
+#include "Random.h"
 
 namespace JobBot
 {
@@ -27,7 +37,9 @@ public:
   enum struct Mode
   {
     Primary,
-    Volunteer
+    Volunteer,
+    // Fills in for a blocked worker (see Manager::BeginBlocking)
+    Compensating
   };
 
   /*
@@ -37,6 +49,16 @@ public:
   {
     // Order in which workers with this specialization should request work
     JobType priorities[static_cast<size_t>(JobType::NumJobTypes) - 1];
+    // Take jobs with a deadline, soonest first, before anything else.
+    // Otherwise they are only taken when there is nothing else to do or
+    // they are about to be late
+    bool earliestDeadlineFirst;
+
+    /*
+        Will a worker with this specialization ever take this type of job
+        (Important jobs are taken by everyone)
+    */
+    bool Accepts(JobType type) const;
 
     // Predefined specializations
 
@@ -46,20 +68,138 @@ public:
     // jobs after all IO is finished
     static Specialization IO;
     // Prefer completing graphics jobs, will only take small jobs so as to
-    // always be ready for more graphics
+    // always be ready for more graphics. Earliest deadline first
     static Specialization Graphics;
-    // Will take only tiny jobs, never accepts blocking jobs
+    // Will take only tiny jobs, never accepts blocking jobs. Earliest
+    // deadline first
     static Specialization RealTime;
   };
 
+  /*
+      How a worker waits when it can't find a job
+
+      A worker with nothing to do goes through three phases, checking for
+      work again after every step:
+        spin  - busy wait with the CPU's pause instruction. Each step pauses
+                twice as long as the last, up to maxSpinPauses
+        yield - give the rest of its time slice to another thread
+        park  - go to sleep until a new job is submitted
+
+      Workers waiting on something (WorkWhileWaitingFor) are woken by any
+      worker that finishes a job, since that may be what they wait on. A
+      condition can also be set outside of a job, so they still only park
+      for minParkTime at first, doubling every time up to maxParkTime.
+
+      Spinning keeps wake ups fast at the cost of burning CPU, parking is
+      the other way around.
+  */
+  struct IdlePolicy
+  {
+    // Number of spin steps before moving on to yielding
+    unsigned spinSteps;
+    // Longest a single spin step can pause for
+    unsigned maxSpinPauses;
+    // Number of yields before moving on to parking
+    unsigned yieldSteps;
+    // Shortest and longest time to park for when waiting on a job
+    std::chrono::microseconds minParkTime;
+    std::chrono::microseconds maxParkTime;
+
+    // Predefined policies
+
+    // Spins and yields for a long time before sleeping, for frame loops
+    // where a job showing up late is worse than a busy core
+    static const IdlePolicy LowLatency;
+    // Spins briefly then yields a little before sleeping
+    static const IdlePolicy Balanced;
+    // Sleeps as soon as there is nothing to do, for servers where cores
+    // should be given up when idle
+    static const IdlePolicy PowerSaving;
+  };
+
+  /*
+      How many times and for how long a worker has been in each idle phase
+  */
+  struct IdleStats
+  {
+    std::uint64_t spinCount;
+    std::uint64_t yieldCount;
+    std::uint64_t parkCount;
+
+    // Time spent in each phase in nanoseconds
+    std::uint64_t spinTime;
+    std::uint64_t yieldTime;
+    std::uint64_t parkTime;
+
+    /*
+        Add another worker's stats to these
+    */
+    IdleStats& operator+=(const IdleStats& other);
+  };
+
+  /*
+      How long jobs at each priority waited before a worker took them.
+      Waits are only timed while the manager is tracking them (see
+      Manager::SetWaitTracking)
+  */
+  struct PriorityStats
+  {
+    // Number of jobs taken whose wait was timed
+    std::uint64_t timedJobs[Job::NUM_PRIORITIES];
+    // Total and longest time those jobs spent between being submitted and
+    // being taken, in microseconds
+    std::uint64_t totalWait[Job::NUM_PRIORITIES];
+    std::uint64_t maxWait[Job::NUM_PRIORITIES];
+    // Number of jobs taken ahead of more urgent work because they had been
+    // waiting too long
+    std::uint64_t agedJobs[Job::NUM_PRIORITIES];
+
+    /*
+        Add another worker's stats to these, keeping the longer of the
+        longest waits
+    */
+    PriorityStats& operator+=(const PriorityStats& other);
+  };
+
+  /*
+      How many jobs with a deadline a worker ran, and how many of those
+      were still running when it passed
+  */
+  struct DeadlineStats
+  {
+    std::uint64_t deadlineJobs;
+    std::uint64_t missedDeadlines;
+    // Total and longest time missed deadlines were missed by, in
+    // microseconds
+    std::uint64_t totalLateness;
+    std::uint64_t maxLateness;
+
+    /*
+        Add another worker's stats to these, keeping the longer of the
+        longest lateness
+    */
+    DeadlineStats& operator+=(const DeadlineStats& other);
+  };
+
   /*
       Constructor for worker
 
       manager - this worker's manager that it may ask for jobs from
-      maxJobs - the maxiumum jobs that can be accepted into this worker's queue
       mode - Mode this worker should operate as
+      specialization - types of work this worker should look for
+      idlePolicy - how this worker waits when there is no work
+      fiberStacks - where to get stacks for running jobs on fibers, or
+                    nullptr to run them on the thread's own stack (see
+                    Manager::SetFiberMode)
   */
-  Worker(Manager* manager, Mode mode, const Specialization& specialization);
+  Worker(Manager* manager, Mode mode, const Specialization& specialization,
+         const IdlePolicy& idlePolicy = IdlePolicy::Balanced,
+         FiberStackPool* fiberStacks  = nullptr);
+
+  /*
+      Free this worker's local job queues and fibers
+  */
+  ~Worker();
 
   /*
       Copying or assigning to a worker does not make sense
@@ -71,10 +211,24 @@ public:
       Steal jobs from other workers and complete them while waiting for
       a job to complete
 
+      Rethrows the exception if the job is the root of a tree and a job in
+      the tree threw one (see JobErrors for where else they are kept)
+
       job - The job to wait for
   */
   void WorkWhileWaitingFor(Job* job);
 
+  /*
+      Complete other jobs while waiting for the job a handle refers to.
+      Unlike waiting on a Job*, the job doesn't need to be held open and is
+      free to be reused as soon as it finishes
+
+      Rethrows exceptions the same way as waiting on a Job*
+
+      handle - handle to the job to wait for
+  */
+  void WorkWhileWaitingFor(const JobHandle& handle);
+
   /*
       Steal jobs from other workers and complete them while waiting for
       some condition to be true
@@ -120,7 +274,128 @@ public:
   */
   bool IsWorking() const;
 
+  /*
+      Does this worker run jobs on fibers, so waiting on a job puts the
+      waiting job aside rather than running other jobs on top of it
+  */
+  bool UsesFibers() const;
+
+  /*
+      Get the types of work this worker prefers
+  */
+  const Specialization& GetSpecialization() const;
+
+  /*
+      Put a job in this worker's local queue for its type and priority.
+      Must only be called from this worker's thread.
+
+      Returns false if the local queue is full, or this is a compensating
+      worker. Those come and go and nobody steals from them, so they
+      keep no jobs of their own
+  */
+  bool PushLocalJob(Job* job);
+
+  /*
+      Take the newest job of the given type and priority from this worker's
+      local queues. Must only be called from this worker's thread.
+
+      Returns nullptr if there is no such job
+  */
+  Job* PopLocalJob(JobType type, unsigned priority = Job::DEFAULT_PRIORITY);
+
+  /*
+      Steal the oldest job of the given type and priority from this
+      worker's local queues. Safe to call from any thread.
+
+      Returns nullptr if there was no such job to steal
+  */
+  Job* StealLocalJob(JobType type,
+                     unsigned priority = Job::DEFAULT_PRIORITY);
+
+  /*
+      Approximate number of jobs waiting in this worker's local queues
+  */
+  size_t GetLocalJobCount() const;
+
+  /*
+      Approximate number of jobs of one type waiting in this worker's local
+      queues for that type, at any priority
+  */
+  size_t GetLocalJobCount(JobType type) const;
+
+  /*
+      Approximate number of jobs of one type and priority waiting in this
+      worker's local queue for them
+  */
+  size_t GetLocalJobCount(JobType type, unsigned priority) const;
+
+  /*
+      Get this worker's random number generator, for picking other workers
+      to steal from. Must only be used from this worker's thread
+  */
+  XorShift& GetRandom();
+
+  /*
+      Get the worker belonging to the given manager that lives on the
+      calling thread. Only looks at this thread's own workers, so is cheap
+      enough to call on every job submission
+
+      Returns nullptr if this thread has no worker for that manager
+  */
+  static Worker* GetThisThreadsWorker(const Manager* manager);
+
+  /*
+      Get any worker that lives on the calling thread, whatever manager it
+      belongs to. For waiting on jobs without knowing their manager
+
+      Returns nullptr if this thread has no workers
+  */
+  static Worker* GetThisThreadsWorker();
+
+  /*
+      Get the manager this worker takes jobs from
+  */
+  Manager* GetManager() const;
+
+  /*
+      Get how this worker waits when there is no work
+  */
+  const IdlePolicy& GetIdlePolicy() const;
+
+  /*
+      Get how long this worker has spent in each idle phase so far.
+      Safe to call from any thread
+  */
+  IdleStats GetIdleStats() const;
+
+  /*
+      Get how long the jobs this worker took at each priority waited.
+      Safe to call from any thread
+  */
+  PriorityStats GetPriorityStats() const;
+
+  /*
+      Get how many of the jobs this worker ran missed their deadline.
+      Safe to call from any thread
+  */
+  DeadlineStats GetDeadlineStats() const;
+
 private:
+  // Phases a worker goes through while idle, in order
+  enum IdlePhase
+  {
+    Spin,
+    Yield,
+    Park,
+    NumIdlePhases
+  };
+
+  // Maximum number of jobs of each type in a worker's local queues
+  static constexpr size_t scLocalQueueCapacity_ = 1024;
+
+  // Manager handles putting workers to sleep and waking them up
+  friend class Manager;
+
   // This worker's manager
   Manager* manager_;
   // Mode that this worker is operating in
@@ -130,19 +405,194 @@ private:
   // ID of the thread that this worker lives on
   std::thread::id threadID_;
   // If this worker should continue working
-  volatile bool keepWorking_;
+  std::atomic_bool keepWorking_;
   // If this worker is currently working
-  volatile bool isWorking_;
+  std::atomic_bool isWorking_;
+
+  // If this worker is asleep waiting for work. Whoever changes this from
+  // true to false is responsible for waking the worker
+  std::atomic_bool sleeping_;
+  // If this worker is asleep while waiting on something other than new
+  // work, so it should be woken whenever a job finishes
+  std::atomic_bool sleepingWhileWaiting_;
+  // What this worker sleeps on when it has nothing to do
+  Parker parker_;
+
+  // Workers living on the current thread, linked through nextOnThread_.
+  // Usually just one, but a thread can have a worker for several managers
+  static thread_local Worker* tThreadsWorkers_;
+  // Next worker living on the same thread as this one
+  Worker* nextOnThread_;
+
+  // Local queues for jobs submitted from this worker's thread, one per type
+  // and priority
+  JobDeque* localJobs_[static_cast<size_t>(JobType::NumJobTypes)]
+                      [Job::NUM_PRIORITIES];
+
+  // Random numbers for choosing who to steal from
+  XorShift random_;
+
+  // How this worker waits when there is no work
+  const IdlePolicy idlePolicy_;
+  // Number of times in a row this worker has failed to find a job
+  unsigned idleSteps_;
+  // Number of times and nanoseconds spent in each idle phase
+  std::atomic<std::uint64_t> idleCounts_[NumIdlePhases];
+  std::atomic<std::uint64_t> idleTimes_[NumIdlePhases];
+
+  // Bits in the manager's waitingClasses_ for the jobs this worker takes
+  std::uint32_t acceptedClasses_;
+  // Number of job requests left before this worker next looks for jobs
+  // that have waited too long
+  unsigned requestsUntilAging_;
+  // Counters behind GetPriorityStats. Only this worker writes them
+  std::atomic<std::uint64_t> timedJobs_[Job::NUM_PRIORITIES];
+  std::atomic<std::uint64_t> totalWaits_[Job::NUM_PRIORITIES];
+  std::atomic<std::uint64_t> maxWaits_[Job::NUM_PRIORITIES];
+  std::atomic<std::uint64_t> agedJobs_[Job::NUM_PRIORITIES];
+  // Counters behind GetDeadlineStats. Only this worker writes them
+  std::atomic<std::uint64_t> deadlineJobs_;
+  std::atomic<std::uint64_t> missedDeadlines_;
+  std::atomic<std::uint64_t> totalLateness_;
+  std::atomic<std::uint64_t> maxLateness_;
+
+  /*
+      Count a job this worker took at some priority
+
+      wait - microseconds it waited to be taken, if it was timed
+      timed - if the wait was timed
+      aged - if it was taken ahead of more urgent work for waiting too long
+  */
+  void CountJob(unsigned priority, std::uint32_t wait, bool timed,
+                bool aged);
+
+  /*
+      Count a job with a deadline that this worker just ran, checking if
+      it finished in time
+
+      deadline - the job's deadline, in the manager's ticks
+  */
+  void CountDeadline(std::uint32_t deadline);
+
+  /*
+      Something a fiber is waiting on before it can carry on
+  */
+  struct FiberWait
+  {
+    Fiber* fiber;
+    // Checks if the wait is over
+    bool (*isDone)(const void* waitingFor);
+    const void* waitingFor;
+  };
+
+  // Where this worker gets stacks for fibers, or nullptr if it doesn't use
+  // them
+  FiberStackPool* fiberStacks_;
+  // Stands in for the stack of the thread this worker lives on
+  Fiber* threadFiber_;
+  // Fiber this worker is running on right now
+  Fiber* currentFiber_;
+  // Every fiber with a stack of its own this worker has made
+  std::vector<Fiber*> fibers_;
+  // Fibers left between jobs, free to carry on looking for work
+  std::vector<Fiber*> idleFibers_;
+  // Fibers put aside until what they are waiting on is done
+  std::vector<FiberWait> fiberWaits_;
+
+  // What WaitUntil is waiting on right here on this stack, if anything
+  bool (*waitDone_)(const void* waitingFor);
+  const void* waitingFor_;
 
   /*
       Loop until the worker is told to stop
   */
   void DoWork();
 
+  /*
+      Complete other jobs until isDone(waitingFor) is true. With fibers the
+      waiting fiber is put aside while others run, otherwise jobs are run
+      right here on top of the wait
+  */
+  void WaitUntil(bool (*isDone)(const void*), const void* waitingFor);
+
+  /*
+      Put the fiber this worker is running on aside until
+      isDone(waitingFor) is true, and carry on with other work on another
+      fiber in the meantime
+
+      Returns false without waiting if there was no stack for a new fiber
+  */
+  bool SuspendFiber(bool (*isDone)(const void*), const void* waitingFor);
+
+  /*
+      Take a fiber that has been put aside and is done waiting, or nullptr
+      if there isn't one
+  */
+  Fiber* TakeReadyFiber();
+
+  /*
+      Carry on in another of this worker's fibers
+  */
+  void SwitchFiber(Fiber* fiber);
+
+  /*
+      Where this worker's fibers start. They look for jobs to do until they
+      are switched away from
+  */
+  static void RunFiber(void* worker);
+
+  /*
+      Has a worker been told to stop. With fibers, this is what the
+      thread's own fiber waits on while the worker's jobs run on others
+  */
+  static bool IsStopped(const void* worker);
+
+  /*
+      Are no fibers but the thread's own waiting on anything
+  */
+  static bool IsDrained(const void* worker);
+
+  /*
+      Run jobs until every fiber put aside has finished waiting. The
+      thread's own fiber carries on as soon as its wait is done, which can
+      leave others behind, so this is done before the thread stops working
+      for this worker
+  */
+  void DrainFibers();
+
+  /*
+      Is the only thing this worker is waiting on whether it has been
+      stopped
+  */
+  bool WaitsOnlyForStop() const;
+
+  /*
+      Is anything this worker is waiting on done, so it shouldn't go to
+      sleep. Must only be called from this worker's thread
+  */
+  bool IsDoneWaiting() const;
+
+  /*
+      Remove this worker from its thread's list of workers.
+      Must be called on this worker's thread
+  */
+  void LeaveThread();
+
   /*
       Take and complete a single job
+
+      waiting - if this worker is waiting on something other than new work,
+                so it must not sleep until a job is submitted
+  */
+  void DoSingleJob(bool waiting);
+
+  /*
+      Wait a little while because no job was found, going further through
+      the idle policy each time in a row this is called
+
+      May return a job that showed up while getting ready to sleep
   */
-  void DoSingleJob();
+  Job* Idle(bool waiting);
 
   /*
       Aquire a job through some means
@@ -5,9 +5,20 @@
   Jake McLeman
 ***************************************************************************/
 
+#include <atomic>
+#include <chrono>
 #include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "Job.h"
+#include "JobExceptions.h"
+#include "JobFuture.h"
+#include "JobPool.h"
+#include "PayloadArena.h"
 
 #define UNUSED(thing) (void)thing
 
@@ -40,6 +51,25 @@ void TestJobFunc4(Job* job)
 }
 GraphicsJobFunction TestJob4(TestJobFunc4);
 
+struct BigData
+{
+  int values[100];
+};
+bool testFunc5GotData;
+void TestJobFunc5(Job* job)
+{
+  BigData& data    = job->GetData<BigData>();
+  testFunc5GotData = (data.values[0] == 5 && data.values[99] == 99);
+}
+JobFunction TestJob5(TestJobFunc5);
+
+int testFunc6GotData;
+void TestJobFunc6(Job* job)
+{
+  testFunc6GotData = *job->GetData<std::unique_ptr<int>>();
+}
+JobFunction TestJob6(TestJobFunc6);
+
 TEST(JobTests, SizeVerification)
 {
   ASSERT_EQ((size_t)Job::TARGET_JOB_SIZE, sizeof(Job))
@@ -138,6 +168,232 @@ TEST(JobTests, Callback)
       << "Job has been run but has not executed callback code";
 }
 
+bool callbackSawCancel;
+void CancelCallbackFunc(Job* job) { callbackSawCancel = job->IsCancelled(); }
+JobFunction CancelCallback(CancelCallbackFunc);
+
+TEST(JobTests, Cancel)
+{
+  testFunc1HasRun   = false;
+  callbackSawCancel = false;
+
+  Job* job = Job::Create(TestJob1);
+  job->SetCallback(CancelCallback);
+  EXPECT_FALSE(job->IsCancelled()) << "New jobs should not be cancelled";
+
+  job->Cancel();
+  EXPECT_TRUE(job->IsCancelled());
+
+  job->Run();
+
+  EXPECT_FALSE(testFunc1HasRun) << "Cancelled job should not run its function";
+  EXPECT_TRUE(callbackSawCancel)
+      << "Callback should still run and see the job was cancelled";
+  EXPECT_TRUE(job->IsFinished()) << "Cancelled job should still finish";
+}
+
+TEST(JobTests, CancelSubtree)
+{
+  testFunc1HasRun = false;
+  testFunc2HasRun = false;
+
+  // Cancel the parent after one child exists and before another is made
+  Job* parent     = Job::Create(TestJob1);
+  Job* child      = Job::CreateChild(TestJob2, parent);
+  Job* grandchild = Job::CreateChild(TestJob2, child);
+  EXPECT_FALSE(grandchild->IsCancelled());
+  parent->Cancel();
+  Job* lateChild = Job::CreateChild(TestJob2, parent);
+
+  EXPECT_TRUE(child->IsCancelled()) << "Children see a cancelled parent";
+  EXPECT_TRUE(grandchild->IsCancelled())
+      << "Jobs that already looked still see a cancelled ancestor";
+  EXPECT_TRUE(lateChild->IsCancelled())
+      << "Children of a cancelled job start cancelled";
+
+  parent->Run();
+  grandchild->Run();
+  child->Run();
+  EXPECT_FALSE(parent->IsFinished())
+      << "Parent must still wait for every child";
+  lateChild->Run();
+
+  EXPECT_FALSE(testFunc1HasRun) << "Cancelled parent should not run";
+  EXPECT_FALSE(testFunc2HasRun) << "Children of cancelled job should not run";
+  EXPECT_TRUE(parent->IsFinished())
+      << "Parent should finish once its cancelled children have";
+}
+
+TEST(JobTests, Priority)
+{
+  Job* parent  = Job::Create(TestJob1);
+  JobType type = parent->GetType();
+  EXPECT_EQ(Job::DEFAULT_PRIORITY, parent->GetPriority());
+
+  parent->SetPriority(0);
+  EXPECT_EQ(0u, parent->GetPriority());
+  EXPECT_EQ(type, parent->GetType())
+      << "Setting priority should leave the type alone";
+
+  Job* child = Job::CreateChild(TestJob2, parent);
+  EXPECT_EQ(0u, child->GetPriority()) << "Children start at parent priority";
+
+  child->SetPriority(100);
+  EXPECT_EQ(Job::NUM_PRIORITIES - 1, child->GetPriority())
+      << "Priorities past the last level should become the last level";
+
+  parent->Run();
+  child->Run();
+  EXPECT_TRUE(parent->IsFinished());
+}
+
+TEST(JobTests, Deadline)
+{
+  Job* parent = Job::Create(TestJob1);
+  EXPECT_FALSE(parent->HasDeadline());
+
+  parent->SetDeadline(std::chrono::milliseconds(5));
+  EXPECT_TRUE(parent->HasDeadline());
+
+  Job* child = Job::CreateChild(TestJob2, parent);
+  EXPECT_FALSE(child->HasDeadline()) << "Children don't inherit deadlines";
+
+  child->SetDeadline(std::chrono::steady_clock::now() -
+                     std::chrono::milliseconds(1));
+  EXPECT_TRUE(child->HasDeadline()) << "Deadlines may already have passed";
+
+  parent->Run();
+  child->Run();
+  EXPECT_TRUE(parent->IsFinished());
+}
+
+TEST(JobTests, HandleSurvivesReuse)
+{
+  JobHandle empty;
+  EXPECT_FALSE(empty.IsValid());
+  EXPECT_TRUE(empty.IsFinished()) << "Empty handles have nothing to wait on";
+
+  Job* job         = Job::Create(TestJob1);
+  JobHandle handle = job->GetHandle();
+  EXPECT_TRUE(handle.IsValid());
+  EXPECT_FALSE(handle.IsFinished());
+
+  job->Run();
+  EXPECT_TRUE(handle.IsFinished());
+
+  // Finished jobs go straight back on this thread's free list, so the next
+  // job reuses the same memory
+  Job* reused         = Job::Create(TestJob1);
+  JobHandle newHandle = reused->GetHandle();
+  ASSERT_EQ(job, reused) << "Expected the pool to reuse the finished job";
+
+  EXPECT_FALSE(reused->IsFinished());
+  EXPECT_TRUE(handle.IsFinished())
+      << "Old handle should stay finished after its memory is reused";
+  EXPECT_FALSE(newHandle.IsFinished());
+  EXPECT_NE(handle, newHandle);
+
+  reused->Run();
+  EXPECT_TRUE(newHandle.IsFinished());
+}
+
+void ThrowingJobFunc(Job* job)
+{
+  UNUSED(job);
+  throw std::runtime_error("job failed");
+}
+JobFunction ThrowingJob(ThrowingJobFunc);
+
+TEST(JobTests, ExceptionsStoredOnce)
+{
+  size_t stored = JobErrors::GetStoredCount();
+
+  // Only the root of the tree keeps it
+  Job* root            = Job::Create(TestJob1);
+  Job* thrower         = Job::CreateChild(ThrowingJob, root);
+  JobHandle rootHandle = root->GetHandle();
+  JobHandle handle     = thrower->GetHandle();
+  thrower->Run();
+  root->Run();
+  EXPECT_EQ(stored + 1, JobErrors::GetStoredCount());
+  EXPECT_NO_THROW(JobErrors::RethrowIfFailed(handle));
+  EXPECT_THROW(JobErrors::RethrowIfFailed(rootHandle), std::runtime_error);
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  // Unless there is a future to throw it from
+  Job* parent           = Job::Create(TestJob1);
+  JobFuture<int> future = Job::CreateChild(
+      []() -> int { throw std::logic_error("no result"); }, parent);
+  JobHandle parentHandle = parent->GetHandle();
+  future.GetJob()->Run();
+  parent->Run();
+  EXPECT_EQ(stored + 1, JobErrors::GetStoredCount());
+  EXPECT_NO_THROW(JobErrors::RethrowIfFailed(parentHandle));
+  EXPECT_THROW(future.Get(), std::logic_error);
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  // Waiting on a handle still throws however many jobs have run since,
+  // since the job's memory is kept until the exception is taken
+  thrower = Job::Create(ThrowingJob);
+  handle  = thrower->GetHandle();
+  thrower->Run();
+  for (int i = 0; i < 10; ++i)
+  {
+    Job* other = Job::Create(TestJob1);
+    EXPECT_NE(thrower, other) << "Memory was reused before the wait";
+    other->Run();
+  }
+  EXPECT_EQ(stored + 1, JobErrors::GetStoredCount());
+  EXPECT_THROW(handle.Wait(), std::runtime_error);
+  EXPECT_NO_THROW(handle.Wait()) << "Exceptions are only thrown once";
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  // Taking it lets the memory go
+  Job* reused = Job::Create(TestJob1);
+  EXPECT_EQ(thrower, reused) << "Expected the pool to reuse the finished job";
+  reused->Run();
+}
+
+TEST(JobTests, ExceptionsDrain)
+{
+  size_t stored = JobErrors::GetStoredCount();
+
+  // Nothing took a handle to these, so nothing can wait on them and they
+  // aren't kept
+  for (int i = 0; i < 100; ++i)
+  {
+    Job::Create(ThrowingJob)->Run();
+  }
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  // Same for futures let go of without taking the result, whether the job
+  // threw before or after
+  {
+    JobFuture<int> future =
+        Job::Create([]() -> int { throw std::logic_error("no result"); });
+    future.GetJob()->Run();
+    EXPECT_EQ(stored + 1, JobErrors::GetStoredCount());
+  }
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  Job* job = nullptr;
+  {
+    JobFuture<int> future =
+        Job::Create([]() -> int { throw std::logic_error("no result"); });
+    job = future.GetJob();
+  }
+  job->Run();
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+
+  // And handles that are given up on
+  job              = Job::Create(ThrowingJob);
+  JobHandle handle = job->GetHandle();
+  job->Run();
+  EXPECT_EQ(stored + 1, JobErrors::GetStoredCount());
+  JobErrors::Take(handle);
+  EXPECT_EQ(stored, JobErrors::GetStoredCount());
+}
+
 TEST(JobTests, Data1)
 {
   testFunc3GotData = false;
@@ -173,6 +429,103 @@ TEST(JobTests, Data2)
   EXPECT_TRUE(job->IsFinished()) << "Job is not marked as finished";
 }
 
+TEST(JobTests, DataTooBigForJob)
+{
+  testFunc5GotData = false;
+
+  BigData data;
+  for (int i = 0; i < 100; ++i) data.values[i] = i;
+  data.values[0] = 5;
+
+  PayloadArena::Stats before = PayloadArena::GetStats();
+
+  Job* job = Job::Create(TestJob5, data);
+
+  PayloadArena::Stats during = PayloadArena::GetStats();
+  EXPECT_EQ(before.liveBlocks + 1, during.liveBlocks)
+      << "Data should have been put in the arena";
+  EXPECT_GE(during.liveBytes, before.liveBytes + sizeof(BigData));
+
+  job->Run();
+
+  EXPECT_TRUE(testFunc5GotData) << "Function recieved wrong data";
+
+  PayloadArena::Stats after = PayloadArena::GetStats();
+  EXPECT_EQ(before.liveBlocks, after.liveBlocks)
+      << "Arena block was not given back when the job finished";
+  EXPECT_GE(after.cachedBlocks, 1u) << "Freed block should be kept for reuse";
+
+  // The block is reused rather than going back to the heap
+  job = Job::Create(TestJob5, data);
+  EXPECT_EQ(after.heapAllocations, PayloadArena::GetStats().heapAllocations);
+  job->Run();
+}
+
+TEST(JobTests, DataFreedOnOtherThread)
+{
+  BigData data;
+  for (int i = 0; i < 100; ++i) data.values[i] = i;
+  data.values[0] = 5;
+
+  // Jobs made here and run on another thread, the way workers run the
+  // jobs the main thread makes
+  auto round = [&data]() {
+    std::vector<Job*> jobs;
+    for (int i = 0; i < 8; ++i)
+    {
+      jobs.push_back(Job::Create(TestJob5, data));
+    }
+    std::thread runner([&jobs]() {
+      for (Job* job : jobs) job->Run();
+    });
+    runner.join();
+  };
+
+  PayloadArena::Stats before = PayloadArena::GetStats();
+  round();
+  PayloadArena::Stats warm = PayloadArena::GetStats();
+  EXPECT_EQ(before.liveBlocks, warm.liveBlocks)
+      << "Blocks freed on another thread were not given back";
+
+  // The blocks come back to this thread, so it doesn't need the heap again
+  for (int i = 0; i < 10; ++i)
+  {
+    round();
+  }
+  PayloadArena::Stats after = PayloadArena::GetStats();
+  EXPECT_EQ(warm.heapAllocations, after.heapAllocations)
+      << "Blocks freed on another thread were not reused";
+  EXPECT_EQ(before.liveBlocks, after.liveBlocks);
+}
+
+TEST(JobTests, DataOwnership)
+{
+  // Move only data is moved in, and destroyed when the job is done
+  testFunc6GotData = 0;
+  Job* job = Job::Create(TestJob6, std::unique_ptr<int>(new int(6)));
+  job->Run();
+  EXPECT_EQ(6, testFunc6GotData) << "Function recieved wrong data";
+
+  // Copies are destroyed too, and so is data that gets replaced
+  std::shared_ptr<int> first  = std::make_shared<int>(1);
+  std::shared_ptr<int> second = std::make_shared<int>(2);
+  job                         = Job::Create(TestJob1, first);
+  EXPECT_EQ(2, first.use_count()) << "Job should hold a copy";
+  job->SetData(second);
+  EXPECT_EQ(1, first.use_count()) << "Replaced data was not destroyed";
+  EXPECT_EQ(2, second.use_count());
+  job->Run();
+  EXPECT_EQ(1, second.use_count()) << "Data was not destroyed with the job";
+
+  // Moving a buffer in doesn't copy it
+  std::string text(1000, 'x');
+  const char* buffer = text.data();
+  job                = Job::Create(TestJob1, std::move(text));
+  EXPECT_EQ(buffer, job->GetData<std::string>().data())
+      << "String was copied instead of moved";
+  job->Run();
+}
+
 TEST(JobTests, JobTypeChecks)
 {
   Job* job1 = Job::Create(TestJob1);
@@ -186,3 +539,284 @@ TEST(JobTests, JobTypeChecks)
   EXPECT_FALSE(job2->MatchesType(JobType::Misc)) << "Huge job was misc";
   EXPECT_FALSE(job2->MatchesType(JobType::Tiny)) << "Huge job was tiny";
 }
+
+TEST(JobTests, Blocking)
+{
+  // IO jobs are counted as blocking unless they say otherwise, and other
+  // jobs only if they say so
+  Job* io = Job::Create(IOJobFunction(TestJobFunc1));
+  EXPECT_TRUE(io->IsBlocking()) << "IO job was not blocking";
+  io->SetBlocking(false);
+  EXPECT_FALSE(io->IsBlocking()) << "IO job was still blocking";
+  io->Run();
+
+  Job* tiny = Job::Create(TestJob1);
+  EXPECT_FALSE(tiny->IsBlocking()) << "Tiny job was blocking";
+  tiny->SetBlocking(true);
+  EXPECT_TRUE(tiny->IsBlocking()) << "Tiny job was not made blocking";
+  tiny->Run();
+}
+
+TEST(JobTests, PoolStats)
+{
+  JobPool::Stats before = JobPool::GetStats();
+
+  Job* job = Job::Create(TestJob1);
+
+  JobPool::Stats during = JobPool::GetStats();
+  EXPECT_EQ(before.live + 1, during.live) << "Job was not counted as live";
+  EXPECT_GE(during.reserved, during.live) << "More jobs live than reserved";
+  EXPECT_LE(during.reserved, during.capacity) << "Reserved past capacity";
+
+  job->Run();
+
+  JobPool::Stats after = JobPool::GetStats();
+  EXPECT_EQ(before.live, after.live) << "Finished job was not freed";
+}
+
+TEST(JobTests, PoolReusesFinishedJobs)
+{
+  Job* job1 = Job::Create(TestJob1);
+  job1->Run();
+
+  // Last job finished on this thread is the first one handed back out
+  Job* job2 = Job::Create(TestJob2);
+  EXPECT_EQ(job1, job2) << "Finished job memory was not reused";
+
+  job2->Run();
+}
+
+TEST(JobTests, PoolCrossThreadFree)
+{
+  JobPool::Stats before = JobPool::GetStats();
+
+  Job* job = Job::Create(TestJob1);
+
+  // Finish the job on a different thread than made it
+  std::thread other([job]() { job->Run(); });
+  other.join();
+
+  EXPECT_TRUE(job->IsFinished()) << "Job was not finished on other thread";
+
+  JobPool::Stats after = JobPool::GetStats();
+  EXPECT_EQ(before.live, after.live) << "Remotely freed job was not counted";
+
+  // Once this thread runs out of local jobs the remote one comes back
+  bool reused = false;
+  Job* made[JobPool::scSlabSize * 2];
+  size_t count = 0;
+  for (; count < JobPool::scSlabSize * 2 && !reused; ++count)
+  {
+    made[count] = Job::Create(TestJob1);
+    reused      = (made[count] == job);
+  }
+
+  EXPECT_TRUE(reused) << "Remotely freed job never came back to its owner";
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    made[i]->Run();
+  }
+}
+
+TEST(JobTests, PoolGrows)
+{
+  JobPool::Stats before = JobPool::GetStats();
+
+  // Keep more jobs alive than the pool currently has room for
+  std::vector<Job*> jobs;
+  for (size_t i = 0; i <= before.capacity; ++i)
+  {
+    jobs.push_back(Job::Create(TestJob1));
+  }
+
+  JobPool::Stats during = JobPool::GetStats();
+  EXPECT_GT(during.capacity, before.capacity) << "Pool did not grow";
+  EXPECT_EQ((size_t)0, during.capacity % JobPool::scSegmentSize)
+      << "Pool did not grow by whole segments";
+
+  for (Job* job : jobs)
+  {
+    job->Run();
+    EXPECT_TRUE(job->IsFinished()) << "Job in new segment did not finish";
+  }
+}
+
+TEST(JobTests, PoolFullThrows)
+{
+  JobPool::SetMaxCapacity(JobPool::GetStats().capacity);
+
+  std::vector<Job*> jobs;
+  bool thrown = false;
+  try
+  {
+    for (size_t i = 0; i <= JobPool::GetStats().capacity; ++i)
+    {
+      jobs.push_back(Job::Create(TestJob1));
+    }
+  }
+  catch (const JobRejected& e)
+  {
+    thrown = true;
+    EXPECT_EQ(JobRejected::FailureType::QueueFull, e.GetFailureMode())
+        << "Wrong failure type for full pool";
+  }
+
+  EXPECT_TRUE(thrown) << "Full pool did not reject the job";
+
+  // Reserving can't take the pool past its most either
+  const size_t capacity = JobPool::GetStats().capacity;
+  JobPool::Reserve(capacity + 4 * JobPool::scSegmentSize);
+  EXPECT_EQ(capacity, JobPool::GetStats().capacity)
+      << "Reserving grew the pool past its max capacity";
+
+  // Finishing jobs makes room again
+  for (Job* job : jobs)
+  {
+    job->Run();
+  }
+  Job* job = Job::Create(TestJob1);
+  job->Run();
+
+  JobPool::SetMaxCapacity(JobPool::scDefaultMaxCapacity);
+}
+
+TEST(JobTests, PoolFullReclaimsRemoteJobs)
+{
+  // Room for one more segment, which the other thread gets
+  JobPool::SetMaxCapacity(JobPool::GetStats().capacity +
+                          JobPool::scSegmentSize);
+
+  // Take every job that can be made on the calling thread
+  auto fillPool = [](std::vector<Job*>& jobs) {
+    try
+    {
+      for (;;)
+      {
+        jobs.push_back(Job::Create(TestJob1));
+      }
+    }
+    catch (const JobRejected&)
+    {
+    }
+  };
+
+  // Another thread takes the rest of the pool and then stays alive, so
+  // its cache isn't given up
+  std::vector<Job*> otherJobs;
+  std::atomic_bool filled(false);
+  std::atomic_bool done(false);
+  std::thread other([&]() {
+    fillPool(otherJobs);
+    filled = true;
+    while (!done)
+    {
+      std::this_thread::yield();
+    }
+  });
+  while (!filled)
+  {
+    std::this_thread::yield();
+  }
+
+  std::vector<Job*> jobs;
+  fillPool(jobs);
+
+  // Finishing the other thread's jobs here gives them back to it, but they
+  // can still be used before it takes them back
+  EXPECT_FALSE(otherJobs.empty());
+  for (Job* job : otherJobs)
+  {
+    job->Run();
+  }
+
+  Job* job = nullptr;
+  EXPECT_NO_THROW(job = Job::Create(TestJob1))
+      << "Jobs waiting for another thread were not reclaimed";
+  if (job != nullptr) job->Run();
+
+  done = true;
+  other.join();
+  for (Job* mine : jobs)
+  {
+    mine->Run();
+  }
+
+  JobPool::SetMaxCapacity(JobPool::scDefaultMaxCapacity);
+}
+
+std::atomic_int parentsFinished(0);
+void CountParentFunc(Job* job)
+{
+  UNUSED(job);
+  ++parentsFinished;
+}
+JobFunction CountParent(CountParentFunc);
+
+TEST(JobTests, ChildrenFinishingAtOnce)
+{
+  constexpr int rounds   = 2000;
+  constexpr int children = 4;
+  parentsFinished        = 0;
+
+  // Each thread runs one child of every parent, all starting together so
+  // the last children of a parent often finish at the same moment
+  Job* kids[rounds][children];
+  for (int round = 0; round < rounds; ++round)
+  {
+    Job* parent = Job::Create(TestJob1);
+    parent->SetCallback(CountParent);
+    for (Job*& kid : kids[round])
+    {
+      kid = Job::CreateChild(TestJob1, parent);
+    }
+    parent->Run();
+  }
+
+  std::atomic_int ready(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < children; ++i)
+  {
+    threads.emplace_back([&, i]() {
+      ++ready;
+      while (ready != children)
+      {
+      }
+      for (int round = 0; round < rounds; ++round)
+      {
+        kids[round][i]->Run();
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(rounds, parentsFinished.load())
+      << "Every parent should finish exactly once";
+}
+
+TEST(JobTests, DeepTreeFinish)
+{
+  constexpr int depth = 10000;
+
+  // A chain of jobs each the only child of the last. Finishing the bottom
+  // one finishes every job above it, a level at a time. Leaves a lot of
+  // jobs on this thread's free list, so it comes last
+  std::vector<Job*> chain;
+  chain.reserve(depth);
+  chain.push_back(Job::Create(TestJob1));
+  for (int i = 1; i < depth; ++i)
+  {
+    chain.push_back(Job::CreateChild(TestJob1, chain.back()));
+  }
+  JobHandle root = chain.front()->GetHandle();
+
+  for (Job* job : chain)
+  {
+    job->Run();
+  }
+
+  EXPECT_TRUE(root.IsFinished()) << "Finishing the leaf should finish the root";
+}
@@ -5,13 +5,24 @@
   Jake McLeman
 ***************************************************************************/
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <functional>
 #include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 #include "Job.h"
+#include "JobCoroutine.h"
+#include "JobFuture.h"
 #include "Manager.h"
+#include "TaskGraph.h"
+#include "Utility.h"
 
 using namespace JobBot;
 
@@ -141,6 +152,50 @@ TEST(ManagerTests, GetThisThreadsWorker)
       << "Single worker thread is not on main thread";
 }
 
+Worker* workerSeenByJob;
+Manager* jobsManager;
+void FindWorkerJobFunc(Job* job)
+{
+  UNUSED(job);
+  workerSeenByJob = jobsManager->GetThisThreadsWorker();
+}
+JobFunction FindWorkerJob(FindWorkerJobFunc);
+
+TEST(ManagerTests, GetThisThreadsWorkerSeveralManagers)
+{
+  Manager first(2);
+  Manager second(2);
+
+  Worker* firstWorker  = first.GetThisThreadsWorker();
+  Worker* secondWorker = second.GetThisThreadsWorker();
+  ASSERT_NE(nullptr, firstWorker);
+  ASSERT_NE(nullptr, secondWorker);
+  EXPECT_NE(firstWorker, secondWorker)
+      << "Each manager should find its own worker on this thread";
+
+  Worker* otherThreadsWorker = firstWorker;
+  std::thread other(
+      [&]() { otherThreadsWorker = first.GetThisThreadsWorker(); });
+  other.join();
+  EXPECT_EQ(nullptr, otherThreadsWorker)
+      << "Threads without a worker should not find one";
+
+  // Jobs always see the worker running them, whichever thread that is
+  workerSeenByJob = nullptr;
+  jobsManager     = &first;
+  Job* job        = Job::Create(FindWorkerJob);
+  first.SubmitJob(job);
+  firstWorker->WorkWhileWaitingFor(job);
+  ASSERT_NE(nullptr, workerSeenByJob);
+  EXPECT_EQ(workerSeenByJob,
+            first.GetWorkerByThreadID(workerSeenByJob->GetThreadID()));
+
+  // Stopping one manager leaves the other's worker in place
+  first.StopWorkers();
+  EXPECT_EQ(nullptr, first.GetThisThreadsWorker());
+  EXPECT_EQ(secondWorker, second.GetThisThreadsWorker());
+}
+
 TEST(ManagerTests, SingleThreadFewJobs)
 {
   Manager man(1);
@@ -244,6 +299,24 @@ TEST(ManagerTests, MultiThreadStartStop)
   std::this_thread::sleep_for(std::chrono::milliseconds(3));
 }
 
+TEST(ManagerTests, KeepsJobPoolLimit)
+{
+  constexpr size_t limit = JobPool::scDefaultMaxCapacity * 2;
+  JobPool::SetMaxCapacity(limit);
+
+  {
+    Manager man(1);
+    EXPECT_EQ(limit, JobPool::GetStats().maxCapacity)
+        << "A manager made with defaults should leave the limit alone";
+  }
+  {
+    Manager man(1, JobPool::scDefaultInitialCapacity,
+                JobPool::scDefaultMaxCapacity);
+    EXPECT_EQ(JobPool::scDefaultMaxCapacity,
+              JobPool::GetStats().maxCapacity);
+  }
+}
+
 TEST(ManagerTests, MultiThreadFewJobs)
 {
   constexpr size_t workersToUse = 4;
@@ -408,3 +481,1583 @@ TEST(ManagerTests, SingleThreadWillTakeAnyJob)
   EXPECT_TRUE(sleepyJob->IsFinished());
   EXPECT_TRUE(otherJob->IsFinished());
 }
+
+TEST(ManagerTests, SubmitJobsBatch)
+{
+  constexpr size_t jobsToMake = 300;
+  Job* jobs[jobsToMake];
+
+  Manager man(4);
+
+  Job* parentJob = Job::Create(Job1);
+  parentJob->SetAllowCompletion(false);
+  man.SubmitJob(parentJob);
+
+  // Mix of types so the batch is split between queues
+  for (unsigned i = 0; i < jobsToMake; ++i)
+  {
+    if (i % 3 == 0)
+      jobs[i] = Job::CreateChild(SleepJob, 0, parentJob);
+    else
+      jobs[i] = Job::CreateChild<float>(FloatsJob, (float)i, parentJob);
+  }
+
+  man.SubmitJobs(jobs, jobsToMake);
+  parentJob->SetAllowCompletion(true);
+
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(parentJob);
+
+  EXPECT_TRUE(parentJob->IsFinished()) << "Batch of jobs was not completed";
+}
+
+TEST(ManagerTests, SubmitJobsWithNullJob)
+{
+  Manager man(1);
+
+  Job* jobs[] = {Job::Create(Job1), nullptr};
+
+  bool exceptionThrown = false;
+  try
+  {
+    man.SubmitJobs(jobs, 2);
+  }
+  catch (JobRejected& e)
+  {
+    exceptionThrown = true;
+  }
+
+  EXPECT_TRUE(exceptionThrown) << "Exception was not thrown";
+
+  // Nothing from the rejected batch should have been queued
+  jobs[0]->Run();
+  EXPECT_TRUE(jobs[0]->IsFinished());
+}
+
+void AddOneParallel(Job* job, int* data, size_t count)
+{
+  UNUSED(job);
+  for (size_t i = 0; i < count; ++i)
+  {
+    ++data[i];
+  }
+}
+
+TEST(ManagerTests, ParallelFor)
+{
+  constexpr size_t elements = 10000;
+  static int data[elements];
+  std::fill(data, data + elements, 0);
+
+  Manager man(4);
+
+  Job* job = Utilities::ParallelForJob<int>(&man, AddOneParallel, data,
+                                            elements, 64);
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+
+  EXPECT_EQ(elements, (size_t)std::count(data, data + elements, 1))
+      << "Not every element was visited exactly once";
+}
+
+TEST(ManagerTests, ParallelForBulk)
+{
+  constexpr size_t elements = 10000;
+  static int data[elements];
+  std::fill(data, data + elements, 0);
+
+  Manager man(4);
+
+  Job* job = Utilities::ParallelForBulkJob<int>(&man, AddOneParallel, data,
+                                                elements, 64);
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+
+  EXPECT_EQ(elements, (size_t)std::count(data, data + elements, 1))
+      << "Not every element was visited exactly once";
+}
+
+std::atomic_int tinyJobsRun(0);
+DECLARE_TINY_JOB(CountingTinyJob)
+{
+  UNUSED(job);
+  ++tinyJobsRun;
+}
+
+TEST(ManagerTests, ManyTinyJobsFromOtherThread)
+{
+  constexpr int jobsToMake = 4096;
+  tinyJobsRun              = 0;
+
+  Manager man(4);
+
+  Job* parentJob = Job::Create(Job1);
+  parentJob->SetAllowCompletion(false);
+
+  // Submitting from outside the workers puts everything in the shared
+  // queues, which workers then take from in batches
+  std::thread producer([&]() {
+    for (int i = 0; i < jobsToMake; ++i)
+    {
+      man.SubmitJob(Job::CreateChild(CountingTinyJob, parentJob));
+    }
+  });
+  producer.join();
+
+  man.SubmitJob(parentJob);
+  parentJob->SetAllowCompletion(true);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(parentJob);
+
+  EXPECT_EQ(jobsToMake, tinyJobsRun.load())
+      << "Every tiny job should run exactly once";
+}
+
+TEST(ManagerTests, PowerSavingWorkersPark)
+{
+  Manager man(2, JobPool::scDefaultInitialCapacity,
+              JobPool::scDefaultMaxCapacity,
+              Worker::IdlePolicy::PowerSaving);
+
+  // Give the primary worker time to run out of work
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  Worker::IdleStats stats = man.GetIdleStats();
+  EXPECT_GT(stats.parkCount, 0u) << "Idle worker should have gone to sleep";
+  EXPECT_EQ(0u, stats.spinCount) << "Power saving workers should not spin";
+
+  // Sleeping workers still wake up for new jobs
+  tinyJobsRun = 0;
+  Job* parentJob = Job::Create(Job1);
+  parentJob->SetAllowCompletion(false);
+  for (int i = 0; i < 64; ++i)
+  {
+    man.SubmitJob(Job::CreateChild(CountingTinyJob, parentJob));
+  }
+  man.SubmitJob(parentJob);
+  parentJob->SetAllowCompletion(true);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(parentJob);
+
+  EXPECT_EQ(64, tinyJobsRun.load());
+}
+
+TEST(ManagerTests, WaitersWokenByFinishedJobs)
+{
+  typedef std::chrono::steady_clock Clock;
+  constexpr int waits = 10;
+
+  // The main thread doesn't work here, so the two primary workers take
+  // everything and park as soon as they are idle
+  Manager man(3, JobPool::scDefaultInitialCapacity, 0,
+              Worker::IdlePolicy::PowerSaving);
+
+  std::chrono::microseconds totalLate(0);
+  for (int i = 0; i < waits; ++i)
+  {
+    std::atomic_bool started(false);
+    std::atomic_bool done(false);
+    Clock::time_point finishedAt;
+    Clock::time_point wokenAt;
+
+    Job* slow = Job::Create([&]() {
+      started = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      finishedAt = Clock::now();
+    });
+    JobHandle slowHandle = slow->GetHandle();
+    man.SubmitJob(slow);
+    while (!started)
+    {
+      std::this_thread::yield();
+    }
+
+    // Runs on the other worker, which has nothing to do but wait
+    man.SubmitJob(Job::Create([&]() {
+      man.GetThisThreadsWorker()->WorkWhileWaitingFor(slowHandle);
+      wokenAt = Clock::now();
+      done    = true;
+    }));
+    while (!done)
+    {
+      std::this_thread::yield();
+    }
+
+    totalLate += std::chrono::duration_cast<std::chrono::microseconds>(
+        wokenAt - finishedAt);
+  }
+
+  EXPECT_LT(totalLate.count() / waits,
+            Worker::IdlePolicy::PowerSaving.maxParkTime.count() / 4)
+      << "Waiters should be woken when the job they wait on finishes";
+}
+
+TEST(ManagerTests, SetIdlePolicy)
+{
+  Manager man(2);
+  EXPECT_EQ(Worker::IdlePolicy::Balanced.spinSteps,
+            man.GetIdlePolicy().spinSteps);
+
+  man.SetIdlePolicy(Worker::IdlePolicy::LowLatency);
+  EXPECT_EQ(Worker::IdlePolicy::LowLatency.spinSteps,
+            man.GetIdlePolicy().spinSteps);
+  EXPECT_EQ(Worker::IdlePolicy::LowLatency.spinSteps,
+            man.GetThisThreadsWorker()->GetIdlePolicy().spinSteps)
+      << "Workers should be restarted with the new policy";
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_GT(man.GetIdleStats().spinCount, 0u);
+
+  jobFunc1HasRun = false;
+  Job* job       = Job::Create(Job1);
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+  EXPECT_TRUE(jobFunc1HasRun);
+}
+
+TEST(ManagerTests, RestartKeepsQueuedJobs)
+{
+  // Only the main thread works, so everything it submits sits in its own
+  // queues until it waits
+  Manager man(1);
+  tinyJobsRun = 0;
+
+  Job* parentJob = Job::Create(Job1);
+  parentJob->SetAllowCompletion(false);
+  for (int i = 0; i < 64; ++i)
+  {
+    man.SubmitJob(Job::CreateChild(CountingTinyJob, parentJob));
+  }
+  man.SubmitJob(parentJob);
+  parentJob->SetAllowCompletion(true);
+  EXPECT_EQ(65u, man.GetThisThreadsWorker()->GetLocalJobCount());
+
+  // Restarting replaces the worker, whose queued jobs must not go with it
+  man.SetIdlePolicy(Worker::IdlePolicy::PowerSaving);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(parentJob);
+
+  EXPECT_EQ(64, tinyJobsRun.load());
+}
+
+std::atomic_bool blockerStarted(false);
+std::atomic_bool releaseBlocker(false);
+DECLARE_TINY_JOB(BlockerJob)
+{
+  UNUSED(job);
+  blockerStarted = true;
+  while (!releaseBlocker)
+  {
+    std::this_thread::yield();
+  }
+}
+
+TEST(ManagerTests, GetBusiestWorker)
+{
+  constexpr int jobsToMake = 100;
+  blockerStarted           = false;
+  releaseBlocker           = false;
+  tinyJobsRun              = 0;
+
+  Manager man(2);
+  Worker* mainWorker = man.GetThisThreadsWorker();
+
+  // Keep the primary worker busy so nobody takes jobs from the main thread
+  Job* blocker = Job::Create(BlockerJob);
+  man.SubmitJob(blocker);
+  while (!blockerStarted)
+  {
+    std::this_thread::yield();
+  }
+
+  Job* parentJob = Job::Create(Job1);
+  parentJob->SetAllowCompletion(false);
+  for (int i = 0; i < jobsToMake; ++i)
+  {
+    man.SubmitJob(Job::CreateChild(CountingTinyJob, parentJob));
+  }
+
+  EXPECT_EQ(mainWorker, man.GetBusiestWorker())
+      << "Jobs submitted from the main thread should be in its worker";
+  EXPECT_EQ(static_cast<size_t>(jobsToMake),
+            mainWorker->GetLocalJobCount(JobType::Tiny));
+  EXPECT_EQ(0u, mainWorker->GetLocalJobCount(JobType::Misc));
+
+  releaseBlocker = true;
+  man.SubmitJob(parentJob);
+  parentJob->SetAllowCompletion(true);
+  mainWorker->WorkWhileWaitingFor(parentJob);
+  mainWorker->WorkWhileWaitingFor(blocker);
+
+  EXPECT_EQ(jobsToMake, tinyJobsRun.load());
+
+  man.StopWorkers();
+  EXPECT_EQ(nullptr, man.GetBusiestWorker())
+      << "There is no busiest worker when none are running";
+}
+
+TEST(ManagerTests, WaitOnHandles)
+{
+  constexpr int jobsToMake = 256;
+  tinyJobsRun              = 0;
+
+  Manager man(4);
+
+  // Nothing holds these jobs open, so they are reused as soon as they
+  // finish while the handles are still being waited on
+  std::vector<JobHandle> handles;
+  for (int i = 0; i < jobsToMake; ++i)
+  {
+    Job* job = Job::Create(CountingTinyJob);
+    handles.push_back(job->GetHandle());
+    man.SubmitJob(job);
+  }
+
+  for (const JobHandle& handle : handles)
+  {
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+    EXPECT_TRUE(handle.IsFinished());
+  }
+  EXPECT_EQ(jobsToMake, tinyJobsRun.load());
+
+  // Threads that aren't workers can wait on a handle too
+  jobFunc1HasRun   = false;
+  Job* job         = Job::Create(Job1);
+  JobHandle handle = job->GetHandle();
+  std::thread waiter([&]() { handle.Wait(); });
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  waiter.join();
+  EXPECT_TRUE(jobFunc1HasRun);
+}
+
+std::atomic_int orderCounter(0);
+DECLARE_TINY_JOB(RecordOrderJob)
+{
+  // Each job stores when it ran into the int its data points at
+  *job->GetData<int*>() = orderCounter++;
+}
+
+TEST(ManagerTests, DependencyFanIn)
+{
+  orderCounter = 0;
+  int aRan = -1, bRan = -1, cRan = -1;
+
+  Manager man(4);
+
+  Job* a = Job::Create(RecordOrderJob, &aRan);
+  Job* b = Job::Create(RecordOrderJob, &bRan);
+  Job* c = Job::Create(RecordOrderJob, &cRan);
+  c->AddDependency(a);
+  c->AddDependency(b);
+  JobHandle cHandle = c->GetHandle();
+
+  // Submitted first, but held back until both a and b are done
+  man.SubmitJob(c);
+  man.SubmitJob(a);
+  man.SubmitJob(b);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(cHandle);
+
+  EXPECT_EQ(3, orderCounter.load()) << "Every job should run once";
+  EXPECT_GT(cRan, aRan) << "c ran before a finished";
+  EXPECT_GT(cRan, bRan) << "c ran before b finished";
+}
+
+TEST(ManagerTests, DependencyChain)
+{
+  constexpr int chainLength = 200;
+  orderCounter              = 0;
+  static int ran[chainLength];
+
+  Manager man(4);
+
+  // Each job depends on the one before it, submitted all at once in
+  // reverse so nothing would run in order by accident
+  Job* jobs[chainLength];
+  for (int i = 0; i < chainLength; ++i)
+  {
+    ran[i]  = -1;
+    jobs[i] = Job::Create(RecordOrderJob, &ran[i]);
+    if (i > 0) jobs[i]->AddDependency(jobs[i - 1]);
+  }
+  JobHandle last = jobs[chainLength - 1]->GetHandle();
+
+  std::reverse(jobs, jobs + chainLength);
+  man.SubmitJobs(jobs, chainLength);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(last);
+
+  for (int i = 0; i < chainLength; ++i)
+  {
+    EXPECT_EQ(i, ran[i]) << "Job " << i << " ran out of order";
+  }
+}
+
+TEST(ManagerTests, TaskGraphReplay)
+{
+  Manager man(4);
+
+  // Diamond: a before b and c, both before d
+  int ran[4];
+  TaskGraph graph;
+  TaskGraph::Node a = graph.AddNode(RecordOrderJob, &ran[0]);
+  TaskGraph::Node b = graph.AddNode(RecordOrderJob, &ran[1]);
+  TaskGraph::Node c = graph.AddNode(RecordOrderJob, &ran[2]);
+  TaskGraph::Node d = graph.AddNode(RecordOrderJob, &ran[3]);
+  graph.AddDependency(a, b);
+  graph.AddDependency(a, c);
+  graph.AddDependency(b, d);
+  graph.AddDependency(c, d);
+  EXPECT_EQ(4u, graph.GetNodeCount());
+
+  for (int run = 0; run < 3; ++run)
+  {
+    orderCounter = 0;
+    std::fill(ran, ran + 4, -1);
+
+    graph.RunAndWait(man);
+
+    EXPECT_TRUE(graph.IsFinished());
+    EXPECT_EQ(4, orderCounter.load()) << "Every node should run once per run";
+    EXPECT_EQ(0, ran[a]);
+    EXPECT_GT(ran[d], ran[b]);
+    EXPECT_GT(ran[d], ran[c]);
+    EXPECT_EQ(3, ran[d]);
+  }
+
+  // Node data can be changed between runs
+  int patched = -1;
+  graph.GetData<int*>(d) = &patched;
+  orderCounter = 0;
+  graph.RunAndWait(man);
+  EXPECT_EQ(3, patched) << "Patched data should be used on the next run";
+}
+
+TaskGraph* graphToCancel;
+DECLARE_TINY_JOB(CancelGraphJob)
+{
+  UNUSED(job);
+  if (graphToCancel != nullptr) graphToCancel->Cancel();
+}
+
+TEST(ManagerTests, TaskGraphCancel)
+{
+  Manager man(2);
+
+  int ran = -1;
+  TaskGraph graph;
+  TaskGraph::Node first  = graph.AddNode(CancelGraphJob);
+  TaskGraph::Node second = graph.AddNode(RecordOrderJob, &ran);
+  graph.AddDependency(first, second);
+
+  graphToCancel = &graph;
+  graph.RunAndWait(man);
+  EXPECT_EQ(-1, ran) << "Nodes after a cancel should be skipped";
+
+  // Cancelling only lasts for one run
+  graphToCancel = nullptr;
+  orderCounter  = 0;
+  graph.RunAndWait(man);
+  EXPECT_EQ(0, ran) << "Graph should run normally after being cancelled";
+}
+
+std::atomic_int childCallbacksRun(0);
+int childCallbacksSeenByParent = -1;
+DECLARE_JOB(ChildCallbackJob)
+{
+  UNUSED(job);
+  ++childCallbacksRun;
+}
+DECLARE_JOB(ParentCallbackJob)
+{
+  UNUSED(job);
+  childCallbacksSeenByParent = childCallbacksRun.load();
+}
+
+TEST(ManagerTests, CallbacksAsJobs)
+{
+  constexpr int children      = 64;
+  childCallbacksRun           = 0;
+  childCallbacksSeenByParent  = -1;
+
+  Manager man(4);
+
+  Job* parent = Job::Create(Job1);
+  parent->SetCallback(ParentCallbackJob, true);
+  for (int i = 0; i < children; ++i)
+  {
+    Job* child = Job::CreateChild(CountingTinyJob, parent);
+    child->SetCallback(ChildCallbackJob, true);
+    man.SubmitJob(child);
+  }
+  JobHandle handle = parent->GetHandle();
+  man.SubmitJob(parent);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_EQ(children, childCallbacksRun.load());
+  EXPECT_EQ(children, childCallbacksSeenByParent)
+      << "Parent finished before its children's callbacks ran";
+
+  // Waiting on the job itself waits for its callback too
+  for (int i = 0; i < 20; ++i)
+  {
+    childCallbacksRun = 0;
+    Job* job          = Job::Create(Job1);
+    job->SetCallback(ChildCallbackJob, true);
+    man.SubmitJob(job);
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(job);
+    EXPECT_EQ(1, childCallbacksRun.load());
+  }
+
+  // Jobs that were never submitted have nowhere to send the callback, so
+  // it runs right away
+  childCallbacksRun     = 0;
+  Job* job              = Job::Create(Job1);
+  JobHandle unsubmitted = job->GetHandle();
+  job->SetCallback(ChildCallbackJob, true);
+  job->Run();
+  EXPECT_EQ(1, childCallbacksRun.load());
+  EXPECT_TRUE(unsubmitted.IsFinished());
+}
+
+TEST(ManagerTests, LambdaJobs)
+{
+  Manager man(4);
+
+  // Small captures, with and without the job
+  std::atomic_int sum(0);
+  Job* parent = Job::Create([&man, &sum](Job* job) {
+    for (int i = 1; i <= 10; ++i)
+    {
+      man.SubmitJob(
+          Job::CreateChild([&sum, i]() { sum += i; }, job, JobType::Tiny));
+    }
+  });
+  JobHandle handle = parent->GetHandle();
+  man.SubmitJob(parent);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_EQ(55, sum.load());
+
+  // Move only captures are moved in, and destroyed once the job is done
+  std::shared_ptr<int> shared = std::make_shared<int>(7);
+  std::unique_ptr<int> owned(new int(3));
+  int product = 0;
+  struct MoveOnlyJob
+  {
+    std::unique_ptr<int> value;
+    std::shared_ptr<int> other;
+    int* product;
+    void operator()() { *product = *value * *other; }
+  };
+  {
+    Job* job = Job::Create(MoveOnlyJob{std::move(owned), shared, &product});
+    handle   = job->GetHandle();
+    man.SubmitJob(job);
+  }
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_EQ(21, product);
+  EXPECT_EQ(1, shared.use_count()) << "Capture should have been destroyed";
+
+  // Captures too big for the padding go to the payload arena
+  std::array<int, 100> big;
+  big.fill(2);
+  int bigSum = 0;
+  Job* bigJob = Job::Create([big, &bigSum]() {
+    for (int value : big) bigSum += value;
+  });
+  handle = bigJob->GetHandle();
+  man.SubmitJob(bigJob);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_EQ(200, bigSum);
+}
+
+int FutureFibonacci(Manager& man, int n)
+{
+  if (n < 2) return n;
+
+  // Get runs other jobs while it waits, so nesting these can't deadlock
+  JobFuture<int> left =
+      Job::Create([&man, n]() { return FutureFibonacci(man, n - 1); });
+  man.SubmitJob(left.GetJob());
+  int right = FutureFibonacci(man, n - 2);
+  return left.Get() + right;
+}
+
+TEST(ManagerTests, Futures)
+{
+  Manager man(4);
+
+  JobFuture<int> answer = Job::Create([]() { return 42; });
+  man.SubmitJob(answer.GetJob());
+  EXPECT_EQ(42, answer.Get());
+  EXPECT_FALSE(answer.IsValid());
+
+  // Callables can take the job running them, and a type
+  JobFuture<bool> isTiny = Job::Create(
+      [](Job* job) { return job->MatchesType(JobType::Tiny); }, JobType::Tiny);
+  man.SubmitJob(isTiny.GetJob());
+  EXPECT_TRUE(isTiny.Get());
+
+  EXPECT_EQ(144, FutureFibonacci(man, 12));
+
+  // Results that need destructing, from a thread that isn't a worker
+  std::vector<int> numbers = {1, 2, 3};
+  JobFuture<std::vector<int>> doubled;
+  std::thread asker([&]() {
+    doubled = Job::Create([numbers]() {
+      std::vector<int> result;
+      for (int number : numbers) result.push_back(number * 2);
+      return result;
+    });
+    man.SubmitJob(doubled.GetJob());
+    EXPECT_EQ(std::vector<int>({2, 4, 6}), doubled.Get());
+  });
+  asker.join();
+
+  // Futures that are dropped still let their job run and clean up
+  tinyJobsRun = 0;
+  JobHandle ignoredHandle;
+  {
+    JobFuture<int> ignored = Job::Create([]() { return ++tinyJobsRun; });
+    ignoredHandle          = ignored.GetHandle();
+    man.SubmitJob(ignored.GetJob());
+  }
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(ignoredHandle);
+  EXPECT_EQ(1, tinyJobsRun.load());
+}
+
+TEST(ManagerTests, FutureLargeResult)
+{
+  typedef std::array<int, 64> Big;
+
+  Manager man(2);
+
+  // Too big for the job's padding, so kept in the payload arena
+  std::vector<JobFuture<Big>> futures;
+  for (int i = 0; i < 100; ++i)
+  {
+    futures.push_back(Job::Create([i]() {
+      Big result;
+      result.fill(i);
+      return result;
+    }));
+    man.SubmitJob(futures.back().GetJob());
+  }
+
+  for (int i = 0; i < 100; ++i)
+  {
+    Big result = futures[i].Get();
+    EXPECT_EQ(i, result.front());
+    EXPECT_EQ(i, result.back());
+  }
+}
+
+TEST(ManagerTests, FutureCancelled)
+{
+  Manager man(2);
+
+  JobFuture<int> future = Job::Create([]() { return 1; });
+  future.GetJob()->Cancel();
+  man.SubmitJob(future.GetJob());
+  EXPECT_THROW(future.Get(), JobCancelled);
+  EXPECT_FALSE(future.IsValid());
+}
+
+DECLARE_JOB(ThrowingJob)
+{
+  UNUSED(job);
+  throw std::runtime_error("job failed");
+}
+
+TEST(ManagerTests, ExceptionsReachWaiters)
+{
+  Manager man(4);
+
+  // Waiting on the job that threw, by handle
+  Job* job         = Job::Create(ThrowingJob);
+  JobHandle handle = job->GetHandle();
+  man.SubmitJob(job);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle),
+               std::runtime_error);
+
+  // Waiting on the root of the tree it was in, even after the rest of the
+  // tree carried on
+  tinyJobsRun          = 0;
+  Job* root            = Job::Create(Job1);
+  JobHandle rootHandle = root->GetHandle();
+  man.SubmitJob(Job::CreateChild(ThrowingJob, root));
+  man.SubmitJob(Job::CreateChild(CountingTinyJob, root));
+  man.SubmitJob(root);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(rootHandle),
+               std::runtime_error);
+  EXPECT_EQ(1, tinyJobsRun.load()) << "Sibling should still have run";
+
+  // Exceptions are only thrown once
+  EXPECT_NO_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle));
+
+  // Futures throw from Get
+  JobFuture<int> future = Job::Create([]() -> int {
+    throw std::logic_error("no result");
+  });
+  man.SubmitJob(future.GetJob());
+  EXPECT_THROW(future.Get(), std::logic_error);
+  EXPECT_FALSE(future.IsValid());
+
+  // The worker threads are all still alive
+  JobFuture<int> answer = Job::Create([]() { return 42; });
+  man.SubmitJob(answer.GetJob());
+  EXPECT_EQ(42, answer.Get());
+
+  // Nothing is left behind once everything has been waited on
+  EXPECT_EQ(0u, JobErrors::GetStoredCount());
+}
+
+DECLARE_JOB(ThrowingCallbackJob)
+{
+  UNUSED(job);
+  throw std::runtime_error("callback failed");
+}
+
+TEST(ManagerTests, ThrowingCallbackAsJob)
+{
+  Manager man(4);
+
+  // The job still finishes, and the error is thrown from its own handle
+  Job* job         = Job::Create(Job1);
+  JobHandle handle = job->GetHandle();
+  job->SetCallback(ThrowingCallbackJob, true);
+  man.SubmitJob(job);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle),
+               std::runtime_error);
+  EXPECT_TRUE(handle.IsFinished());
+
+  // And so does the rest of the tree above it
+  Job* root            = Job::Create(Job1);
+  JobHandle rootHandle = root->GetHandle();
+  Job* child           = Job::CreateChild(Job1, root);
+  child->SetCallback(ThrowingCallbackJob, true);
+  man.SubmitJob(child);
+  man.SubmitJob(root);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(rootHandle),
+               std::runtime_error);
+  EXPECT_TRUE(rootHandle.IsFinished());
+
+  EXPECT_EQ(0u, JobErrors::GetStoredCount());
+}
+
+TEST(ManagerTests, CancelOnException)
+{
+  Manager man(2);
+
+  tinyJobsRun = 0;
+  Job* root   = Job::Create(Job1);
+  root->SetCancelOnException(true);
+
+  // The second child only runs after the first has thrown
+  Job* thrower = Job::CreateChild(ThrowingJob, root);
+  Job* after   = Job::CreateChild(CountingTinyJob, root);
+  after->AddDependency(thrower);
+  JobHandle handle = root->GetHandle();
+
+  man.SubmitJob(after);
+  man.SubmitJob(thrower);
+  man.SubmitJob(root);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle),
+               std::runtime_error);
+  EXPECT_EQ(0, tinyJobsRun.load()) << "Rest of the tree should be cancelled";
+}
+
+TEST(ManagerTests, PriorityOrder)
+{
+  // One worker so the order jobs are taken in is the order they run in
+  Manager man(1);
+  man.SetPriorityAging(std::chrono::microseconds::zero());
+
+  std::vector<unsigned> order;
+  Job* root                   = Job::Create(Job1);
+  JobHandle handle            = root->GetHandle();
+  const unsigned priorities[] = {3, 1, 2, 0, 3, 2, 0, 1, 2, 3, 1, 0};
+
+  for (unsigned priority : priorities)
+  {
+    Job* job = Job::CreateChild(
+        [&order, priority]() { order.push_back(priority); }, root);
+    job->SetPriority(priority);
+    man.SubmitJob(job);
+  }
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  ASSERT_EQ(sizeof(priorities) / sizeof(priorities[0]), order.size());
+  EXPECT_TRUE(std::is_sorted(order.begin(), order.end()))
+      << "More urgent jobs should always be taken first";
+}
+
+TEST(ManagerTests, PriorityAging)
+{
+  Manager man(1);
+  man.SetPriorityAging(std::chrono::microseconds(200));
+  man.SetWaitTracking(true);
+
+  // A stream of urgent jobs that keeps going until the less urgent job has
+  // had a turn, or long after it would have had one with aging
+  constexpr int maxUrgentJobs = 10000;
+  std::atomic_bool lowRan(false);
+  std::atomic_int urgentRan(0);
+
+  Job* root        = Job::Create(Job1);
+  JobHandle handle = root->GetHandle();
+
+  std::function<void()> submitUrgent = [&]() {
+    Job* urgent = Job::CreateChild(
+        [&]() {
+          std::chrono::steady_clock::time_point end =
+              std::chrono::steady_clock::now() +
+              std::chrono::microseconds(20);
+          while (std::chrono::steady_clock::now() < end)
+          {
+          }
+
+          if (++urgentRan < maxUrgentJobs && !lowRan)
+          {
+            submitUrgent();
+          }
+        },
+        root);
+    urgent->SetPriority(0);
+    man.SubmitJob(urgent);
+  };
+
+  Job* low = Job::CreateChild([&]() { lowRan = true; }, root);
+  low->SetPriority(Job::NUM_PRIORITIES - 1);
+  man.SubmitJob(low);
+  submitUrgent();
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_TRUE(lowRan.load());
+  EXPECT_LT(urgentRan.load(), maxUrgentJobs)
+      << "Less urgent job should have been aged ahead of the urgent ones";
+
+  Worker::PriorityStats stats = man.GetPriorityStats();
+  EXPECT_EQ(1u, stats.agedJobs[Job::NUM_PRIORITIES - 1]);
+  EXPECT_EQ(1u, stats.timedJobs[Job::NUM_PRIORITIES - 1]);
+  EXPECT_EQ(static_cast<std::uint64_t>(urgentRan.load()),
+            stats.timedJobs[0]);
+  EXPECT_GE(stats.maxWait[Job::NUM_PRIORITIES - 1], 200u)
+      << "Job should have waited at least as long as the aging time";
+}
+
+TEST(ManagerTests, DeadlineOrder)
+{
+  // The volunteer worker schedules earliest deadline first. The other one
+  // is kept busy so the order jobs are taken in is the order they run in
+  Manager man(2);
+
+  std::atomic_bool blockerStarted(false);
+  std::atomic_bool releaseBlocker(false);
+  std::atomic_bool blockerDone(false);
+  man.SubmitJob(Job::Create([&]() {
+    blockerStarted = true;
+    while (!releaseBlocker)
+    {
+      std::this_thread::yield();
+    }
+    blockerDone = true;
+  }));
+  while (!blockerStarted)
+  {
+    std::this_thread::yield();
+  }
+
+  // Jobs without a deadline are marked with -1, and are as urgent as jobs
+  // can be, but still come after every job with a deadline
+  std::vector<int> order;
+  Job* root                = Job::Create(Job1);
+  JobHandle handle         = root->GetHandle();
+  const int milliseconds[] = {40, -1, 10, 30, -1, 20, 50, 0, -1};
+
+  for (int deadline : milliseconds)
+  {
+    Job* job = Job::CreateChild(
+        [&order, deadline]() { order.push_back(deadline); }, root);
+    job->SetPriority(0);
+    if (deadline >= 0)
+    {
+      job->SetDeadline(std::chrono::seconds(1) +
+                       std::chrono::milliseconds(deadline));
+    }
+    man.SubmitJob(job);
+  }
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  releaseBlocker = true;
+  while (!blockerDone)
+  {
+    std::this_thread::yield();
+  }
+
+  const std::vector<int> expected = {0, 10, 20, 30, 40, 50, -1, -1, -1};
+  EXPECT_EQ(expected, order)
+      << "Jobs with a deadline should come first, soonest deadline first";
+
+  Worker::DeadlineStats stats = man.GetDeadlineStats();
+  EXPECT_EQ(6u, stats.deadlineJobs);
+  EXPECT_EQ(0u, stats.missedDeadlines);
+}
+
+TEST(ManagerTests, DeadlineMisses)
+{
+  // The only worker doesn't go by deadline, so this also checks that jobs
+  // with a deadline still get run by workers that don't
+  Manager man(1);
+
+  Job* root        = Job::Create(Job1);
+  JobHandle handle = root->GetHandle();
+
+  Job* late = Job::CreateChild(Job2, root);
+  late->SetDeadline(std::chrono::steady_clock::now() -
+                    std::chrono::milliseconds(2));
+  man.SubmitJob(late);
+
+  Job* onTime = Job::CreateChild(Job2, root);
+  onTime->SetDeadline(std::chrono::seconds(10));
+  man.SubmitJob(onTime);
+
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  Worker::DeadlineStats stats = man.GetDeadlineStats();
+  EXPECT_EQ(2u, stats.deadlineJobs);
+  EXPECT_EQ(1u, stats.missedDeadlines);
+  EXPECT_GE(stats.maxLateness, 2000u);
+  EXPECT_EQ(stats.maxLateness, stats.totalLateness);
+}
+
+TEST(ManagerTests, DelayedJobs)
+{
+  Manager man(2);
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+
+  // Long enough apart to land in different levels of the timer wheel
+  const int milliseconds[] = {20, 1, 5, 0, 40};
+  std::atomic_int ran(0);
+  std::atomic_int early(0);
+
+  Job* root        = Job::Create(Job1);
+  JobHandle handle = root->GetHandle();
+  for (int delay : milliseconds)
+  {
+    man.SubmitJobAfter(
+        Job::CreateChild(
+            [&, delay]() {
+              if (Clock::now() - start < std::chrono::milliseconds(delay))
+              {
+                ++early;
+              }
+              ++ran;
+            },
+            root),
+        std::chrono::milliseconds(delay));
+  }
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_EQ(5, ran.load());
+  EXPECT_EQ(0, early.load()) << "Delayed jobs should never run early";
+  EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(40));
+}
+
+TEST(ManagerTests, PeriodicJobs)
+{
+  // The main thread never works here, so the other worker has to wake up
+  // for the timer by itself
+  Manager man(2);
+
+  std::atomic_int runs(0);
+  TimerWheel::TimerID timer =
+      man.SubmitJobEvery(std::chrono::milliseconds(2), [&runs]() {
+        return Job::Create([&runs]() { ++runs; });
+      });
+
+  const auto giveUp =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (runs.load() < 5 && std::chrono::steady_clock::now() < giveUp)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_GE(runs.load(), 5);
+
+  EXPECT_TRUE(man.CancelTimer(timer));
+  EXPECT_FALSE(man.CancelTimer(timer)) << "Timers can only be cancelled once";
+
+  // A job made just before cancelling may still run
+  const int cancelledAt = runs.load();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_LE(runs.load(), cancelledAt + 1);
+}
+
+TEST(ManagerTests, CancelDelayedJob)
+{
+  Manager man(2);
+
+  std::atomic_bool ran(false);
+  Job* root        = Job::Create(Job1);
+  JobHandle handle = root->GetHandle();
+  TimerWheel::TimerID timer = man.SubmitJobAfter(
+      Job::CreateChild([&ran]() { ran = true; }, root),
+      std::chrono::seconds(100));
+  man.SubmitJob(root);
+
+  EXPECT_TRUE(man.CancelTimer(timer));
+
+  // The cancelled job is still submitted, so the root can finish
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_FALSE(ran.load());
+}
+
+TEST(ManagerTests, DelayedJobsWhileWorkersBusy)
+{
+  // The main thread never works here, and the other worker is kept busy by
+  // a chain of jobs, so it never goes to sleep and watches the timers
+  Manager man(2);
+
+  // About 200ms of work, much longer than the delay
+  typedef std::chrono::steady_clock Clock;
+  std::atomic_int linksLeft(200);
+  std::function<void()> spin = [&]() {
+    const Clock::time_point end = Clock::now() + std::chrono::milliseconds(1);
+    while (Clock::now() < end)
+    {
+    }
+    if (--linksLeft > 0)
+    {
+      man.SubmitJob(Job::Create(spin));
+    }
+  };
+  man.SubmitJob(Job::Create(spin));
+
+  std::atomic_int linksLeftWhenRun(-1);
+  man.SubmitJobAfter(
+      Job::Create([&]() { linksLeftWhenRun = linksLeft.load(); }),
+      std::chrono::milliseconds(5));
+
+  // Wait for the whole chain too, since it uses things on this stack
+  const Clock::time_point giveUp = Clock::now() + std::chrono::seconds(10);
+  while ((linksLeftWhenRun.load() < 0 || linksLeft.load() > 0) &&
+         Clock::now() < giveUp)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  ASSERT_GE(linksLeftWhenRun.load(), 0) << "Delayed job never ran";
+  EXPECT_GT(linksLeftWhenRun.load(), 0)
+      << "Busy workers should still look at the timers";
+}
+
+TEST(ManagerTests, DelayedJobsCancelledOnShutdown)
+{
+  std::atomic_bool ran(false);
+  JobFuture<int> future;
+  JobHandle handle;
+  {
+    Manager man(2);
+
+    future = Job::Create([&ran]() {
+      ran = true;
+      return 1;
+    });
+    handle = future.GetJob()->GetHandle();
+    man.SubmitJobAfter(future.GetJob(), std::chrono::seconds(100));
+  }
+
+  // The manager finished the job on its way out, rather than dropping it
+  EXPECT_TRUE(handle.IsFinished());
+  EXPECT_THROW(future.Get(), JobCancelled);
+  EXPECT_FALSE(ran.load());
+}
+
+#ifdef JOBBOT_COROUTINES
+JobTask AwaitingTask(Manager& man, std::atomic_int& children,
+                     std::vector<int>& seen)
+{
+  co_await Submit(Job::Create([&children]() { ++children; }));
+  seen.push_back(children.load());
+
+  Job* batch[8];
+  for (Job*& job : batch)
+  {
+    job = Job::Create([&children]() { ++children; });
+  }
+  co_await Submit(batch, 8);
+  seen.push_back(children.load());
+
+  JobFuture<int> future = Job::Create([]() { return 42; });
+  man.SubmitJob(future.GetJob());
+  seen.push_back(co_await future);
+
+  const auto start = std::chrono::steady_clock::now();
+  co_await Delay(std::chrono::milliseconds(5));
+  seen.push_back(std::chrono::steady_clock::now() - start >=
+                 std::chrono::milliseconds(5));
+}
+
+TEST(ManagerTests, CoroutineJobs)
+{
+  Manager man(2);
+
+  std::atomic_int children(0);
+  std::vector<int> seen;
+  Job* task        = AwaitingTask(man, children, seen).GetJob();
+  JobHandle handle = task->GetHandle();
+  man.SubmitJob(task);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_EQ(std::vector<int>({1, 9, 42, 1}), seen);
+
+  // Lots of them at once, suspended while far fewer workers get on with
+  // other things
+  std::atomic_int finished(0);
+  std::vector<JobHandle> handles;
+  for (int i = 0; i < 100; ++i)
+  {
+    Job* counter = [](std::atomic_int& count) -> JobTask {
+      co_await Submit(Job::Create([]() {}));
+      co_await Delay(std::chrono::milliseconds(1));
+      ++count;
+    }(finished).GetJob();
+    handles.push_back(counter->GetHandle());
+    man.SubmitJob(counter);
+  }
+  for (const JobHandle& counter : handles)
+  {
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(counter);
+  }
+  EXPECT_EQ(100, finished.load());
+}
+
+TEST(ManagerTests, CoroutineFailures)
+{
+  Manager man(2);
+
+  // Exceptions reach whoever waits on the task, even thrown after it has
+  // been resumed on another worker
+  Job* thrower = []() -> JobTask {
+    co_await Submit(Job::Create([]() {}));
+    throw std::runtime_error("task failed");
+  }().GetJob();
+  JobHandle handle = thrower->GetHandle();
+  man.SubmitJob(thrower);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle),
+               std::runtime_error);
+  EXPECT_EQ(0u, JobErrors::GetStoredCount())
+      << "Only the task's job should have kept the exception";
+
+  // Cancelled tasks are destroyed where they are waiting
+  std::atomic_bool waiting(false);
+  std::atomic_bool ran(false);
+  std::atomic_bool destroyed(false);
+  Job* sleeper = [](std::atomic_bool& waiting, std::atomic_bool& ran,
+                    std::atomic_bool& destroyed) -> JobTask {
+    std::shared_ptr<void> guard(nullptr,
+                                [&destroyed](void*) { destroyed = true; });
+    waiting = true;
+    co_await Delay(std::chrono::milliseconds(50));
+    ran = true;
+  }(waiting, ran, destroyed).GetJob();
+  handle = sleeper->GetHandle();
+  man.SubmitJob(sleeper);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(waiting);
+  sleeper->Cancel();
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_FALSE(ran.load());
+  EXPECT_TRUE(destroyed.load());
+}
+
+TEST(ManagerTests, CoroutinesSeveralManagers)
+{
+  // This thread's latest worker belongs to the second manager, but the
+  // task belongs to the first, which has no other threads to run it on
+  Manager first(1);
+  Manager second(2);
+
+  std::thread::id resumedOn;
+  Job* task = [](std::thread::id& resumedOn) -> JobTask {
+    co_await Submit(Job::Create([]() {}));
+    resumedOn = std::this_thread::get_id();
+  }(resumedOn).GetJob();
+  JobHandle handle = task->GetHandle();
+  first.SubmitJob(task);
+  first.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_EQ(std::this_thread::get_id(), resumedOn)
+      << "Task should stay with the manager it was submitted to";
+}
+#endif
+
+TEST(ManagerTests, FiberWaits)
+{
+  Manager man(1);
+  if (!man.SetFiberMode(true))
+  {
+    return;
+  }
+  EXPECT_TRUE(man.GetFiberMode());
+
+  // The first job waits on a quick one, but the worker takes the job it
+  // submitted after that first, which waits for the first job to finish.
+  // Run on top of the first job that would never end, but with fibers the
+  // first job carries on as soon as the quick one is done
+  std::atomic_bool firstDone(false);
+  std::atomic_bool secondDone(false);
+  Job* first = Job::Create([&](Job* job) {
+    UNUSED(job);
+    Job* quick       = Job::Create(Job1);
+    JobHandle handle = quick->GetHandle();
+    man.SubmitJob(quick);
+    man.SubmitJob(Job::Create([&]() {
+      man.GetThisThreadsWorker()->WorkWhileWaitingFor(firstDone);
+      secondDone = true;
+    }));
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+    firstDone = true;
+  });
+  JobHandle handle = first->GetHandle();
+  man.SubmitJob(first);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+
+  EXPECT_TRUE(firstDone.load());
+
+  // The second job may still be put aside, and carries on as soon as the
+  // thread waits again
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(secondDone);
+  EXPECT_TRUE(secondDone.load());
+
+  EXPECT_TRUE(man.SetFiberMode(false));
+  EXPECT_FALSE(man.GetFiberMode());
+}
+
+TEST(ManagerTests, FiberThreadResumes)
+{
+  Manager man(1);
+  if (!man.SetFiberMode(true))
+  {
+    return;
+  }
+
+  // A job put aside waits on something the thread only does once its own
+  // wait is over, so the thread has to carry on while the job is waiting
+  std::atomic_bool jobWaiting(false);
+  std::atomic_bool threadCarriedOn(false);
+  Job* job = Job::Create([&]() {
+    jobWaiting = true;
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(threadCarriedOn);
+  });
+  JobHandle handle = job->GetHandle();
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(jobWaiting);
+
+  threadCarriedOn = true;
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_TRUE(handle.IsFinished());
+
+  // Jobs still waiting when the workers stop are finished before the
+  // thread leaves its worker
+  std::atomic_bool stopped(false);
+  job = Job::Create([&]() {
+    jobWaiting = true;
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(stopped);
+  });
+  handle     = job->GetHandle();
+  jobWaiting = false;
+  man.SubmitJob(job);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(jobWaiting);
+  stopped = true;
+  EXPECT_TRUE(man.SetFiberMode(false));
+  EXPECT_TRUE(handle.IsFinished());
+}
+
+TEST(ManagerTests, FiberJobs)
+{
+  Manager man(4);
+  if (!man.SetFiberMode(true, 64 * 1024))
+  {
+    return;
+  }
+
+  // Lots of jobs waiting on each other all at once
+  EXPECT_EQ(144, FutureFibonacci(man, 12));
+
+  // Exceptions still reach whoever is waiting, through jobs that waited
+  Job* root = Job::Create([&man](Job* job) {
+    Job* thrower = Job::CreateChild(ThrowingJob, job);
+    man.SubmitJob(thrower);
+    man.GetThisThreadsWorker()->WorkWhileWaitingFor(thrower->GetHandle());
+  });
+  JobHandle handle = root->GetHandle();
+  man.SubmitJob(root);
+  EXPECT_THROW(man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle),
+               std::runtime_error);
+
+  // Fibers are dropped along with the workers
+  man.SetIdlePolicy(Worker::IdlePolicy::PowerSaving);
+  EXPECT_TRUE(man.GetFiberMode());
+  EXPECT_EQ(144, FutureFibonacci(man, 12));
+}
+
+TEST(ManagerTests, CompensatingWorkers)
+{
+  // The only worker takes a blocking job that waits until the other jobs
+  // have all run, which only works if another worker fills in for it
+  Manager man(1);
+  EXPECT_EQ(0u, man.GetCompensatingWorkerCount());
+
+  std::atomic_int cpuJobsRun(0);
+  std::atomic_bool released(false);
+  Job* root        = Job::Create(Job1);
+  JobHandle handle = root->GetHandle();
+  for (int i = 0; i < 100; ++i)
+  {
+    man.SubmitJob(Job::CreateChild(
+        [&]() {
+          if (++cpuJobsRun == 100) released = true;
+        },
+        root));
+  }
+
+  // The worker takes the newest jobs first, so these come before the rest.
+  // IO jobs count as blocking without being marked
+  for (int i = 0; i < 3; ++i)
+  {
+    Job* io = Job::CreateChild(
+        [&released]() {
+          while (!released)
+          {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        },
+        root, JobType::IO);
+    man.SubmitJob(io);
+  }
+  man.SubmitJob(root);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_EQ(100, cpuJobsRun.load());
+
+  // Compensating workers retire once nobody is blocked
+  const auto giveUp =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (man.GetCompensatingWorkerCount() != 0 &&
+         std::chrono::steady_clock::now() < giveUp)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(0u, man.GetCompensatingWorkerCount());
+
+  // Jobs can also say when they block from inside, and retired workers
+  // come back for them
+  man.SetMaxCompensatingWorkers(1);
+  EXPECT_EQ(1u, man.GetMaxCompensatingWorkers());
+  released = false;
+
+  Job* blocker = Job::Create([&man, &released]() {
+    man.BeginBlocking();
+    while (!released)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    man.EndBlocking();
+  });
+  handle = blocker->GetHandle();
+
+  // The worker takes the newest job first, so the blocker goes last
+  man.SubmitJob(Job::Create([&released]() { released = true; }));
+  man.SubmitJob(blocker);
+  man.GetThisThreadsWorker()->WorkWhileWaitingFor(handle);
+  EXPECT_TRUE(released.load());
+}
+
+TEST(ManagerTests, CompensatingWorkersWoken)
+{
+  typedef std::chrono::steady_clock Clock;
+  constexpr int jobs = 10;
+
+  // The main thread doesn't work here, and the only other worker is
+  // blocked throughout, so a compensating worker that has gone to sleep
+  // has to be woken for each job
+  Manager man(2, JobPool::scDefaultInitialCapacity, 0,
+              Worker::IdlePolicy::PowerSaving);
+
+  std::atomic_bool started(false);
+  std::atomic_bool released(false);
+  Job* blocker = Job::Create([&]() {
+    started = true;
+    while (!released)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  blocker->SetBlocking(true);
+  JobHandle handle = blocker->GetHandle();
+  man.SubmitJob(blocker);
+  while (!started)
+  {
+    std::this_thread::yield();
+  }
+
+  // Compensating workers sleep until they are woken, so a job that runs
+  // at all was woken for. The time limit is only there to fail instead of
+  // hanging
+  std::atomic_int ran(0);
+  for (int i = 0; i < jobs; ++i)
+  {
+    // Long enough for the compensating worker to go to sleep
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    man.SubmitJob(Job::Create([&ran]() { ++ran; }));
+
+    const Clock::time_point giveUp = Clock::now() + std::chrono::seconds(5);
+    while (ran.load() <= i && Clock::now() < giveUp)
+    {
+      std::this_thread::yield();
+    }
+    if (ran.load() <= i) break;
+  }
+
+  released = true;
+  while (!handle.IsFinished())
+  {
+    std::this_thread::yield();
+  }
+
+  EXPECT_EQ(jobs, ran.load())
+      << "Compensating workers should be woken when jobs are submitted";
+}
+
+TEST(ManagerTests, CompensatingWorkerStats)
+{
+  typedef std::chrono::steady_clock Clock;
+  constexpr int jobs = 10;
+
+  // The main thread doesn't work here, and the only other worker is
+  // blocked throughout, so a compensating worker runs every job
+  Manager man(2);
+  man.SetWaitTracking(true);
+
+  std::atomic_bool started(false);
+  std::atomic_bool released(false);
+  Job* blocker = Job::Create([&]() {
+    started = true;
+    while (!released)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  blocker->SetBlocking(true);
+  JobHandle handle = blocker->GetHandle();
+  man.SubmitJob(blocker);
+  while (!started)
+  {
+    std::this_thread::yield();
+  }
+
+  std::atomic_int ran(0);
+  for (int i = 0; i < jobs; ++i)
+  {
+    Job* job = Job::Create([&ran]() { ++ran; });
+    job->SetDeadline(Clock::now() - std::chrono::milliseconds(2));
+    man.SubmitJob(job);
+  }
+
+  const Clock::time_point giveUp = Clock::now() + std::chrono::seconds(5);
+  while (ran.load() < jobs && Clock::now() < giveUp)
+  {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(jobs, ran.load()) << "Compensating worker never ran the jobs";
+
+  // Counted while the compensating worker is around
+  Worker::DeadlineStats deadlines = man.GetDeadlineStats();
+  EXPECT_EQ(static_cast<std::uint64_t>(jobs), deadlines.deadlineJobs);
+  EXPECT_EQ(static_cast<std::uint64_t>(jobs), deadlines.missedDeadlines);
+
+  std::uint64_t timed = 0;
+  Worker::PriorityStats waits = man.GetPriorityStats();
+  for (unsigned priority = 0; priority < Job::NUM_PRIORITIES; ++priority)
+  {
+    timed += waits.timedJobs[priority];
+  }
+  EXPECT_GE(timed, static_cast<std::uint64_t>(jobs));
+
+  released = true;
+  while (!handle.IsFinished())
+  {
+    std::this_thread::yield();
+  }
+
+  // And after it has gone
+  man.StopWorkers();
+  deadlines = man.GetDeadlineStats();
+  EXPECT_EQ(static_cast<std::uint64_t>(jobs), deadlines.deadlineJobs)
+      << "Stats of exited compensating workers should be kept";
+  EXPECT_EQ(static_cast<std::uint64_t>(jobs), deadlines.missedDeadlines);
+}
+
+TEST(ManagerTests, CompensationDelay)
+{
+  Manager man(2);
+  EXPECT_EQ(std::chrono::milliseconds(1), man.GetCompensationDelay());
+
+  // The main thread doesn't work here, so the other worker takes each of
+  // these (which could be a graphics worker, so they aren't IO jobs). One
+  // that is over well before the delay isn't filled in for
+  man.SetCompensationDelay(std::chrono::seconds(1));
+  EXPECT_EQ(std::chrono::seconds(1), man.GetCompensationDelay());
+
+  std::atomic_bool started(false);
+  std::atomic_bool released(false);
+  auto blockingJob = [&]() {
+    started = true;
+    while (!released)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  Job* job = Job::Create(blockingJob);
+  job->SetBlocking(true);
+  JobHandle handle = job->GetHandle();
+  man.SubmitJob(job);
+  while (!started)
+  {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(0u, man.GetCompensatingWorkerCount());
+  released = true;
+  while (!handle.IsFinished())
+  {
+    std::this_thread::yield();
+  }
+
+  // With no delay, one is brought in as soon as the watcher gets to it
+  man.SetCompensationDelay(std::chrono::microseconds::zero());
+  started  = false;
+  released = false;
+  job      = Job::Create(blockingJob);
+  handle   = job->GetHandle();
+  job->SetBlocking(true);
+  man.SubmitJob(job);
+
+  const auto giveUp =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (man.GetCompensatingWorkerCount() == 0 &&
+         std::chrono::steady_clock::now() < giveUp)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(1u, man.GetCompensatingWorkerCount());
+  released = true;
+  while (!handle.IsFinished())
+  {
+    std::this_thread::yield();
+  }
+}